@@ -0,0 +1,75 @@
+#include "events.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Jobs per second through EventLoop: posted jobs, and timeouts with the handle kept.
+// Each iteration queues a batch, the callables capture a shared_ptr like most real ones do.
+
+namespace {
+
+constexpr std::size_t TOTAL_JOBS = 10'000'000;
+constexpr std::size_t BATCH = 1000;
+
+double seconds_since(std::chrono::steady_clock::time_point started) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+void bench_post() {
+  auto event_loop = EventLoop::make();
+  auto payload = std::make_shared<std::string>("x");
+
+  std::size_t posted = 0;
+  std::size_t ran = 0;
+  auto driver = event_loop->repeat([&]() {
+    if (posted >= TOTAL_JOBS) {
+      event_loop->stop();
+      return;
+    }
+
+    for (std::size_t i = 0; i < BATCH; ++i, ++posted) {
+      event_loop->post([&ran, payload]() {
+        ++ran;
+      }).forget();
+    }
+  });
+
+  auto started = std::chrono::steady_clock::now();
+  event_loop->start();
+  std::printf("post:    %6.1f M jobs/s (%zu jobs)\n", ran / seconds_since(started) / 1e6, ran);
+}
+
+void bench_timeout() {
+  auto event_loop = EventLoop::make();
+
+  std::size_t ran = 0;
+  std::vector<EventLoop::JobHandle> handles;
+  auto driver = event_loop->repeat([&]() {
+    if (ran >= TOTAL_JOBS / 4) {
+      event_loop->stop();
+      return;
+    }
+
+    handles.clear();
+    for (std::size_t i = 0; i < BATCH; ++i) {
+      handles.push_back(event_loop->set_timeout(0, [&ran]() {
+        ++ran;
+      }));
+    }
+  });
+
+  auto started = std::chrono::steady_clock::now();
+  event_loop->start();
+  std::printf("timeout: %6.1f M jobs/s (%zu jobs)\n", ran / seconds_since(started) / 1e6, ran);
+}
+
+} // namespace
+
+int main() {
+  bench_post();
+  bench_timeout();
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "poller.h"
+#include "signal_slot.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+// Nanoseconds per dispatched event: poll readiness through the Callback each socket registers
+// with the poller, and a wiring Signal emitting to a Slot.
+
+namespace {
+
+constexpr std::size_t SOCKETS = 1000;
+constexpr std::size_t ROUNDS = 20'000;
+constexpr std::size_t EMITS = 20'000'000;
+
+struct Socket {
+  std::size_t events = 0;
+
+  void on_poll_event(PollEventType type) {
+    this->events += type == PollEventType::ReadyToRead ? 1 : 2;
+  }
+};
+
+double nanoseconds_since(std::chrono::steady_clock::time_point started) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+}
+
+std::size_t bench_poll_dispatch() {
+  std::vector<std::unique_ptr<Socket>> sockets;
+  std::vector<PollCallback> callbacks;
+  for (std::size_t i = 0; i < SOCKETS; ++i) {
+    sockets.push_back(std::make_unique<Socket>());
+    callbacks.push_back(PollCallback::bind<&Socket::on_poll_event>(sockets.back().get()));
+  }
+
+  auto started = std::chrono::steady_clock::now();
+  for (std::size_t round = 0; round < ROUNDS; ++round) {
+    for (std::size_t i = 0; i < SOCKETS; ++i) {
+      // copied out first like the poller does, a callback may register more sockets
+      auto callback = callbacks[i];
+      callback(PollEventType::ReadyToRead);
+    }
+  }
+  std::printf("poll dispatch: %5.2f ns/event\n", nanoseconds_since(started) / (SOCKETS * ROUNDS));
+
+  std::size_t events = 0;
+  for (const auto& socket : sockets) {
+    events += socket->events;
+  }
+  return events;
+}
+
+std::size_t bench_signal_emit() {
+  std::size_t sum = 0;
+  auto signal = std::make_shared<Signal<std::size_t>>();
+  auto slot = std::make_shared<Slot<std::size_t>>([&sum](std::size_t value) {
+    sum += value;
+  });
+  signal->connect(slot);
+
+  auto started = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < EMITS; ++i) {
+    signal->emit(i);
+  }
+  std::printf("signal emit:   %5.2f ns/event\n", nanoseconds_since(started) / EMITS);
+
+  return sum;
+}
+
+} // namespace
+
+int main() {
+  // printed so that the work can not be optimized away
+  auto checksum = bench_poll_dispatch() + bench_signal_emit();
+  std::printf("(%zu)\n", checksum);
+  return 0;
+}
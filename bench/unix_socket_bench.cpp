@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// PING round trips from one client, over TCP and over the unix socket of the same server.
+// The server binary is started with both listeners: unix_socket_bench [server] [port] [pings]
+
+namespace {
+
+constexpr std::size_t WARMUP_PINGS = 1000;
+constexpr std::string_view PING = "*1\r\n$4\r\nPING\r\n";
+constexpr std::string_view PONG = "+PONG\r\n";
+
+std::runtime_error system_error(const char* what) {
+  std::ostringstream ss;
+  ss << what << ": " << strerror(errno);
+  return std::runtime_error(ss.str());
+}
+
+std::optional<int> connect_tcp(int port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return {};
+  }
+
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+std::optional<int> connect_unix(const std::string& path) {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return {};
+  }
+  return fd;
+}
+
+// the server takes a moment to bind, both listeners are tried until they answer
+template <typename Connect>
+int wait_connect(Connect connect) {
+  for (int attempt = 0; attempt < 500; ++attempt) {
+    if (auto fd = connect()) {
+      return fd.value();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+  throw std::runtime_error("Server did not come up");
+}
+
+void ping(int fd) {
+  if (::write(fd, PING.data(), PING.size()) != static_cast<ssize_t>(PING.size())) {
+    throw system_error("write");
+  }
+
+  char reply[PONG.size()];
+  std::size_t received = 0;
+  while (received < PONG.size()) {
+    auto read = ::read(fd, reply + received, PONG.size() - received);
+    if (read <= 0) {
+      throw system_error("read");
+    }
+    received += read;
+  }
+}
+
+void bench(const char* name, int fd, std::size_t pings) {
+  for (std::size_t i = 0; i < WARMUP_PINGS; ++i) {
+    ping(fd);
+  }
+
+  std::vector<double> rtt_us;
+  rtt_us.reserve(pings);
+  for (std::size_t i = 0; i < pings; ++i) {
+    auto started = std::chrono::steady_clock::now();
+    ping(fd);
+    rtt_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count());
+  }
+
+  std::sort(rtt_us.begin(), rtt_us.end());
+  std::printf("%-5s PING rtt p50 %6.1f us, p99 %6.1f us (%zu pings)\n",
+    name, rtt_us[pings / 2], rtt_us[pings * 99 / 100], pings);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const std::string server = argc > 1 ? argv[1] : SERVER_BINARY;
+  const int port = argc > 2 ? std::atoi(argv[2]) : 16379;
+  const std::size_t pings = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 100'000;
+
+  const std::string socket_path = "/tmp/unix_socket_bench." + std::to_string(::getpid()) + ".sock";
+  const std::string port_arg = std::to_string(port);
+
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::execl(server.c_str(), server.c_str(), "--port", port_arg.c_str(), "--unixsocket", socket_path.c_str(), nullptr);
+    std::perror("exec");
+    ::_exit(127);
+  }
+
+  int code = 0;
+  try {
+    int tcp_fd = wait_connect([port]() { return connect_tcp(port); });
+    int unix_fd = wait_connect([&socket_path]() { return connect_unix(socket_path); });
+
+    bench("tcp", tcp_fd, pings);
+    bench("unix", unix_fd, pings);
+
+    ::close(tcp_fd);
+    ::close(unix_fd);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    code = 1;
+  }
+
+  ::kill(pid, SIGTERM);
+  ::waitpid(pid, nullptr, 0);
+  ::unlink(socket_path.c_str());
+  return code;
+}
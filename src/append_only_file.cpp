@@ -0,0 +1,570 @@
+#include "append_only_file.h"
+
+#include "debug.h"
+#include "intset.h"
+#include "listpack.h"
+#include "persistence.h"
+#include "rdb_parser.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t FSYNC_INTERVAL_MS = 1000;
+// everysec: how long a write may wait for the running fsync before it goes anyway
+constexpr auto MAX_WRITE_POSTPONE = std::chrono::seconds{2};
+// the clock is read once per that many commands replayed
+constexpr std::size_t LOAD_CLOCK_CHECK_COMMANDS = 1024;
+
+void write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto written = ::write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      std::ostringstream ss;
+      ss << "Error writing the rewritten AOF: " << strerror(errno);
+      throw std::runtime_error(ss.str());
+    }
+
+    data.remove_prefix(written);
+  }
+}
+
+// Splits one command off the front of data, args point into data.
+// Returns the command size, or 0 while it is not complete yet.
+std::size_t parse_command(std::string_view data, std::vector<std::string_view>& args) {
+  args.clear();
+  std::size_t pos = 0;
+
+  auto read_number = [&](char type) -> std::optional<std::size_t> {
+    if (pos >= data.size()) {
+      return {};
+    }
+
+    if (data[pos] != type) {
+      throw std::runtime_error(print_args("Bad file format reading the append only file: expected '", type, "'"));
+    }
+
+    auto end = data.find("\r\n", pos);
+    if (end == data.npos) {
+      return {};
+    }
+
+    auto number = parseUInt64(data.substr(pos + 1, end - pos - 1));
+    if (!number) {
+      throw std::runtime_error("Bad file format reading the append only file: invalid length");
+    }
+
+    pos = end + 2;
+    return number.value();
+  };
+
+  auto count = read_number('*');
+  if (!count) {
+    return 0;
+  }
+
+  for (std::size_t i = 0; i < count.value(); ++i) {
+    auto size = read_number('$');
+    if (!size || pos + size.value() + 2 > data.size()) {
+      return 0;
+    }
+
+    args.push_back(data.substr(pos, size.value()));
+    pos += size.value() + 2;
+  }
+
+  return pos;
+}
+
+// only elements that print back the same count as integers, "007" stays a string
+std::optional<std::int64_t> element_integer(std::string_view element) {
+  std::int64_t value;
+  auto [ptr, ec] = std::from_chars(element.data(), element.data() + element.size(), value);
+  if (ec == std::errc() && ptr == element.data() + element.size() && std::to_string(value) == element) {
+    return value;
+  }
+  return {};
+}
+
+void append_element(ListpackWriter& lp, std::string_view element) {
+  if (auto value = element_integer(element)) {
+    lp.integer(value.value());
+  } else {
+    lp.string(element);
+  }
+}
+
+// sets of integers only are kept as intsets, like Redis does
+std::optional<std::string> try_intset(const std::vector<std::string_view>& args) {
+  std::vector<std::int64_t> values;
+  values.reserve(args.size() - 2);
+  for (std::size_t i = 2; i < args.size(); ++i) {
+    auto value = element_integer(args[i]);
+    if (!value) {
+      return {};
+    }
+    values.push_back(value.value());
+  }
+
+  return intset_encode(std::move(values));
+}
+
+// Aggregates are only logged for full syncs from a master, as one command holding all elements.
+void apply_aggregate(RDBAggregate::Type type, const std::vector<std::string_view>& args, IStorage& storage) {
+  if (type == RDBAggregate::Type::Set) {
+    if (auto data = try_intset(args)) {
+      auto length = IntsetReader(data.value()).size();
+      storage.restore_aggregate(std::string(args[1]), {type, RDBAggregate::Encoding::Intset, std::move(data.value()), length}, {});
+      return;
+    }
+  }
+
+  ListpackWriter lp;
+  if (type == RDBAggregate::Type::ZSet) {
+    for (std::size_t i = 2; i < args.size(); i += 2) {
+      append_element(lp, args[i + 1]);
+      append_element(lp, args[i]);
+    }
+  } else {
+    for (std::size_t i = 2; i < args.size(); ++i) {
+      append_element(lp, args[i]);
+    }
+  }
+
+  const bool pairs = type == RDBAggregate::Type::ZSet || type == RDBAggregate::Type::Hash;
+  RDBAggregate value{type, RDBAggregate::Encoding::Listpack, lp.finish(), (args.size() - 2) / (pairs ? 2 : 1)};
+  storage.restore_aggregate(std::string(args[1]), std::move(value), {});
+}
+
+void apply_command(const std::vector<std::string_view>& args, IStorage& storage) {
+  if (args.empty()) {
+    throw std::runtime_error("Bad file format reading the append only file: empty command");
+  }
+
+  const auto name = args[0];
+
+  if (equals_ignore_case(name, "set") && (args.size() == 3 || args.size() == 5)) {
+    std::optional<Timepoint> expire_time;
+    if (args.size() == 5) {
+      auto at = parseUInt64(args[4]);
+      if (!equals_ignore_case(args[3], "pxat") || !at) {
+        throw std::runtime_error("Unsupported SET options in the append only file");
+      }
+      expire_time = Timepoint(std::chrono::milliseconds(at.value()));
+    }
+
+    storage.restore(std::string(args[1]), std::string(args[2]), expire_time);
+
+  } else if (equals_ignore_case(name, "xadd") && args.size() >= 5 && args.size() % 2 == 1) {
+    StreamPartValue values;
+    values.reserve((args.size() - 3) / 2);
+    for (std::size_t i = 3; i < args.size(); i += 2) {
+      values.emplace_back(args[i], args[i + 1]);
+    }
+
+    auto [id, error] = storage.xadd(std::string(args[1]), InputStreamId(args[2]), std::move(values));
+    if (error != StreamErrorType::None) {
+      throw std::runtime_error(print_args("XADD from the append only file was rejected, id ", args[2]));
+    }
+
+  } else if (equals_ignore_case(name, "rpush") && args.size() >= 3) {
+    apply_aggregate(RDBAggregate::Type::List, args, storage);
+
+  } else if (equals_ignore_case(name, "sadd") && args.size() >= 3) {
+    apply_aggregate(RDBAggregate::Type::Set, args, storage);
+
+  } else if (equals_ignore_case(name, "zadd") && args.size() >= 4 && args.size() % 2 == 0) {
+    apply_aggregate(RDBAggregate::Type::ZSet, args, storage);
+
+  } else if (equals_ignore_case(name, "hset") && args.size() >= 4 && args.size() % 2 == 0) {
+    apply_aggregate(RDBAggregate::Type::Hash, args, storage);
+
+  } else if (equals_ignore_case(name, "pexpireat") && args.size() == 3) {
+    auto at = parseUInt64(args[2]);
+    if (!at) {
+      throw std::runtime_error("Bad PEXPIREAT deadline in the append only file");
+    }
+
+    storage.expire_at(std::string(args[1]), Timepoint(std::chrono::milliseconds(at.value())));
+
+  } else if (equals_ignore_case(name, "flushall")) {
+    storage.clear();
+
+  } else if (!equals_ignore_case(name, "select") && !equals_ignore_case(name, "multi") && !equals_ignore_case(name, "exec")) {
+    throw std::runtime_error(print_args("Unknown command '", name, "' reading the append only file"));
+  }
+}
+
+} // namespace
+
+AppendOnlyFile::AppendOnlyFile(EventLoopPtr event_loop)
+  : _event_loop(event_loop)
+{
+  this->_start_handle = this->_event_loop->post([this]() {
+    this->start();
+  });
+}
+
+AppendOnlyFile::~AppendOnlyFile() {
+  if (this->_bio_thread.joinable()) {
+    {
+      std::lock_guard lock(this->_bio_mutex);
+      this->_bio_stop = true;
+    }
+    this->_bio_cv.notify_one();
+    this->_bio_thread.join();
+  }
+
+  if (this->_fd >= 0) {
+    if (!this->_buffer.empty()) {
+      [[maybe_unused]] auto written = ::write(this->_fd, this->_buffer.data(), this->_buffer.size());
+    }
+    ::fdatasync(this->_fd);
+    ::close(this->_fd);
+  }
+}
+
+void AppendOnlyFile::set_server(ServerPtr server) {
+  this->_server = std::move(server);
+}
+
+void AppendOnlyFile::set_storage(IStoragePtr storage) {
+  this->_storage = std::move(storage);
+}
+
+void AppendOnlyFile::open() {
+  auto& persistence = this->_server->info().persistence;
+  const auto path = this->_server->info().aof_file_path();
+
+  // the data loaded from RDB, if any, has to be in the log as well
+  if (!std::filesystem::exists(path)) {
+    RDBSave(path, *this->_storage, this->_server->info().persistence.rdb_checksum);
+  }
+
+  this->_fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (this->_fd < 0) {
+    std::ostringstream ss;
+    ss << "Can't open the append-only file " << path.string() << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  persistence.aof_current_size = std::filesystem::file_size(path);
+  persistence.aof_base_size = persistence.aof_current_size;
+}
+
+void AppendOnlyFile::feed(std::string_view command) {
+  this->_buffer.append(command);
+  ++this->_buffer_commands;
+
+  if (this->_rewrite_buffer) {
+    this->_rewrite_buffer->append(command);
+  }
+}
+
+void AppendOnlyFile::rewrite_started() {
+  this->_rewrite_buffer.emplace();
+}
+
+void AppendOnlyFile::rewrite_done(const std::filesystem::path& base_path) {
+  auto& persistence = this->_server->info().persistence;
+  const auto path = this->_server->info().aof_file_path();
+
+  int fd = ::open(base_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0) {
+    std::ostringstream ss;
+    ss << "Can't open the rewritten AOF " << base_path.string() << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  try {
+    write_all(fd, this->_rewrite_buffer.value());
+
+    if (persistence.aof_fsync == ServerInfo::Persistence::AppendFsync::Always && ::fdatasync(fd) != 0) {
+      std::ostringstream ss;
+      ss << "Failed to fsync the rewritten AOF: " << strerror(errno);
+      throw std::runtime_error(ss.str());
+    }
+
+    if (::rename(base_path.c_str(), path.c_str()) != 0) {
+      std::ostringstream ss;
+      ss << "Error moving the rewritten AOF " << base_path.string() << " to " << path.string() << ": " << strerror(errno);
+      throw std::runtime_error(ss.str());
+    }
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+
+  auto dir = path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path();
+  int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+
+  // whatever is still buffered was fed after the fork, so the new file has it already
+  persistence.aof_written_commands += this->_buffer_commands;
+  this->_buffer.clear();
+  this->_buffer_commands = 0;
+  this->_postponed_since.reset();
+  this->_rewrite_buffer.reset();
+
+  // the old file goes away with its last descriptor, freeing its blocks may take a while
+  const int old_fd = std::exchange(this->_fd, fd);
+  this->bio_post([old_fd]() {
+    ::close(old_fd);
+  });
+  this->_unsynced = persistence.aof_fsync != ServerInfo::Persistence::AppendFsync::Always;
+
+  persistence.aof_current_size = std::filesystem::file_size(path);
+  persistence.aof_base_size = persistence.aof_current_size;
+  persistence.aof_buffer_length = 0;
+  persistence.aof_rewrite_buffer_length = 0;
+}
+
+void AppendOnlyFile::rewrite_failed() {
+  this->_rewrite_buffer.reset();
+  this->_server->info().persistence.aof_rewrite_buffer_length = 0;
+}
+
+void AppendOnlyFile::start() {
+  // The poller job is registered before this one and every connection handler after,
+  // so commands read in an iteration are written out before their replies.
+  this->_flush_handle = this->_event_loop->repeat([this]() {
+    this->flush();
+  });
+
+  this->_bio_thread = std::thread([this]() {
+    this->bio_loop();
+  });
+
+  if (this->_server->info().persistence.aof_fsync == ServerInfo::Persistence::AppendFsync::EverySec) {
+    this->schedule_cron();
+  }
+}
+
+void AppendOnlyFile::flush() {
+  if (this->_buffer.empty()) {
+    return;
+  }
+
+  using AppendFsync = ServerInfo::Persistence::AppendFsync;
+  auto& persistence = this->_server->info().persistence;
+
+  if (this->_rewrite_buffer) {
+    persistence.aof_rewrite_buffer_length = this->_rewrite_buffer->size();
+  }
+
+  // write() to a file being fsynced blocks until the fsync is done, its completion wakes
+  // the loop and so does the everysec cron, that is when the postponed write is retried
+  if (persistence.aof_fsync == AppendFsync::EverySec && this->_fsync_in_progress) {
+    auto now = std::chrono::steady_clock::now();
+    if (!this->_postponed_since) {
+      this->_postponed_since = now;
+      return;
+    }
+    if (now - this->_postponed_since.value() < MAX_WRITE_POSTPONE) {
+      return;
+    }
+
+    persistence.aof_delayed_fsync += 1;
+    std::cerr << "Asynchronous AOF fsync is taking too long (disk is busy?). "
+      << "Writing the AOF buffer without waiting for fsync to complete, this may slow down the server." << std::endl;
+  }
+  this->_postponed_since.reset();
+
+  auto written = ::write(this->_fd, this->_buffer.data(), this->_buffer.size());
+
+  if (persistence.aof_fsync == AppendFsync::Always && written != static_cast<ssize_t>(this->_buffer.size())) {
+    std::cerr << "Can't recover from AOF write error when the AOF fsync policy is 'always': "
+      << (written < 0 ? strerror(errno) : "short write") << ". Exiting..." << std::endl;
+    std::exit(1);
+  }
+
+  if (written < 0) {
+    if (errno != EINTR && errno != EAGAIN && persistence.aof_last_write_status == "ok") {
+      std::cerr << "Error writing to the AOF file: " << strerror(errno) << std::endl;
+      persistence.aof_last_write_status = "err";
+    }
+    return;
+  }
+
+  // the rest of a short write goes with the next iteration
+  this->_buffer.erase(0, written);
+  if (!this->_buffer.empty()) {
+    this->_event_loop->keep_awake();
+  } else {
+    persistence.aof_written_commands += this->_buffer_commands;
+    this->_buffer_commands = 0;
+  }
+
+  persistence.aof_current_size += written;
+  persistence.aof_buffer_length = this->_buffer.size();
+  persistence.aof_writes += 1;
+  if (persistence.aof_last_write_status != "ok") {
+    std::cerr << "AOF write error looks solved, can write again." << std::endl;
+    persistence.aof_last_write_status = "ok";
+  }
+
+  if (persistence.aof_fsync == AppendFsync::Always) {
+    if (::fdatasync(this->_fd) != 0) {
+      std::cerr << "Can't persist AOF for fsync error when the AOF fsync policy is 'always': "
+        << strerror(errno) << ". Exiting..." << std::endl;
+      std::exit(1);
+    }
+  } else {
+    this->_unsynced = true;
+  }
+}
+
+void AppendOnlyFile::schedule_cron() {
+  this->_cron_handle = this->_event_loop->set_timeout(FSYNC_INTERVAL_MS, [this]() {
+    this->cron();
+    this->schedule_cron();
+  });
+}
+
+void AppendOnlyFile::cron() {
+  if (this->_unsynced && !this->_fsync_in_progress) {
+    this->request_fsync();
+  }
+}
+
+void AppendOnlyFile::request_fsync() {
+  this->_unsynced = false;
+  this->_fsync_in_progress = true;
+  this->_server->info().persistence.aof_pending_bio_fsync = true;
+
+  this->bio_post([this, fd = this->_fd]() {
+    if (::fdatasync(fd) != 0) {
+      std::cerr << "Error syncing the AOF file: " << strerror(errno) << std::endl;
+    }
+
+    // a write held back by this fsync goes out in the iteration the loop takes this
+    this->_event_loop->post_threadsafe([this]() {
+      this->_fsync_in_progress = false;
+      this->_server->info().persistence.aof_pending_bio_fsync = false;
+    });
+  });
+}
+
+void AppendOnlyFile::bio_post(std::function<void()> job) {
+  {
+    std::lock_guard lock(this->_bio_mutex);
+    this->_bio_jobs.push_back(std::move(job));
+  }
+  this->_bio_cv.notify_one();
+}
+
+// jobs run in order, so a file is never closed before its pending fsync
+void AppendOnlyFile::bio_loop() {
+  std::unique_lock lock(this->_bio_mutex);
+
+  while (true) {
+    this->_bio_cv.wait(lock, [this]() {
+      return !this->_bio_jobs.empty() || this->_bio_stop;
+    });
+
+    if (this->_bio_jobs.empty()) {
+      return;
+    }
+
+    auto job = std::move(this->_bio_jobs.front());
+    this->_bio_jobs.pop_front();
+    lock.unlock();
+
+    job();
+
+    lock.lock();
+  }
+}
+
+AOFLoader::AOFLoader(const std::filesystem::path& path, bool verify_checksum)
+  : _path(path)
+{
+  this->_file.emplace(path);
+  const auto data = this->_file->data();
+  this->_stats.total_bytes = data.size();
+
+  if (data.starts_with("REDIS")) {
+    this->_preamble.emplace(data, verify_checksum);
+  }
+}
+
+AOFLoader::~AOFLoader() = default;
+
+bool AOFLoader::step(IStorage& storage, std::chrono::steady_clock::duration budget) {
+  const auto deadline = std::chrono::steady_clock::now() + budget;
+
+  if (this->_preamble) {
+    bool done = this->_preamble->step(storage, budget);
+    this->_stats = this->_preamble->progress();
+    if (!done) {
+      return false;
+    }
+
+    this->_pos = this->_preamble->rdb_size();
+    this->_preamble.reset();
+  }
+
+  const auto data = this->_file->data();
+  std::vector<std::string_view> args;
+  while (this->_pos < data.size()) {
+    if (this->_commands % LOAD_CLOCK_CHECK_COMMANDS == 0 && std::chrono::steady_clock::now() >= deadline) {
+      this->_stats.loaded_bytes = this->_pos;
+      return false;
+    }
+
+    auto size = parse_command(data.substr(this->_pos), args);
+    if (size == 0) {
+      break;
+    }
+
+    apply_command(args, storage);
+    this->_pos += size;
+    ++this->_commands;
+  }
+
+  this->_stats.loaded_bytes = this->_pos;
+  this->finish();
+  return true;
+}
+
+const RDBLoadProgress& AOFLoader::progress() const {
+  return this->_stats;
+}
+
+void AOFLoader::finish() {
+  const auto file_size = this->_stats.total_bytes;
+  const auto valid_size = this->_pos;
+  this->_file.reset();
+
+  // a crash in the middle of a write leaves a partial command at the tail
+  if (valid_size < file_size) {
+    std::cerr << "!!! Warning: short read while loading the AOF file " << this->_path.string() << "!!!" << std::endl
+      << "!!! Truncating the AOF at offset " << valid_size << " !!!" << std::endl;
+
+    if (::truncate(this->_path.c_str(), valid_size) != 0) {
+      std::ostringstream ss;
+      ss << "Error truncating the AOF file: " << strerror(errno);
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG AOF loaded, commands replayed: " << this->_commands << std::endl;
+}
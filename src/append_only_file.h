@@ -0,0 +1,105 @@
+#pragma once
+
+#include "events.h"
+#include "mapped_file.h"
+#include "rdb_parser.h"
+#include "server.h"
+#include "storage.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Commands fed during a loop iteration are collected in one buffer and reach the
+// file with a single write() before the replies of that iteration are sent.
+class AppendOnlyFile {
+public:
+  AppendOnlyFile(EventLoopPtr event_loop);
+  ~AppendOnlyFile();
+
+  void set_server(ServerPtr);
+  void set_storage(IStoragePtr);
+
+  // Opens the log for appending, a missing one starts with the current dataset as RDB preamble.
+  void open();
+
+  // takes one RESP encoded command
+  void feed(std::string_view command);
+
+  // A forked child is writing the dataset as the new base, writes fed from now on
+  // are kept aside as well and appended to it once it is done.
+  void rewrite_started();
+  void rewrite_done(const std::filesystem::path& base_path);
+  void rewrite_failed();
+
+private:
+  EventLoopPtr _event_loop;
+
+  ServerPtr _server;
+  IStoragePtr _storage;
+
+  int _fd = -1;
+  std::string _buffer;
+  std::size_t _buffer_commands = 0;
+  bool _unsynced = false;
+  std::optional<std::chrono::steady_clock::time_point> _postponed_since;
+
+  std::optional<std::string> _rewrite_buffer;
+
+  // fsync and closing of replaced files run here, so a slow disk never stalls the loop
+  std::thread _bio_thread;
+  std::mutex _bio_mutex;
+  std::condition_variable _bio_cv;
+  std::deque<std::function<void()>> _bio_jobs;
+  bool _bio_stop = false;
+  bool _fsync_in_progress = false; // cleared by a job the bio thread posts back
+
+  EventLoop::JobHandle _start_handle;
+  EventLoop::JobHandle _flush_handle;
+  EventLoop::JobHandle _cron_handle;
+
+  void start();
+
+  void flush();
+  void schedule_cron();
+  void cron();
+
+  void request_fsync();
+  void bio_post(std::function<void()> job);
+  void bio_loop();
+};
+using AppendOnlyFilePtr = std::shared_ptr<AppendOnlyFile>;
+
+// Replays the log into storage in slices, the RDB preamble goes through RDBLoader.
+// Commands are applied straight from the file bytes, no messages or command objects
+// are built for them.
+class AOFLoader {
+public:
+  AOFLoader(const std::filesystem::path& path, bool verify_checksum);
+  ~AOFLoader();
+
+  // Replays until `budget` is used up, returns true once the whole log was applied.
+  // A torn command at the tail is truncated off the file then.
+  bool step(IStorage& storage, std::chrono::steady_clock::duration budget);
+
+  const RDBLoadProgress& progress() const;
+
+private:
+  std::filesystem::path _path;
+  std::optional<MappedFile> _file;
+  std::optional<RDBLoader> _preamble;
+
+  std::size_t _pos = 0;
+  std::size_t _commands = 0;
+  RDBLoadProgress _stats;
+
+  void finish();
+};
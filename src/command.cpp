@@ -57,6 +57,18 @@ CommandPtr Command::try_parse(const Message& message) {
     return XRangeCommand::try_parse(message);
   } else if (command == "xread") {
     return XReadCommand::try_parse(message);
+  } else if (command == "xlen") {
+    return XLenCommand::try_parse(message);
+  } else if (command == "xinfo") {
+    return XInfoCommand::try_parse(message);
+  } else if (command == "save") {
+    return SaveCommand::try_parse(message);
+  } else if (command == "bgsave") {
+    return BgSaveCommand::try_parse(message);
+  } else if (command == "lastsave") {
+    return LastSaveCommand::try_parse(message);
+  } else if (command == "bgrewriteaof") {
+    return BgRewriteAofCommand::try_parse(message);
   }
 
   throw CommandParseError("unknown command");
@@ -390,3 +402,109 @@ Message ConfigCommand::construct() const {
 
   return Message(Message::Type::Array, parts);
 }
+
+
+
+CommandPtr SaveCommand::try_parse(const Message& message) {
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() != 1) {
+    std::ostringstream ss;
+    ss << "SAVE command must have no arguments, recieved " << data.size() - 1;
+    throw CommandParseError(ss.str());
+  }
+
+  return std::make_shared<SaveCommand>();
+}
+
+SaveCommand::SaveCommand() {
+  this->_type = CommandType::Save;
+}
+
+Message SaveCommand::construct() const {
+  std::vector<Message> parts;
+  parts.emplace_back(Message::Type::BulkString, "SAVE");
+  return Message(Message::Type::Array, parts);
+}
+
+
+
+CommandPtr BgSaveCommand::try_parse(const Message& message) {
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() == 1) {
+    return std::make_shared<BgSaveCommand>();
+  }
+
+  if (data.size() != 2 || data[1].type() != Message::Type::BulkString) {
+    throw CommandParseError("BGSAVE command accepts only optional SCHEDULE argument");
+  }
+
+  if (to_lower_case(std::get<std::string>(data[1].getValue())) != "schedule") {
+    throw CommandParseError("BGSAVE command accepts only optional SCHEDULE argument");
+  }
+
+  return std::make_shared<BgSaveCommand>(true);
+}
+
+BgSaveCommand::BgSaveCommand(bool schedule)
+  : _schedule(schedule) {
+  this->_type = CommandType::BgSave;
+}
+
+bool BgSaveCommand::schedule() const {
+  return this->_schedule;
+}
+
+Message BgSaveCommand::construct() const {
+  std::vector<Message> parts;
+  parts.emplace_back(Message::Type::BulkString, "BGSAVE");
+  if (this->_schedule) {
+    parts.emplace_back(Message::Type::BulkString, "SCHEDULE");
+  }
+  return Message(Message::Type::Array, parts);
+}
+
+
+
+CommandPtr LastSaveCommand::try_parse(const Message& message) {
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() != 1) {
+    std::ostringstream ss;
+    ss << "LASTSAVE command must have no arguments, recieved " << data.size() - 1;
+    throw CommandParseError(ss.str());
+  }
+
+  return std::make_shared<LastSaveCommand>();
+}
+
+LastSaveCommand::LastSaveCommand() {
+  this->_type = CommandType::LastSave;
+}
+
+Message LastSaveCommand::construct() const {
+  std::vector<Message> parts;
+  parts.emplace_back(Message::Type::BulkString, "LASTSAVE");
+  return Message(Message::Type::Array, parts);
+}
+
+
+
+CommandPtr BgRewriteAofCommand::try_parse(const Message& message) {
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() != 1) {
+    std::ostringstream ss;
+    ss << "BGREWRITEAOF command must have no arguments, recieved " << data.size() - 1;
+    throw CommandParseError(ss.str());
+  }
+
+  return std::make_shared<BgRewriteAofCommand>();
+}
+
+BgRewriteAofCommand::BgRewriteAofCommand() {
+  this->_type = CommandType::BgRewriteAof;
+}
+
+Message BgRewriteAofCommand::construct() const {
+  std::vector<Message> parts;
+  parts.emplace_back(Message::Type::BulkString, "BGREWRITEAOF");
+  return Message(Message::Type::Array, parts);
+}
@@ -30,6 +30,12 @@ enum class CommandType {
   XAdd,
   XRange,
   XRead,
+  XLen,
+  XInfo,
+  Save,
+  BgSave,
+  LastSave,
+  BgRewriteAof,
 };
 
 class Command;
@@ -165,3 +171,45 @@ private:
   std::string _action;
   std::vector<std::string> _args;
 };
+
+class SaveCommand : public Command {
+public:
+  static CommandPtr try_parse(const Message&);
+
+  SaveCommand();
+
+  Message construct() const override;
+};
+
+class BgSaveCommand : public Command {
+public:
+  static CommandPtr try_parse(const Message&);
+
+  BgSaveCommand(bool schedule = false);
+
+  // SCHEDULE: start once the running child is done instead of failing
+  bool schedule() const;
+
+  Message construct() const override;
+
+private:
+  bool _schedule;
+};
+
+class LastSaveCommand : public Command {
+public:
+  static CommandPtr try_parse(const Message&);
+
+  LastSaveCommand();
+
+  Message construct() const override;
+};
+
+class BgRewriteAofCommand : public Command {
+public:
+  static CommandPtr try_parse(const Message&);
+
+  BgRewriteAofCommand();
+
+  Message construct() const override;
+};
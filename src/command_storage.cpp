@@ -455,3 +455,145 @@ Message XReadCommand::construct() const {
   }
   return Message(Message::Type::Array, parts);
 }
+
+
+
+CommandPtr XLenCommand::try_parse(const Message& message) {
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() != 2) {
+    throw CommandParseError("XLEN expects 1 argument");
+  }
+
+  if (data[1].type() != Message::Type::BulkString) {
+    throw CommandParseError("stream_key has invalid type");
+  }
+
+  return std::make_shared<XLenCommand>(std::get<std::string>(data[1].getValue()));
+}
+
+XLenCommand::XLenCommand(std::string key)
+  : _key(std::move(key)) {
+  this->_type = CommandType::XLen;
+}
+
+const std::string& XLenCommand::key() const {
+  return this->_key;
+}
+
+Message XLenCommand::construct() const {
+  std::vector<Message> parts;
+  parts.emplace_back(Message::Type::BulkString, "XLEN");
+  parts.emplace_back(Message::Type::BulkString, this->_key);
+  return Message(Message::Type::Array, parts);
+}
+
+
+
+CommandPtr XInfoCommand::try_parse(const Message& message) {
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+
+  for (const auto& arg : data) {
+    if (arg.type() != Message::Type::BulkString) {
+      throw CommandParseError("XINFO arguments should be BulkString");
+    }
+  }
+
+  if (data.size() < 3) {
+    throw CommandParseError("XINFO expects at least 2 arguments");
+  }
+
+  auto action = to_lower_case(std::get<std::string>(data[1].getValue()));
+  const auto& key = std::get<std::string>(data[2].getValue());
+
+  if (action == "groups") {
+    if (data.size() != 3) {
+      throw CommandParseError("XINFO GROUPS expects exactly 1 argument");
+    }
+    return std::make_shared<XInfoCommand>(Action::Groups, key);
+
+  } else if (action == "consumers") {
+    if (data.size() != 4) {
+      throw CommandParseError("XINFO CONSUMERS expects exactly 2 arguments");
+    }
+    return std::make_shared<XInfoCommand>(Action::Consumers, key, std::get<std::string>(data[3].getValue()));
+
+  } else if (action != "stream") {
+    throw CommandParseError(print_args("unknown subcommand for XINFO: ", action));
+  }
+
+  auto command = std::make_shared<XInfoCommand>(Action::Stream, key);
+
+  std::size_t data_pos = 3;
+  while (data_pos < data.size()) {
+    auto arg = to_lower_case(std::get<std::string>(data[data_pos].getValue()));
+
+    if (arg == "full") {
+      command->_full = true;
+      ++data_pos;
+    } else if (arg == "count" && command->_full) {
+      if (data_pos + 1 >= data.size()) {
+        throw CommandParseError("XINFO STREAM expects an argument after count");
+      }
+
+      auto count = parseUInt64(std::get<std::string>(data[data_pos + 1].getValue()));
+      if (!count) {
+        throw CommandParseError("XINFO STREAM count must be a number");
+      }
+      command->_count = count.value();
+      data_pos += 2;
+    } else {
+      throw CommandParseError(print_args("unexpected arg for XINFO STREAM: ", arg));
+    }
+  }
+
+  return command;
+}
+
+XInfoCommand::XInfoCommand(Action action, std::string key, std::string group)
+  : _action(action), _key(std::move(key)), _group(std::move(group)) {
+  this->_type = CommandType::XInfo;
+}
+
+XInfoCommand::Action XInfoCommand::action() const {
+  return this->_action;
+}
+
+const std::string& XInfoCommand::key() const {
+  return this->_key;
+}
+
+const std::string& XInfoCommand::group() const {
+  return this->_group;
+}
+
+bool XInfoCommand::full() const {
+  return this->_full;
+}
+
+std::size_t XInfoCommand::count() const {
+  return this->_count;
+}
+
+Message XInfoCommand::construct() const {
+  std::vector<Message> parts;
+  parts.emplace_back(Message::Type::BulkString, "XINFO");
+
+  if (this->_action == Action::Stream) {
+    parts.emplace_back(Message::Type::BulkString, "STREAM");
+    parts.emplace_back(Message::Type::BulkString, this->_key);
+    if (this->_full) {
+      parts.emplace_back(Message::Type::BulkString, "FULL");
+      parts.emplace_back(Message::Type::BulkString, "COUNT");
+      parts.emplace_back(Message::Type::BulkString, std::to_string(this->_count));
+    }
+  } else if (this->_action == Action::Groups) {
+    parts.emplace_back(Message::Type::BulkString, "GROUPS");
+    parts.emplace_back(Message::Type::BulkString, this->_key);
+  } else {
+    parts.emplace_back(Message::Type::BulkString, "CONSUMERS");
+    parts.emplace_back(Message::Type::BulkString, this->_key);
+    parts.emplace_back(Message::Type::BulkString, this->_group);
+  }
+
+  return Message(Message::Type::Array, parts);
+}
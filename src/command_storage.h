@@ -103,3 +103,47 @@ private:
   StreamsReadRequest _request;
   std::optional<std::size_t> _block_ms;
 };
+
+class XLenCommand : public Command {
+public:
+  static CommandPtr try_parse(const Message&);
+
+  XLenCommand(std::string key);
+
+  const std::string& key() const;
+
+  Message construct() const override;
+
+private:
+  std::string _key;
+};
+
+class XInfoCommand : public Command {
+public:
+  enum class Action {
+    Stream,
+    Groups,
+    Consumers,
+  };
+
+  static CommandPtr try_parse(const Message&);
+
+  XInfoCommand(Action action, std::string key, std::string group = {});
+
+  Action action() const;
+  const std::string& key() const;
+  const std::string& group() const;
+
+  bool full() const;
+  std::size_t count() const;
+
+  Message construct() const override;
+
+private:
+  Action _action;
+  std::string _key;
+  std::string _group;
+
+  bool _full = false;
+  std::size_t _count = 10;
+};
@@ -0,0 +1,72 @@
+#include "crc64.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+namespace {
+
+// 0xad93d23594c935a9 bit reversed
+constexpr std::uint64_t POLY = 0x95ac9329ac4bc9b5ULL;
+
+using Tables = std::array<std::array<std::uint64_t, 256>, 8>;
+
+// Slicing by 8: tables[k][b] is the CRC of byte b followed by k zero bytes, so
+// eight input bytes are folded in with eight independent lookups instead of a
+// chain of eight dependent ones.
+constexpr Tables make_tables() {
+  Tables tables{};
+
+  for (std::uint64_t byte = 0; byte < 256; ++byte) {
+    std::uint64_t crc = byte;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+    }
+    tables[0][byte] = crc;
+  }
+
+  for (std::size_t k = 1; k < 8; ++k) {
+    for (std::size_t byte = 0; byte < 256; ++byte) {
+      auto prev = tables[k - 1][byte];
+      tables[k][byte] = (prev >> 8) ^ tables[0][prev & 0xff];
+    }
+  }
+
+  return tables;
+}
+
+constexpr Tables TABLES = make_tables();
+
+} // namespace
+
+std::uint64_t crc64(std::uint64_t crc, std::string_view data) {
+  const auto* p = reinterpret_cast<const unsigned char*>(data.data());
+  std::size_t size = data.size();
+
+  if constexpr (std::endian::native == std::endian::little) {
+    while (size >= 8) {
+      std::uint64_t word;
+      std::memcpy(&word, p, 8);
+      crc ^= word;
+
+      crc = TABLES[7][crc & 0xff]
+        ^ TABLES[6][(crc >> 8) & 0xff]
+        ^ TABLES[5][(crc >> 16) & 0xff]
+        ^ TABLES[4][(crc >> 24) & 0xff]
+        ^ TABLES[3][(crc >> 32) & 0xff]
+        ^ TABLES[2][(crc >> 40) & 0xff]
+        ^ TABLES[1][(crc >> 48) & 0xff]
+        ^ TABLES[0][crc >> 56];
+
+      p += 8;
+      size -= 8;
+    }
+  }
+
+  while (size > 0) {
+    crc = TABLES[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    --size;
+  }
+
+  return crc;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// CRC-64 with the Jones polynomial, reflected, as Redis checksums RDB files with.
+// Pass the previous result to continue over data that comes in pieces, 0 to start.
+std::uint64_t crc64(std::uint64_t crc, std::string_view data);
@@ -1,6 +1,22 @@
 #include "events.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::size_t JOB_BLOCK_SIZE = 256;
+
+} // namespace
 
 EventLoopPtr EventLoop::make() {
   return std::make_shared<EventLoop>();
@@ -9,62 +25,205 @@ EventLoopPtr EventLoop::make() {
 EventLoop::EventLoop(std::size_t max_unqueue_events)
   : _max_unqueue_events(max_unqueue_events)
 {
+  this->_wakeup_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->_wakeup_fd < 0) {
+    std::ostringstream ss;
+    ss << "Failed to create event loop wakeup eventfd: " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+}
+
+EventLoop::~EventLoop() {
+  // what the jobs hold may hold handles to other jobs, all nodes have to be there while it goes
+  this->_events = {};
+  while (this->_inbox.pop()) {
+  }
+  for (auto& block : this->_job_blocks) {
+    for (std::size_t i = 0; i < JOB_BLOCK_SIZE; ++i) {
+      block[i].func.reset();
+    }
+  }
+
+  ::close(this->_wakeup_fd);
 }
 
 EventLoop::JobHandle EventLoop::post(Func func) {
-  auto job = std::make_shared<JobWrapper>(std::move(func));
-  this->_onetime_jobs.push(job);
+  auto job = this->make_job(std::move(func));
+  this->_onetime_jobs.push_back(job);
   return job;
 }
 
 EventLoop::JobHandle EventLoop::repeat(Func func) {
-  auto job = std::make_shared<JobWrapper>(std::move(func));
+  auto job = this->make_job(std::move(func));
   this->_repeated_jobs.push_back(job);
   return job;
 }
 
 EventLoop::JobHandle EventLoop::set_timeout(std::size_t ms, Func func) {
-  auto job = std::make_shared<JobWrapper>(std::move(func));
+  auto job = this->make_job(std::move(func));
   job->fire_time = Clock::now() + std::chrono::milliseconds{ms};
   this->_timeout_jobs.push_back(job);
   return job;
 }
 
+EventLoop::Job* EventLoop::make_job(Func func) {
+  if (!this->_free_jobs) {
+    // the pool grows to the loop's peak of live jobs, a steady loop allocates none
+    auto& block = this->_job_blocks.emplace_back(std::make_unique<Job[]>(JOB_BLOCK_SIZE));
+    for (std::size_t i = 0; i < JOB_BLOCK_SIZE; ++i) {
+      block[i].next = this->_free_jobs;
+      this->_free_jobs = &block[i];
+    }
+  }
+
+  auto job = this->_free_jobs;
+  this->_free_jobs = job->next;
+
+  job->next = nullptr;
+  job->func = std::move(func);
+  job->is_valid = true;
+  return job;
+}
+
+void EventLoop::release_job(Job* job) {
+  job->func.reset();
+  job->is_valid = false;
+  ++job->generation;
+
+  job->next = this->_free_jobs;
+  this->_free_jobs = job;
+}
+
+void EventLoop::run_job(Job* job, const char* kind) {
+  try {
+    job->func();
+  } catch (const std::exception& exception) {
+    std::cerr << "EventLoop caught exception while " << kind << " job: " << std::endl
+      << exception.what() << std::endl;
+  }
+}
+
+void EventLoop::post_threadsafe(Func func) {
+  this->_inbox.push(std::move(func));
+
+  if (!this->_wakeup_pending.exchange(true)) {
+    this->notify();
+  }
+}
+
+int EventLoop::wakeup_fd() const {
+  return this->_wakeup_fd;
+}
+
+void EventLoop::wakeup() {
+  std::uint64_t count;
+  while (::read(this->_wakeup_fd, &count, sizeof(count)) > 0) {
+  }
+
+  // a post after this point writes the eventfd again, one before it is drained right below
+  this->_wakeup_pending.store(false);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->drain_inbox();
+}
+
+void EventLoop::keep_awake() {
+  this->_awake = true;
+}
+
+int EventLoop::poll_timeout_ms() {
+  // whatever ran may have left work for repeating jobs, they get one more iteration first
+  if (std::exchange(this->_awake, false) || this->_onetime_jobs.head || !this->_events.empty()) {
+    return 0;
+  }
+
+  std::optional<Timepoint> nearest;
+  for (auto job = this->_timeout_jobs.head; job; job = job->next) {
+    if (job->is_valid && (!nearest || job->fire_time < nearest.value())) {
+      nearest = job->fire_time;
+    }
+  }
+
+  if (!nearest) {
+    return -1;
+  }
+
+  const auto now = Clock::now();
+  if (nearest.value() <= now) {
+    return 0;
+  }
+
+  // rounded up, waking before the deadline would only come back here with 0
+  const auto ms = std::chrono::ceil<std::chrono::milliseconds>(nearest.value() - now).count();
+  return static_cast<int>(std::min<std::int64_t>(ms, std::numeric_limits<int>::max()));
+}
+
+void EventLoop::notify() {
+  std::uint64_t one = 1;
+  [[maybe_unused]] auto written = ::write(this->_wakeup_fd, &one, sizeof(one));
+}
+
+void EventLoop::drain_inbox() {
+  while (auto func = this->_inbox.pop()) {
+    this->_awake = true;
+    try {
+      func.value()();
+    } catch (const std::exception& exception) {
+      std::cerr << "EventLoop caught exception while posted job: " << std::endl
+        << exception.what() << std::endl;
+    }
+  }
+}
+
+void EventLoop::stop() {
+  this->_stopped.store(true, std::memory_order_relaxed);
+  this->notify();
+}
+
 void EventLoop::start() {
-  while (true) {
-    while (this->_onetime_jobs.size() > 0) {
-      try {
-        auto job = std::move(this->_onetime_jobs.front());
-        this->_onetime_jobs.pop();
-        job->call();
-      } catch (const std::exception& exception) {
-        std::cerr << "EventLoop caught exception while onetime job: " << std::endl
-          << exception.what() << std::endl;
+  while (!this->_stopped.load(std::memory_order_relaxed)) {
+    // a busy loop does not wait for the poller to report the eventfd
+    this->drain_inbox();
+
+    // jobs posted meanwhile run in this same pass
+    while (auto job = this->_onetime_jobs.head) {
+      this->_onetime_jobs.unlink(nullptr, job);
+      if (job->is_valid) {
+        this->_awake = true;
+        this->run_job(job, "onetime");
       }
+      this->release_job(job);
     }
 
-    for (const auto& job: this->_repeated_jobs) {
-      try {
-        job->call();
-      } catch (const std::exception& exception) {
-        std::cerr << "EventLoop caught exception while repeating job: " << std::endl
-          << exception.what() << std::endl;
+    // a job cancelled here, even from inside its own run, leaves the list on the next pass
+    for (Job *prev = nullptr, *job = this->_repeated_jobs.head; job;) {
+      if (!job->is_valid) {
+        auto next = job->next;
+        this->_repeated_jobs.unlink(prev, job);
+        this->release_job(job);
+        job = next;
+        continue;
       }
+
+      auto next = job->next;
+      this->run_job(job, "repeating");
+      prev = job;
+      job = next;
     }
 
-    for (auto it = this->_timeout_jobs.begin(); it != this->_timeout_jobs.end();) {
-      try {
-        auto job = *it;
-        if (Clock::now() >= job->fire_time.value()) {
-          it = this->_timeout_jobs.erase(it);
-          job->call();
-        } else {
-          ++it;
+    const auto now = Clock::now();
+    for (Job *prev = nullptr, *job = this->_timeout_jobs.head; job;) {
+      auto next = job->next;
+      if (!job->is_valid || now >= job->fire_time) {
+        this->_timeout_jobs.unlink(prev, job);
+        if (job->is_valid) {
+          this->_awake = true;
+          this->run_job(job, "timeout");
         }
-      } catch (const std::exception& exception) {
-        std::cerr << "EventLoop caught exception while timeout job: " << std::endl
-          << exception.what() << std::endl;
+        this->release_job(job);
+      } else {
+        prev = job;
       }
+      job = next;
     }
 
     std::size_t unqueue_size = this->_max_unqueue_events;
@@ -73,6 +232,7 @@ void EventLoop::start() {
     }
 
     for (std::size_t i = 0; i < unqueue_size; ++i) {
+      this->_awake = true;
       try {
         auto event = std::move(this->_events.front());
         this->_events.pop();
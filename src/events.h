@@ -1,11 +1,15 @@
 #pragma once
 
+#include "inline_function.h"
+#include "mpsc_queue.h"
+
+#include <atomic>
 #include <chrono>
-#include <functional>
-#include <list>
+#include <cstdint>
 #include <memory>
-#include <optional>
 #include <queue>
+#include <utility>
+#include <vector>
 
 static constexpr std::size_t MAX_UNQUEUE_EVENTS_DEFAULT = -1;
 
@@ -14,7 +18,8 @@ using EventLoopPtr = std::shared_ptr<EventLoop>;
 
 class EventLoop : public std::enable_shared_from_this<EventLoop> {
 public:
-  using Func = std::function<void()>;
+  // big enough for `this` and a few shared pointers, anything bigger goes to the heap
+  using Func = InlineFunction<void(), 48>;
   using Clock = std::chrono::steady_clock;
   using Timepoint = Clock::time_point;
 
@@ -41,32 +46,61 @@ private:
     }
   };
 
-  struct JobWrapper {
+  // Jobs live in nodes taken from the loop's pool and linked into its lists through `next`.
+  // A node going back to the pool gets a new generation, which turns handles to it stale.
+  struct Job {
+    Job* next = nullptr;
     Func func;
+    Timepoint fire_time;
+    std::uint32_t generation = 0;
     bool is_valid = false;
-    std::optional<Timepoint> fire_time;
+  };
+
+  struct JobList {
+    Job* head = nullptr;
+    Job* tail = nullptr;
 
-    JobWrapper(Func func) {
-      this->func = std::move(func);
-      this->is_valid = true;
+    void push_back(Job* job) {
+      job->next = nullptr;
+      if (this->tail) {
+        this->tail->next = job;
+      } else {
+        this->head = job;
+      }
+      this->tail = job;
     }
 
-    void call() const {
-      if (this->is_valid) {
-        this->func();
+    // prev is the node before job, nullptr for the head
+    void unlink(Job* prev, Job* job) {
+      (prev ? prev->next : this->head) = job->next;
+      if (this->tail == job) {
+        this->tail = prev;
       }
     }
   };
-  using JobWrapperPtr = std::shared_ptr<JobWrapper>;
 
 public:
+  // Cancels its job when destroyed, unless forgotten. A handle must not outlive its loop.
   class JobHandle {
     friend EventLoop;
 
   public:
     JobHandle() = default;
-    JobHandle(JobHandle&& other) = default;
-    JobHandle& operator=(JobHandle&& other) = default;
+
+    JobHandle(JobHandle&& other) noexcept
+      : job(std::exchange(other.job, nullptr))
+      , generation(other.generation)
+      , do_invalidate(other.do_invalidate)
+    {
+    }
+
+    // the job held before is left running, as if forgotten
+    JobHandle& operator=(JobHandle&& other) noexcept {
+      this->job = std::exchange(other.job, nullptr);
+      this->generation = other.generation;
+      this->do_invalidate = other.do_invalidate;
+      return *this;
+    }
 
     ~JobHandle() {
       this->invalidate();
@@ -76,29 +110,37 @@ public:
       this->do_invalidate = false;
     }
 
+    bool is_pending() const {
+      return this->job && this->job->generation == this->generation && this->job->is_valid;
+    }
+
     void invalidate() {
       if (!this->do_invalidate) {
         return;
       }
 
-      if (auto ptr = this->job.lock()) {
-        ptr->is_valid = false;
+      // the node is only marked, a job may be cancelled from inside its own run
+      if (this->job && this->job->generation == this->generation) {
+        this->job->is_valid = false;
       }
     }
 
   private:
-    std::weak_ptr<JobWrapper> job;
+    Job* job = nullptr;
+    std::uint32_t generation = 0;
     bool do_invalidate = true;
 
-    JobHandle(const JobWrapperPtr& ptr) {
-      this->job = ptr;
+    JobHandle(Job* job)
+      : job(job)
+      , generation(job->generation)
+    {
     }
   };
 
-
   static EventLoopPtr make();
 
   EventLoop(std::size_t max_unqueue_events = MAX_UNQUEUE_EVENTS_DEFAULT);
+  ~EventLoop();
 
   template <typename Signal, typename Slot>
   void connect(Signal& signal, const std::shared_ptr<Slot>& slot_ptr) {
@@ -109,13 +151,50 @@ public:
   JobHandle repeat(Func);
   JobHandle set_timeout(std::size_t ms, Func);
 
+  // Any thread: the job runs on the loop thread at the start of an iteration, jobs posted by
+  // one thread run in the order posted. There is no handle, the job can not be cancelled.
+  void post_threadsafe(Func);
+
+  // Readable while jobs posted by other threads wait, the poller waits on it so that
+  // a loop idle in poll takes them right away.
+  int wakeup_fd() const;
+  // the poller saw wakeup_fd readable
+  void wakeup();
+
+  // A repeating job with more to do than what sockets and timeouts bring calls it,
+  // the poller does not wait on the next iteration then.
+  void keep_awake();
+  // How long the poller may wait: 0 when anything but idle repeating jobs ran since the
+  // previous call, until the nearest timeout otherwise, -1 (only wakeup_fd) without one.
+  int poll_timeout_ms();
+
   void start();
+  // start() returns after the current iteration, callable from another thread
+  void stop();
 
 private:
   const std::size_t _max_unqueue_events;
+  std::atomic<bool> _stopped = false;
 
-  std::queue<JobWrapperPtr> _onetime_jobs;
-  std::list<JobWrapperPtr> _repeated_jobs;
-  std::list<JobWrapperPtr> _timeout_jobs; // stupid simple. better to have jobs sorted by fire time
+  MPSCQueue<Func> _inbox;
+  // set by the poster which writes the eventfd, others skip the syscall until the loop takes it
+  std::atomic<bool> _wakeup_pending = false;
+  int _wakeup_fd = -1;
+  bool _awake = true;
+
+  JobList _onetime_jobs;
+  JobList _repeated_jobs;
+  JobList _timeout_jobs; // stupid simple. better to have jobs sorted by fire time
   std::queue<Func> _events;
+
+  // nodes are never given back to the system while the loop lives, handles may point at them
+  std::vector<std::unique_ptr<Job[]>> _job_blocks;
+  Job* _free_jobs = nullptr;
+
+  Job* make_job(Func);
+  void release_job(Job*);
+  void run_job(Job*, const char* kind);
+
+  void notify();
+  void drain_inbox();
 };
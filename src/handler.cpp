@@ -3,6 +3,7 @@
 #include "command.h"
 #include "debug.h"
 #include "handlers_manager.h"
+#include "io_threads.h"
 #include "message.h"
 #include "poller.h"
 #include "server.h"
@@ -24,34 +25,15 @@ public:
   ConnReset() : std::runtime_error("Conn reset") {}
 };
 
-Handler::Handler(EventLoopPtr event_loop, int fd, TalkerPtr talker)
-  : _event_loop(event_loop)
-  , _fd(fd)
+Handler::Handler(EventLoopPtr event_loop, int fd, TalkerPtr talker, IOThreadsPtr io_threads)
+  : _fd(fd)
   , _talker(talker)
-  , _parser(this->_read_buffer)
+  , _event_loop(event_loop)
+  , _io_threads(io_threads)
+  , _parser(this->_read_buffer, talker->wants_raw())
 {
-  this->_slot_fd_event = std::make_shared<Slot<PollEventType>>([this](PollEventType type) {
-    if (!this->_fd) {
-      return;
-    }
-
-    if (type == PollEventType::ReadyToRead) {
-      this->process_read();
-    } else if (type == PollEventType::ReadyToWrite) {
-      this->write();
-    } else if (type == PollEventType::HangUp) {
-      this->close();
-    } else {
-      this->close();
-      throw std::runtime_error("Handler got unexpected poll event");
-      // TODO make error more verbose
-    }
-  });
-
-  this->_new_fd_signal = std::make_shared<Signal<int, PollEventTypeList, SignalPtr<PollEventType>>>();
+  this->_new_fd_signal = std::make_shared<Signal<int, PollEventTypeList, PollCallback>>();
   this->_removed_fd_signal = std::make_shared<Signal<int>>();
-  this->_fd_event_signal = std::make_shared<Signal<PollEventType>>();
-  this->_fd_event_signal->connect(this->_slot_fd_event);
 
   this->_start_handle = this->_event_loop->post([this](){
     this->start();
@@ -62,7 +44,7 @@ Handler::~Handler() {
   this->close();
 }
 
-SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& Handler::new_fd() {
+SignalPtr<int, PollEventTypeList, PollCallback>& Handler::new_fd() {
   return this->_new_fd_signal;
 }
 
@@ -79,22 +61,58 @@ void Handler::start() {
 
   this->setup_poll(false);
 
+  if (this->_io_threads) {
+    this->_io_threads->add(this);
+    return;
+  }
+
   this->_loop_handle = this->_event_loop->repeat([this]() {
     this->process_write();
   });
 }
 
+void Handler::on_poll_event(PollEventType type) {
+  if (!this->_fd) {
+    return;
+  }
+
+  if (type == PollEventType::ReadyToRead) {
+    if (this->_io_threads) {
+      this->_io_threads->read_ready(this);
+    } else {
+      this->process_read();
+    }
+  } else if (type == PollEventType::ReadyToWrite) {
+    this->write();
+  } else if (type == PollEventType::HangUp) {
+    this->close();
+  } else {
+    this->close();
+    throw std::runtime_error("Handler got unexpected poll event");
+    // TODO make error more verbose
+  }
+}
+
 void Handler::setup_poll(bool write) {
+  // most writes leave the socket as it was polled, the poller only hears about changes
+  if (this->_polling_write == write) {
+    return;
+  }
+  this->_polling_write = write;
+
+  // the poller calls back until close() removes the socket from it
+  const auto callback = PollCallback::bind<&Handler::on_poll_event>(this);
+
   if (write) {
     this->_new_fd_signal->emit(
         this->_fd.value(),
         PollEventTypeList{PollEventType::ReadyToRead, PollEventType::ReadyToWrite},
-        this->_fd_event_signal);
+        callback);
   } else {
     this->_new_fd_signal->emit(
         this->_fd.value(),
         PollEventTypeList{PollEventType::ReadyToRead},
-        this->_fd_event_signal);
+        callback);
   }
 }
 
@@ -103,6 +121,10 @@ void Handler::close() {
     auto fd = this->_fd.value();
     this->_fd.reset();
 
+    if (this->_io_threads) {
+      this->_io_threads->remove(this);
+    }
+
     if (this->_talker) {
       this->_talker->interrupt();
     }
@@ -114,17 +136,114 @@ void Handler::close() {
 
 void Handler::process_read() {
   try {
-    this->read();
+    auto bytes_read = this->read();
 
+    this->_talker->batch_started(bytes_read);
     while (auto maybe_message = this->_parser.try_parse(this->_talker->expected())) {
       if (DEBUG_LEVEL >= 1) std::cerr << "<< FROM" << std::endl << maybe_message.value();
-      this->_talker->listen(std::move(maybe_message.value()));
+      this->_talker->listen(std::move(maybe_message.value()), this->_parser.last_message_raw());
     }
+    this->_talker->batch_finished();
   } catch (const ConnReset&) {
     this->close();
   }
 
-  this->process_write();
+  // replies are sent by the loop job later in this iteration, once the append only file got the writes
+}
+
+void Handler::io_read() {
+  try {
+    this->_io_bytes_read = this->read();
+    while (auto maybe_message = this->_parser.try_parse(this->_talker->expected())) {
+      this->_io_parsed.push_back(std::move(maybe_message.value()));
+    }
+  } catch (const ConnReset&) {
+    this->_io_reset = true;
+  } catch (const std::exception&) {
+    this->_io_error = std::current_exception();
+  }
+}
+
+void Handler::io_dispatch() {
+  if (this->_io_reset) {
+    this->close();
+    return;
+  }
+
+  // only client connections go through the pool, their talkers do not ask for raw bytes
+  this->_talker->batch_started(this->_io_bytes_read);
+  for (auto& message : this->_io_parsed) {
+    if (DEBUG_LEVEL >= 1) std::cerr << "<< FROM" << std::endl << message;
+    this->_talker->listen(std::move(message), {});
+  }
+  this->_talker->batch_finished();
+
+  this->_io_parsed.clear();
+  this->_io_bytes_read = 0;
+
+  this->io_failed();
+}
+
+bool Handler::io_collect() {
+  while (auto maybe_message = this->_talker->say()) {
+    if (maybe_message.value().type() == Message::Type::Leave) {
+      this->_io_leave = true;
+      break;
+    }
+
+    if (DEBUG_LEVEL >= 1) std::cerr << ">> TO" << std::endl << maybe_message.value();
+    this->_io_outgoing.push_back(std::move(maybe_message.value()));
+  }
+
+  return !this->_io_outgoing.empty() || this->_io_leave;
+}
+
+void Handler::io_write() {
+  try {
+    for (const auto& message : this->_io_outgoing) {
+      this->encode(message);
+    }
+    this->_io_outgoing.clear();
+
+    this->write_some();
+  } catch (const ConnReset&) {
+    this->_io_reset = true;
+  } catch (const std::exception&) {
+    this->_io_error = std::current_exception();
+  }
+}
+
+void Handler::io_write_finished() {
+  if (this->io_failed()) {
+    return;
+  }
+
+  // whatever was said before leaving went out first, as far as the socket took it
+  if (this->_io_leave) {
+    this->close();
+    return;
+  }
+
+  this->setup_poll(this->_write_buffer.size() != 0);
+}
+
+bool Handler::io_failed() {
+  if (this->_io_reset) {
+    this->close();
+    return true;
+  }
+
+  if (this->_io_error) {
+    try {
+      std::rethrow_exception(this->_io_error);
+    } catch (const std::exception& e) {
+      std::cerr << "Handler closes client(" << this->_fd.value() << ") after error: " << e.what() << std::endl;
+    }
+    this->close();
+    return true;
+  }
+
+  return false;
 }
 
 void Handler::process_write() {
@@ -141,9 +260,10 @@ void Handler::process_write() {
   }
 }
 
-void Handler::read() {
-  static constexpr std::size_t READ_BUFFER_SIZE = 1024;
+std::size_t Handler::read() {
+  static constexpr std::size_t READ_BUFFER_SIZE = 16 * 1024;
   std::array<char, READ_BUFFER_SIZE> read_buffer;
+  std::size_t total = 0;
 
   while (true) {
     ssize_t read_size = ::read(this->_fd.value(), read_buffer.data(), READ_BUFFER_SIZE);
@@ -153,6 +273,7 @@ void Handler::read() {
 
     if (read_size > 0) {
       this->_read_buffer.insert(this->_read_buffer.end(), read_buffer.begin(), read_buffer.begin() + read_size);
+      total += read_size;
       continue;
     }
 
@@ -175,16 +296,29 @@ void Handler::read() {
 
     break;
   }
+
+  return total;
 }
 
 void Handler::write() {
-  static constexpr std::size_t WRITE_BUFFER_SIZE = 1024;
-  std::array<char, WRITE_BUFFER_SIZE> write_buffer;
-
   if (this->_write_buffer.size() == 0) {
     return;
   }
 
+  this->write_some();
+
+  if (this->_write_buffer.size() == 0) {
+    this->setup_poll(false);
+  } else {
+    this->setup_poll(true);
+  }
+}
+
+void Handler::write_some() {
+  // big replies go out in few syscalls, the copy out of the deque is what every chunk costs
+  static constexpr std::size_t WRITE_BUFFER_SIZE = 16 * 1024;
+  std::array<char, WRITE_BUFFER_SIZE> write_buffer;
+
   if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG write_buffer size=" << this->_write_buffer.size() << std::endl;
 
   std::size_t transferred_total = 0;
@@ -226,24 +360,25 @@ void Handler::write() {
   if (transferred_total > 0) {
     this->_write_buffer.erase(this->_write_buffer.begin(), this->_write_buffer.begin() + transferred_total);
   }
-
-  if (this->_write_buffer.size() == 0) {
-    this->setup_poll(false);
-  } else {
-    this->setup_poll(true);
-  }
 }
 
 void Handler::send(const Message& message) {
-  auto str = message.to_string();
   if (DEBUG_LEVEL >= 1) {
     std::cerr << ">> TO" << std::endl;
     std::cerr << message;
   }
-  this->send(str);
-}
 
-void Handler::send(const std::string& str) {
-  this->_write_buffer.insert(this->_write_buffer.end(), str.begin(), str.begin() + str.size());
+  this->encode(message);
   this->write();
 }
+
+void Handler::encode(const Message& message) {
+  if (message.type() == Message::Type::Raw) {
+    const auto str = message.raw();
+    this->_write_buffer.insert(this->_write_buffer.end(), str.begin(), str.end());
+    return;
+  }
+
+  const auto str = message.to_string();
+  this->_write_buffer.insert(this->_write_buffer.end(), str.begin(), str.end());
+}
@@ -6,31 +6,45 @@
 #include "signal_slot.h"
 #include "talker.h"
 
+#include <exception>
 #include <optional>
 #include <deque>
 #include <string>
+#include <vector>
 
 class HandlersManager;
+class IOThreads;
+using IOThreadsPtr = std::shared_ptr<IOThreads>;
 
 class Handler {
 public:
-  Handler(EventLoopPtr event_loop, int fd, TalkerPtr talker);
+  // with io_threads the socket is read and written by the pool in its phases instead of
+  // right on the poll event and in a loop job of its own
+  Handler(EventLoopPtr event_loop, int fd, TalkerPtr talker, IOThreadsPtr io_threads = {});
   ~Handler();
 
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& new_fd();
+  SignalPtr<int, PollEventTypeList, PollCallback>& new_fd();
   SignalPtr<int>& removed_fd();
 
+  // Phases of threaded I/O, io_read and io_write run on any pool thread while the loop thread
+  // waits, the others on the loop thread. Any of the loop thread ones may close the handler.
+  void io_read();
+  void io_dispatch();
+  // takes what the talker has to say, returns whether there is anything to write
+  bool io_collect();
+  void io_write();
+  void io_write_finished();
+
 private:
   using Buffer = std::deque<char>;
 
   std::optional<int> _fd;
   TalkerPtr _talker;
 
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>> _new_fd_signal;
+  SignalPtr<int, PollEventTypeList, PollCallback> _new_fd_signal;
   SignalPtr<int> _removed_fd_signal;
-  SignalPtr<PollEventType> _fd_event_signal;
-  SlotPtr<PollEventType> _slot_fd_event;
   EventLoopPtr _event_loop;
+  IOThreadsPtr _io_threads;
 
   EventLoop::JobHandle _start_handle;
   EventLoop::JobHandle _loop_handle;
@@ -39,17 +53,33 @@ private:
   Buffer _write_buffer;
   MessageParser<Buffer> _parser;
 
+  // handed between the phases of threaded I/O
+  std::vector<Message> _io_parsed;
+  std::vector<Message> _io_outgoing;
+  std::size_t _io_bytes_read = 0;
+  bool _io_leave = false;
+  bool _io_reset = false;
+  std::exception_ptr _io_error;
+
   void start();
 
+  void on_poll_event(PollEventType);
+
+  std::optional<bool> _polling_write; // as the poller has the socket, none before start()
   void setup_poll(bool write = false);
   void close();
 
   void process_read();
   void process_write();
 
-  void read();
+  std::size_t read();
   void write();
+  // writes what the socket takes now, without touching the poller
+  void write_some();
 
   void send(const Message& message);
-  void send(const std::string& str);
+  void encode(const Message& message);
+
+  // closes the handler after a failed threaded phase, returns whether it did
+  bool io_failed();
 };
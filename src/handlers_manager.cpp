@@ -4,7 +4,7 @@
 
 HandlersManager::HandlersManager(EventLoopPtr event_loop)
   : _event_loop(event_loop) {
-  this->_new_fd_signal = std::make_shared<Signal<int, PollEventTypeList, SignalPtr<PollEventType>>>();
+  this->_new_fd_signal = std::make_shared<Signal<int, PollEventTypeList, PollCallback>>();
   this->_removed_fd_signal = std::make_shared<Signal<int>>();
   this->_slot_add = std::make_shared<Slot<int>>([this](int fd) {
     this->add(fd);
@@ -19,6 +19,10 @@ void HandlersManager::set_talker(TalkerBuilder builder) {
   this->_talker_builder = std::move(builder);
 }
 
+void HandlersManager::set_io_threads(IOThreadsPtr io_threads) {
+  this->_io_threads = std::move(io_threads);
+}
+
 SlotPtr<int>& HandlersManager::add_fd() {
   return this->_slot_add;
 }
@@ -27,7 +31,7 @@ SlotPtr<int>& HandlersManager::remove_fd() {
   return this->_slot_remove;
 }
 
-SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& HandlersManager::new_fd() {
+SignalPtr<int, PollEventTypeList, PollCallback>& HandlersManager::new_fd() {
   return this->_new_fd_signal;
 }
 
@@ -40,7 +44,7 @@ void HandlersManager::add(int fd) {
     throw std::runtime_error("Re-adding client fd to handlers manager is not allowed!");
   }
 
-  auto& handler = this->_handlers.try_emplace(fd, this->_event_loop, fd, this->_talker_builder()).first->second;
+  auto& handler = this->_handlers.try_emplace(fd, this->_event_loop, fd, this->_talker_builder(), this->_io_threads).first->second;
 
   handler.new_fd()->connect(this->_new_fd_signal);
   handler.removed_fd()->connect(this->_removed_fd_signal);
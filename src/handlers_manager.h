@@ -2,10 +2,12 @@
 
 #include "events.h"
 #include "handler.h"
+#include "io_threads.h"
 #include "poller.h"
 #include "signal_slot.h"
 #include "talker.h"
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 
@@ -16,21 +18,23 @@ public:
   HandlersManager(EventLoopPtr event_loop);
 
   void set_talker(TalkerBuilder);
+  void set_io_threads(IOThreadsPtr);
 
   SlotPtr<int>& add_fd();
   SlotPtr<int>& remove_fd();
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& new_fd();
+  SignalPtr<int, PollEventTypeList, PollCallback>& new_fd();
   SignalPtr<int>& removed_fd();
 
 private:
   SlotPtr<int> _slot_add;
   SlotPtr<int> _slot_remove;
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>> _new_fd_signal;
+  SignalPtr<int, PollEventTypeList, PollCallback> _new_fd_signal;
   SignalPtr<int> _removed_fd_signal;
 
   EventLoopPtr _event_loop;
 
   TalkerBuilder _talker_builder;
+  IOThreadsPtr _io_threads;
 
   std::unordered_map<int, Handler> _handlers;
 
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, std::size_t Capacity>
+class InlineFunction;
+
+// Move only std::function: a callable of up to Capacity bytes is kept inside the object,
+// only bigger ones go to the heap. Calling an empty one is undefined.
+template <typename R, typename... Args, std::size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+  struct VTable {
+    R (*call)(void*, Args&&...);
+    void (*move)(void* to, void* from) noexcept; // move constructs at `to` and destroys `from`
+    void (*destroy)(void*) noexcept;
+  };
+
+  template <typename F>
+  static constexpr bool is_inline = sizeof(F) <= Capacity
+    && alignof(F) <= alignof(std::max_align_t)
+    && std::is_nothrow_move_constructible_v<F>;
+
+  template <typename F>
+  static constexpr VTable inline_vtable = {
+    [](void* self, Args&&... args) -> R {
+      return (*static_cast<F*>(self))(std::forward<Args>(args)...);
+    },
+    [](void* to, void* from) noexcept {
+      ::new (to) F(std::move(*static_cast<F*>(from)));
+      static_cast<F*>(from)->~F();
+    },
+    [](void* self) noexcept {
+      static_cast<F*>(self)->~F();
+    },
+  };
+
+  template <typename F>
+  static constexpr VTable heap_vtable = {
+    [](void* self, Args&&... args) -> R {
+      return (**static_cast<F**>(self))(std::forward<Args>(args)...);
+    },
+    [](void* to, void* from) noexcept {
+      *static_cast<F**>(to) = *static_cast<F**>(from);
+    },
+    [](void* self) noexcept {
+      delete *static_cast<F**>(self);
+    },
+  };
+
+public:
+  InlineFunction() = default;
+
+  InlineFunction(std::nullptr_t) {}
+
+  template <
+      typename F,
+      typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>,
+      typename = std::enable_if_t<std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+  InlineFunction(F&& func) {
+    using Stored = std::decay_t<F>;
+    static_assert(sizeof(Stored*) <= Capacity);
+
+    if constexpr (is_inline<Stored>) {
+      ::new (static_cast<void*>(this->_storage)) Stored(std::forward<F>(func));
+      this->_vtable = &inline_vtable<Stored>;
+    } else {
+      *reinterpret_cast<Stored**>(this->_storage) = new Stored(std::forward<F>(func));
+      this->_vtable = &heap_vtable<Stored>;
+    }
+  }
+
+  InlineFunction(InlineFunction&& other) noexcept {
+    this->take(other);
+  }
+
+  InlineFunction& operator=(InlineFunction&& other) noexcept {
+    if (this != &other) {
+      this->reset();
+      this->take(other);
+    }
+    return *this;
+  }
+
+  InlineFunction(const InlineFunction&) = delete;
+  InlineFunction& operator=(const InlineFunction&) = delete;
+
+  ~InlineFunction() {
+    this->reset();
+  }
+
+  explicit operator bool() const {
+    return this->_vtable != nullptr;
+  }
+
+  R operator()(Args... args) {
+    return this->_vtable->call(this->_storage, std::forward<Args>(args)...);
+  }
+
+  void reset() {
+    if (this->_vtable) {
+      this->_vtable->destroy(this->_storage);
+      this->_vtable = nullptr;
+    }
+  }
+
+private:
+  alignas(std::max_align_t) std::byte _storage[Capacity];
+  const VTable* _vtable = nullptr;
+
+  void take(InlineFunction& other) {
+    if (other._vtable) {
+      other._vtable->move(this->_storage, other._storage);
+      this->_vtable = other._vtable;
+      other._vtable = nullptr;
+    }
+  }
+};
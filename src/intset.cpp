@@ -0,0 +1,87 @@
+#include "intset.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::size_t INTSET_HEADER_SIZE = 8;
+
+std::uint64_t read_le(std::string_view data, std::size_t pos, std::size_t bytes) {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < bytes; ++i) {
+    value |= std::uint64_t(static_cast<std::uint8_t>(data[pos + i])) << (8 * i);
+  }
+  return value;
+}
+
+} // namespace
+
+IntsetReader::IntsetReader(std::string_view data)
+  : _data(data)
+{
+  if (data.size() < INTSET_HEADER_SIZE) {
+    throw std::runtime_error("Malformed intset header");
+  }
+
+  this->_width = read_le(data, 0, 4);
+  this->_size = read_le(data, 4, 4);
+
+  if ((this->_width != 2 && this->_width != 4 && this->_width != 8)
+      || data.size() != INTSET_HEADER_SIZE + this->_width * this->_size) {
+    throw std::runtime_error("Malformed intset header");
+  }
+}
+
+std::size_t IntsetReader::size() const {
+  return this->_size;
+}
+
+std::optional<std::int64_t> IntsetReader::next() {
+  if (this->_index == this->_size) {
+    return {};
+  }
+
+  auto value = read_le(this->_data, INTSET_HEADER_SIZE + this->_index * this->_width, this->_width);
+  ++this->_index;
+
+  const auto bits = this->_width * 8;
+  if (bits < 64 && value >= (std::uint64_t(1) << (bits - 1))) {
+    return static_cast<std::int64_t>(value) - (std::int64_t(1) << bits);
+  }
+  return static_cast<std::int64_t>(value);
+}
+
+std::string intset_encode(std::vector<std::int64_t> values) {
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+
+  std::size_t width = 2;
+  if (!values.empty()) {
+    auto fits = [&](auto limits) {
+      return values.front() >= limits.min() && values.back() <= limits.max();
+    };
+
+    if (!fits(std::numeric_limits<std::int16_t>{})) {
+      width = fits(std::numeric_limits<std::int32_t>{}) ? 4 : 8;
+    }
+  }
+
+  std::string result;
+  result.reserve(INTSET_HEADER_SIZE + width * values.size());
+
+  auto append_le = [&result](std::uint64_t value, std::size_t bytes) {
+    for (std::size_t i = 0; i < bytes; ++i) {
+      result.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+  };
+
+  append_le(width, 4);
+  append_le(values.size(), 4);
+  for (auto value : values) {
+    append_le(static_cast<std::uint64_t>(value), width);
+  }
+
+  return result;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Intset as Redis keeps small integer sets: a sorted array of 16, 32 or 64 bit
+// little endian integers after a header of element width and count.
+class IntsetReader {
+public:
+  // Throws std::runtime_error when the header does not match the blob size.
+  explicit IntsetReader(std::string_view data);
+
+  std::size_t size() const;
+
+  std::optional<std::int64_t> next();
+
+private:
+  std::string_view _data;
+  std::size_t _width;
+  std::size_t _size;
+  std::size_t _index = 0;
+};
+
+// Builds an intset of the given values, sorted and deduplicated, in the narrowest width that fits.
+std::string intset_encode(std::vector<std::int64_t> values);
@@ -0,0 +1,169 @@
+#include "io_threads.h"
+
+#include "debug.h"
+#include "handler.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// a loaded server starts phases back to back, a thread spinning this long gets the next one
+// without sleeping and waking up, an idle one goes to sleep soon
+constexpr std::size_t SPIN_ROUNDS = 1 << 14;
+
+} // namespace
+
+IOThreads::IOThreads(EventLoopPtr event_loop, std::size_t count)
+  : _event_loop(event_loop)
+{
+  for (std::size_t i = 1; i < count; ++i) {
+    this->_threads.emplace_back([this, i]() {
+      this->thread_loop(i);
+    });
+  }
+
+  this->_start_handle = this->_event_loop->post([this]() {
+    // reads follow the poller's job which reports the readable sockets
+    this->_read_handle = this->_event_loop->repeat([this]() {
+      this->read_phase();
+    });
+
+    // and writes follow the append only file's flush, posted by now if there is one
+    this->_write_start_handle = this->_event_loop->post([this]() {
+      this->_write_handle = this->_event_loop->repeat([this]() {
+        this->write_phase();
+      });
+    });
+  });
+}
+
+IOThreads::~IOThreads() {
+  this->_stop.store(true);
+  this->_generation.fetch_add(1, std::memory_order_release);
+  this->_generation.notify_all();
+
+  for (auto& thread : this->_threads) {
+    thread.join();
+  }
+}
+
+void IOThreads::set_server(ServerPtr server) {
+  this->_server = std::move(server);
+}
+
+void IOThreads::add(Handler* handler) {
+  this->_handlers.insert(handler);
+}
+
+void IOThreads::remove(Handler* handler) {
+  this->_handlers.erase(handler);
+  std::erase(this->_read_pending, handler);
+  std::replace(this->_phase_handlers.begin(), this->_phase_handlers.end(), handler, static_cast<Handler*>(nullptr));
+}
+
+void IOThreads::read_ready(Handler* handler) {
+  this->_read_pending.push_back(handler);
+}
+
+void IOThreads::read_phase() {
+  if (this->_read_pending.empty()) {
+    return;
+  }
+
+  this->_phase_handlers.swap(this->_read_pending);
+  this->_read_pending.clear();
+
+  this->fan_out(Phase::Read);
+
+  // commands run here only, in the order the sockets were reported
+  for (std::size_t i = 0; i < this->_phase_handlers.size(); ++i) {
+    if (auto handler = this->_phase_handlers[i]) {
+      handler->io_dispatch();
+    }
+  }
+  this->_phase_handlers.clear();
+}
+
+void IOThreads::write_phase() {
+  for (auto handler : this->_handlers) {
+    if (handler->io_collect()) {
+      this->_phase_handlers.push_back(handler);
+    }
+  }
+
+  if (this->_phase_handlers.empty()) {
+    return;
+  }
+
+  this->fan_out(Phase::Write);
+
+  for (std::size_t i = 0; i < this->_phase_handlers.size(); ++i) {
+    if (auto handler = this->_phase_handlers[i]) {
+      handler->io_write_finished();
+    }
+  }
+  this->_phase_handlers.clear();
+}
+
+void IOThreads::fan_out(Phase phase) {
+  this->_phase = phase;
+
+  // waking the pool costs more than a few clients' I/O
+  if (this->_threads.empty() || this->_phase_handlers.size() < 2 * (this->_threads.size() + 1)) {
+    for (auto handler : this->_phase_handlers) {
+      phase == Phase::Read ? handler->io_read() : handler->io_write();
+    }
+    return;
+  }
+
+  if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG io threads " << (phase == Phase::Read ? "read " : "write ")
+    << this->_phase_handlers.size() << " clients" << std::endl;
+
+  this->_busy.store(this->_threads.size(), std::memory_order_relaxed);
+  this->_generation.fetch_add(1, std::memory_order_release);
+  this->_generation.notify_all();
+
+  this->run_share(0);
+
+  while (this->_busy.load(std::memory_order_acquire) != 0) {
+  }
+
+  if (this->_server) {
+    auto& info = this->_server->info().server;
+    (phase == Phase::Read ? info.io_threaded_reads_processed : info.io_threaded_writes_processed)
+      += this->_phase_handlers.size();
+  }
+}
+
+void IOThreads::run_share(std::size_t thread_index) {
+  const auto stride = this->_threads.size() + 1;
+  for (std::size_t i = thread_index; i < this->_phase_handlers.size(); i += stride) {
+    auto handler = this->_phase_handlers[i];
+    this->_phase == Phase::Read ? handler->io_read() : handler->io_write();
+  }
+}
+
+void IOThreads::thread_loop(std::size_t thread_index) {
+  std::uint64_t seen = 0;
+
+  while (true) {
+    auto generation = this->_generation.load(std::memory_order_acquire);
+    for (std::size_t spin = 0; generation == seen && spin < SPIN_ROUNDS; ++spin) {
+      generation = this->_generation.load(std::memory_order_acquire);
+    }
+
+    if (generation == seen) {
+      this->_generation.wait(seen, std::memory_order_acquire);
+      continue;
+    }
+    seen = generation;
+
+    if (this->_stop.load()) {
+      return;
+    }
+
+    this->run_share(thread_index);
+    this->_busy.fetch_sub(1, std::memory_order_release);
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "events.h"
+#include "server.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+class Handler;
+
+// Threaded I/O: socket reads with RESP parsing, and reply encoding with socket writes, are
+// spread over a pool of threads, commands still run on the loop thread only. Every loop
+// iteration has a read phase and a write phase. In each one the loop thread hands out the
+// clients round robin, takes its own share and waits for the others to finish. Nothing but
+// the handlers' own buffers is touched while the pool runs.
+class IOThreads {
+public:
+  // count includes the loop thread
+  IOThreads(EventLoopPtr event_loop, std::size_t count);
+  ~IOThreads();
+
+  void set_server(ServerPtr);
+
+  void add(Handler*);
+  void remove(Handler*);
+  // poller told the handler's socket is readable, it is read in the next read phase
+  void read_ready(Handler*);
+
+private:
+  enum class Phase {
+    Read,
+    Write,
+  };
+
+  EventLoopPtr _event_loop;
+  ServerPtr _server;
+
+  std::unordered_set<Handler*> _handlers;
+  std::vector<Handler*> _read_pending;
+  std::vector<Handler*> _phase_handlers; // handed out in the running phase, closed ones are nulled
+
+  std::vector<std::thread> _threads;
+  Phase _phase = Phase::Read;
+  alignas(64) std::atomic<std::uint64_t> _generation = 0;
+  alignas(64) std::atomic<std::size_t> _busy = 0;
+  std::atomic<bool> _stop = false;
+
+  EventLoop::JobHandle _start_handle;
+  EventLoop::JobHandle _write_start_handle;
+  EventLoop::JobHandle _read_handle;
+  EventLoop::JobHandle _write_handle;
+
+  void read_phase();
+  void write_phase();
+
+  // runs the phase over _phase_handlers on every thread, returns once all are done
+  void fan_out(Phase);
+  void run_share(std::size_t thread_index);
+  void thread_loop(std::size_t thread_index);
+};
+using IOThreadsPtr = std::shared_ptr<IOThreads>;
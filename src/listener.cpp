@@ -0,0 +1,241 @@
+#include "listener.h"
+
+#include "debug.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char* SOMAXCONN_PATH = "/proc/sys/net/core/somaxconn";
+
+std::once_flag somaxconn_checked; // shards' listeners share the setting, one warning does
+
+// the kernel cuts a larger backlog down to this silently
+void warn_on_somaxconn(int backlog) {
+  std::call_once(somaxconn_checked, [backlog]() {
+    std::ifstream file(SOMAXCONN_PATH);
+    int somaxconn = 0;
+    if (file >> somaxconn && somaxconn < backlog) {
+      std::cerr << "WARNING: The TCP backlog setting of " << backlog << " cannot be enforced because "
+        << SOMAXCONN_PATH << " is set to the lower value of " << somaxconn << "." << std::endl;
+    }
+  });
+}
+
+} // namespace
+
+Listener::Listener(EventLoopPtr event_loop, int port, int backlog, bool reuseport)
+  : _event_loop(event_loop)
+  , _port(port)
+  , _backlog(backlog)
+  , _reuseport(reuseport)
+{
+  this->_new_server_fd_signal = std::make_shared<Signal<int, PollEventTypeList, PollCallback>>();
+  this->_removed_server_fd_signal = std::make_shared<Signal<int>>();
+  this->_new_fd_signal = std::make_shared<Signal<int>>();
+
+  this->_start_handle = this->_event_loop->post([this]() {
+    this->start();
+  });
+}
+
+Listener::Listener(EventLoopPtr event_loop, std::filesystem::path unix_path, mode_t unix_perm, int backlog)
+  : Listener(event_loop, 0, backlog)
+{
+  this->_unix_path = std::move(unix_path);
+  this->_unix_perm = unix_perm;
+}
+
+Listener::~Listener() {
+  this->close();
+}
+
+SignalPtr<int, PollEventTypeList, PollCallback>& Listener::new_server_fd() {
+  return this->_new_server_fd_signal;
+}
+
+SignalPtr<int>& Listener::removed_server_fd() {
+  return this->_removed_server_fd_signal;
+}
+
+SignalPtr<int>& Listener::new_fd() {
+  return this->_new_fd_signal;
+}
+
+void Listener::start() {
+  if (this->_unix_path) {
+    this->bind_unix();
+  } else {
+    this->bind_tcp();
+  }
+
+  warn_on_somaxconn(this->_backlog);
+
+  if (listen(*this->_server_fd, this->_backlog) != 0) {
+    std::ostringstream ss;
+    ss << "Listen failed: " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  this->_new_server_fd_signal->emit(
+      this->_server_fd.value(),
+      PollEventTypeList{PollEventType::ReadyToRead},
+      PollCallback::bind<&Listener::on_poll_event>(this));
+  
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Server ready!" << std::endl;
+}
+
+void Listener::on_poll_event(PollEventType type) {
+  if (type != PollEventType::ReadyToRead) {
+    throw std::runtime_error("Server got unexpected poll event");
+    // TODO make error more verbose
+  }
+
+  // the whole accept queue is taken at once, a burst of connects does not wait for more polls
+  try {
+    while (auto maybe_client_fd = this->accept()) {
+      this->_new_fd_signal->emit(maybe_client_fd.value());
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Client accepting error: " << e.what() << std::endl;
+  }
+}
+
+void Listener::bind_tcp() {
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Server starting on 0.0.0.0:" << this->_port
+    << (this->_reuseport ? " with SO_REUSEPORT" : "") << std::endl;
+
+  int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (server_fd < 0) {
+    std::ostringstream ss;
+    ss << "Failed to create server socket: " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  this->_server_fd = server_fd;
+
+  int reuse = 1;
+  if (setsockopt(*this->_server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+    std::ostringstream ss;
+    ss << "Setsockopt failed: " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  if (this->_reuseport && setsockopt(*this->_server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+    std::ostringstream ss;
+    ss << "Setsockopt SO_REUSEPORT failed: " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  struct sockaddr_in server_addr;
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = INADDR_ANY;
+  server_addr.sin_port = htons(this->_port);
+
+  bool binded = false;
+  const int retry_ms = 250;
+  const int max_tries = 8;
+  for (std::size_t tries = 0; tries < max_tries; ++tries) {
+    if (bind(*this->_server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
+      if (errno != EADDRINUSE) {
+        break;
+      }
+      if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG Failed to bind, address in use, retrying in " << retry_ms << "ms, try #" << tries + 1 << std::endl;
+      usleep(retry_ms * 1000);
+    } else {
+      binded = true;
+      break;
+    }
+  }
+
+  if (!binded) {
+    std::ostringstream ss;
+    ss << "Failed to bind to port " << this->_port << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+}
+
+void Listener::bind_unix() {
+  const auto& path = this->_unix_path.value();
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Server starting on unix socket " << path << std::endl;
+
+  struct sockaddr_un server_addr{};
+  server_addr.sun_family = AF_UNIX;
+  if (path.native().size() >= sizeof(server_addr.sun_path)) {
+    std::ostringstream ss;
+    ss << "Unix socket path is too long: " << path;
+    throw std::runtime_error(ss.str());
+  }
+  std::strcpy(server_addr.sun_path, path.c_str());
+
+  int server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (server_fd < 0) {
+    std::ostringstream ss;
+    ss << "Failed to create unix server socket: " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  this->_server_fd = server_fd;
+
+  // a socket file left by a previous run would fail the bind
+  ::unlink(path.c_str());
+
+  if (bind(*this->_server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
+    std::ostringstream ss;
+    ss << "Failed to bind to unix socket " << path << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  if (this->_unix_perm != 0 && ::chmod(path.c_str(), this->_unix_perm) != 0) {
+    std::ostringstream ss;
+    ss << "Failed to set permissions of unix socket " << path << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+}
+
+std::optional<int> Listener::accept() {
+  while (true) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+
+    int accept_res = ::accept4(this->_server_fd.value(), (struct sockaddr *)&client_addr, &client_addr_len,
+      SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (accept_res >= 0) {
+      return accept_res;
+    }
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return {};
+    } else if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+      // that connection is gone already, the next one may be fine
+      continue;
+    } else {
+      std::ostringstream ss;
+      ss << "Server got error on accept: errno=" << errno;
+      throw std::runtime_error(ss.str());
+    }
+  }
+}
+
+void Listener::close() {
+  if (this->_server_fd) {
+    this->_removed_server_fd_signal->emit(this->_server_fd.value());
+    ::close(this->_server_fd.value());
+    this->_server_fd.reset();
+
+    if (this->_unix_path) {
+      ::unlink(this->_unix_path->c_str());
+    }
+  }
+}
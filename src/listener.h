@@ -0,0 +1,52 @@
+#pragma once
+
+#include "events.h"
+#include "poller.h"
+#include "signal_slot.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <sys/types.h>
+
+// Listening TCP or unix domain socket, every accepted connection comes out of new_fd non
+// blocking. With reuseport several listeners share the port, each in its own loop, and the
+// kernel deals the incoming connections between them.
+class Listener {
+public:
+  Listener(EventLoopPtr event_loop, int port, int backlog, bool reuseport = false);
+  // unix_perm 0 leaves the socket file's mode to the umask
+  Listener(EventLoopPtr event_loop, std::filesystem::path unix_path, mode_t unix_perm, int backlog);
+  ~Listener();
+
+  SignalPtr<int, PollEventTypeList, PollCallback>& new_server_fd();
+  SignalPtr<int>& removed_server_fd();
+  SignalPtr<int>& new_fd();
+
+private:
+  EventLoopPtr _event_loop;
+
+  int _port;
+  int _backlog;
+  bool _reuseport;
+  std::optional<std::filesystem::path> _unix_path;
+  mode_t _unix_perm = 0;
+
+  SignalPtr<int, PollEventTypeList, PollCallback> _new_server_fd_signal;
+  SignalPtr<int> _removed_server_fd_signal;
+  SignalPtr<int> _new_fd_signal;
+
+  EventLoop::JobHandle _start_handle;
+
+  std::optional<int> _server_fd;
+
+  void start();
+  void on_poll_event(PollEventType);
+  void bind_tcp();
+  void bind_unix();
+
+  std::optional<int> accept();
+
+  void close();
+};
+using ListenerPtr = std::shared_ptr<Listener>;
@@ -0,0 +1,250 @@
+#include "listpack.h"
+
+#include "utils.h"
+
+#include <stdexcept>
+
+namespace {
+
+constexpr std::size_t LP_HEADER_SIZE = 6;
+constexpr std::uint8_t LP_EOF = 0xFF;
+
+enum Encoding : std::uint8_t {
+  LP_ENCODING_7BIT_UINT = 0x00,
+  LP_ENCODING_6BIT_STR = 0x80,
+  LP_ENCODING_13BIT_INT = 0xC0,
+  LP_ENCODING_12BIT_STR = 0xE0,
+  LP_ENCODING_32BIT_STR = 0xF0,
+  LP_ENCODING_16BIT_INT = 0xF1,
+  LP_ENCODING_24BIT_INT = 0xF2,
+  LP_ENCODING_32BIT_INT = 0xF3,
+  LP_ENCODING_64BIT_INT = 0xF4,
+};
+
+std::size_t backlen_size(std::size_t entry_size) {
+  if (entry_size <= 127) {
+    return 1;
+  } else if (entry_size < 16383) {
+    return 2;
+  } else if (entry_size < 2097151) {
+    return 3;
+  } else if (entry_size < 268435455) {
+    return 4;
+  }
+  return 5;
+}
+
+void append_le(std::string& out, std::uint64_t value, std::size_t bytes) {
+  for (std::size_t i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+std::uint64_t read_le(std::string_view data, std::size_t pos, std::size_t bytes) {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < bytes; ++i) {
+    value |= std::uint64_t(static_cast<std::uint8_t>(data[pos + i])) << (8 * i);
+  }
+  return value;
+}
+
+// two's complement of the given width back to a signed value
+std::int64_t to_signed(std::uint64_t value, std::size_t bits) {
+  if (bits < 64 && value >= (std::uint64_t(1) << (bits - 1))) {
+    return static_cast<std::int64_t>(value) - (std::int64_t(1) << bits);
+  }
+  return static_cast<std::int64_t>(value);
+}
+
+} // namespace
+
+ListpackWriter::ListpackWriter() {
+  this->_data.append(LP_HEADER_SIZE, '\0');
+}
+
+ListpackWriter& ListpackWriter::string(std::string_view value) {
+  const auto start = this->_data.size();
+  const auto size = value.size();
+
+  if (size < 64) {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_6BIT_STR | size));
+  } else if (size < 4096) {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_12BIT_STR | (size >> 8)));
+    this->_data.push_back(static_cast<char>(size & 0xff));
+  } else {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_32BIT_STR));
+    append_le(this->_data, size, 4);
+  }
+  this->_data.append(value);
+
+  this->backlen(this->_data.size() - start);
+  ++this->_count;
+  return *this;
+}
+
+ListpackWriter& ListpackWriter::integer(std::int64_t value) {
+  const auto start = this->_data.size();
+  const auto uvalue = static_cast<std::uint64_t>(value);
+
+  if (value >= 0 && value <= 127) {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_7BIT_UINT | value));
+  } else if (value >= -4096 && value <= 4095) {
+    auto v = uvalue & 0x1fff;
+    this->_data.push_back(static_cast<char>(LP_ENCODING_13BIT_INT | (v >> 8)));
+    this->_data.push_back(static_cast<char>(v & 0xff));
+  } else if (value >= -32768 && value <= 32767) {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_16BIT_INT));
+    append_le(this->_data, uvalue, 2);
+  } else if (value >= -8388608 && value <= 8388607) {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_24BIT_INT));
+    append_le(this->_data, uvalue, 3);
+  } else if (value >= -2147483648LL && value <= 2147483647LL) {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_32BIT_INT));
+    append_le(this->_data, uvalue, 4);
+  } else {
+    this->_data.push_back(static_cast<char>(LP_ENCODING_64BIT_INT));
+    append_le(this->_data, uvalue, 8);
+  }
+
+  this->backlen(this->_data.size() - start);
+  ++this->_count;
+  return *this;
+}
+
+ListpackWriter& ListpackWriter::append(const ListpackWriter& other) {
+  this->_data.append(other._data, LP_HEADER_SIZE);
+  this->_count += other._count;
+  return *this;
+}
+
+std::size_t ListpackWriter::size() const {
+  return this->_data.size() + 1;
+}
+
+std::string ListpackWriter::finish() {
+  this->_data.push_back(static_cast<char>(LP_EOF));
+
+  std::string header;
+  append_le(header, this->_data.size(), 4);
+  append_le(header, this->_count < 65535 ? this->_count : 65535, 2);
+  this->_data.replace(0, LP_HEADER_SIZE, header);
+
+  return std::move(this->_data);
+}
+
+// the entry size written backwards, so the listpack can be walked from its tail as well
+void ListpackWriter::backlen(std::size_t entry_size) {
+  const auto bytes = backlen_size(entry_size);
+  for (std::size_t i = bytes; i > 0; --i) {
+    auto part = static_cast<std::uint8_t>((entry_size >> (7 * (i - 1))) & 127);
+    if (i != bytes) {
+      part |= 128;
+    }
+    this->_data.push_back(static_cast<char>(part));
+  }
+}
+
+ListpackReader::ListpackReader(std::string_view data)
+  : _data(data)
+  , _pos(LP_HEADER_SIZE)
+{
+  if (data.size() < LP_HEADER_SIZE + 1 || read_le(data, 0, 4) != data.size()) {
+    throw std::runtime_error("Malformed listpack header");
+  }
+}
+
+std::optional<ListpackReader::Element> ListpackReader::next() {
+  auto need = [this](std::size_t count) {
+    if (this->_pos + count > this->_data.size()) {
+      throw std::runtime_error("Listpack element out of bounds");
+    }
+  };
+
+  need(1);
+  const auto start = this->_pos;
+  const auto type = static_cast<std::uint8_t>(this->_data[this->_pos]);
+  if (type == LP_EOF) {
+    return {};
+  }
+
+  Element result;
+  std::size_t entry_size = 0;
+
+  auto take_string = [&](std::size_t header, std::size_t length) {
+    need(header + length);
+    result = this->_data.substr(start + header, length);
+    entry_size = header + length;
+  };
+
+  auto take_integer = [&](std::size_t bytes) {
+    need(1 + bytes);
+    result = to_signed(read_le(this->_data, start + 1, bytes), bytes * 8);
+    entry_size = 1 + bytes;
+  };
+
+  if ((type & 0x80) == LP_ENCODING_7BIT_UINT) {
+    result = std::int64_t(type & 0x7f);
+    entry_size = 1;
+  } else if ((type & 0xC0) == LP_ENCODING_6BIT_STR) {
+    take_string(1, type & 0x3f);
+  } else if ((type & 0xE0) == LP_ENCODING_13BIT_INT) {
+    need(2);
+    auto value = (std::uint64_t(type & 0x1f) << 8) | static_cast<std::uint8_t>(this->_data[start + 1]);
+    result = to_signed(value, 13);
+    entry_size = 2;
+  } else if ((type & 0xF0) == LP_ENCODING_12BIT_STR) {
+    need(2);
+    take_string(2, (std::size_t(type & 0x0f) << 8) | static_cast<std::uint8_t>(this->_data[start + 1]));
+  } else if (type == LP_ENCODING_32BIT_STR) {
+    need(5);
+    take_string(5, read_le(this->_data, start + 1, 4));
+  } else if (type == LP_ENCODING_16BIT_INT) {
+    take_integer(2);
+  } else if (type == LP_ENCODING_24BIT_INT) {
+    take_integer(3);
+  } else if (type == LP_ENCODING_32BIT_INT) {
+    take_integer(4);
+  } else if (type == LP_ENCODING_64BIT_INT) {
+    take_integer(8);
+  } else {
+    throw std::runtime_error(print_args("Unknown listpack encoding 0x", to_hex(type)));
+  }
+
+  this->_pos = start + entry_size;
+  need(backlen_size(entry_size));
+  this->_pos += backlen_size(entry_size);
+
+  return result;
+}
+
+std::optional<std::string> ListpackReader::next_string() {
+  auto element = this->next();
+  if (!element) {
+    return {};
+  }
+
+  if (auto str = std::get_if<std::string_view>(&element.value())) {
+    return std::string(*str);
+  }
+  return std::to_string(std::get<std::int64_t>(element.value()));
+}
+
+std::optional<std::int64_t> ListpackReader::next_integer() {
+  auto element = this->next();
+  if (!element) {
+    return {};
+  }
+
+  if (auto value = std::get_if<std::int64_t>(&element.value())) {
+    return *value;
+  }
+
+  // small numbers may still come as strings from older writers
+  const auto& str = std::get<std::string_view>(element.value());
+  std::int64_t value;
+  auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (ec != std::errc() || ptr != str.data() + str.size()) {
+    throw std::runtime_error("Listpack element is not an integer");
+  }
+  return value;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+
+// Listpack as Redis keeps it in RDB: a flat blob of string and integer
+// elements, with a header of total bytes and element count and a 0xFF terminator.
+class ListpackWriter {
+public:
+  ListpackWriter();
+
+  ListpackWriter& string(std::string_view value);
+  ListpackWriter& integer(std::int64_t value);
+
+  // Takes over the elements of another unfinished listpack.
+  ListpackWriter& append(const ListpackWriter& other);
+
+  std::size_t size() const;
+
+  // Fills in the header, the writer should not be used afterwards.
+  std::string finish();
+
+private:
+  std::string _data;
+  std::size_t _count = 0;
+
+  void backlen(std::size_t entry_size);
+};
+
+class ListpackReader {
+public:
+  using Element = std::variant<std::string_view, std::int64_t>;
+
+  // Throws std::runtime_error when the blob has no valid header.
+  explicit ListpackReader(std::string_view data);
+
+  std::optional<Element> next();
+
+  // Same as next(), integers are given back in their decimal form.
+  std::optional<std::string> next_string();
+  std::optional<std::int64_t> next_integer();
+
+private:
+  std::string_view _data;
+  std::size_t _pos;
+};
@@ -0,0 +1,174 @@
+#include "lzf.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t HASH_LOG = 14;
+constexpr std::size_t MAX_LITERAL = 1 << 5;
+constexpr std::size_t MAX_OFFSET = 1 << 13;
+constexpr std::size_t MAX_MATCH = (1 << 8) + (1 << 3);
+// the longest back reference takes 3 bytes, nothing expands any further than that
+constexpr std::size_t MAX_EXPANSION = MAX_MATCH / 3;
+
+inline std::size_t hash(const unsigned char* p) {
+  std::uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return ((v * 2654435761u) >> (32 - HASH_LOG)) & ((1 << HASH_LOG) - 1);
+}
+
+} // namespace
+
+std::optional<std::string> lzf_compress(std::string_view data) {
+  const auto* in = reinterpret_cast<const unsigned char*>(data.data());
+  const std::size_t size = data.size();
+
+  if (size < 4) {
+    return {};
+  }
+
+  std::vector<std::uint32_t> table(1 << HASH_LOG, 0); // positions + 1, 0 is empty
+
+  std::string out;
+  out.reserve(size);
+
+  std::size_t literal_pos = out.size();
+  std::size_t literals = 0;
+  out.push_back(0);
+
+  auto flush_literals = [&]() {
+    if (literals > 0) {
+      out[literal_pos] = static_cast<char>(literals - 1);
+    } else {
+      out.pop_back();
+    }
+  };
+
+  std::size_t pos = 0;
+  while (pos + 2 < size) {
+    if (out.size() >= size) {
+      return {};
+    }
+
+    auto h = hash(in + pos);
+    auto candidate = table[h];
+    table[h] = pos + 1;
+
+    if (candidate != 0) {
+      std::size_t ref = candidate - 1;
+      std::size_t distance = pos - ref - 1;
+
+      if (distance < MAX_OFFSET && in[ref] == in[pos] && in[ref + 1] == in[pos + 1] && in[ref + 2] == in[pos + 2]) {
+        std::size_t length = 3;
+        std::size_t max_length = std::min(MAX_MATCH, size - pos);
+        while (length < max_length && in[ref + length] == in[pos + length]) {
+          ++length;
+        }
+
+        flush_literals();
+
+        std::size_t encoded = length - 2;
+        if (encoded < 7) {
+          out.push_back(static_cast<char>((encoded << 5) | (distance >> 8)));
+        } else {
+          out.push_back(static_cast<char>((7 << 5) | (distance >> 8)));
+          out.push_back(static_cast<char>(encoded - 7));
+        }
+        out.push_back(static_cast<char>(distance & 0xff));
+
+        for (std::size_t i = pos + 1; i < pos + length && i + 2 < size; ++i) {
+          table[hash(in + i)] = i + 1;
+        }
+        pos += length;
+
+        literal_pos = out.size();
+        literals = 0;
+        out.push_back(0);
+        continue;
+      }
+    }
+
+    out.push_back(static_cast<char>(in[pos++]));
+    if (++literals == MAX_LITERAL) {
+      out[literal_pos] = static_cast<char>(MAX_LITERAL - 1);
+      literal_pos = out.size();
+      literals = 0;
+      out.push_back(0);
+    }
+  }
+
+  while (pos < size) {
+    out.push_back(static_cast<char>(in[pos++]));
+    if (++literals == MAX_LITERAL) {
+      out[literal_pos] = static_cast<char>(MAX_LITERAL - 1);
+      literal_pos = out.size();
+      literals = 0;
+      out.push_back(0);
+    }
+  }
+  flush_literals();
+
+  if (out.size() >= size) {
+    return {};
+  }
+  return out;
+}
+
+std::optional<std::string> lzf_decompress(std::string_view data, std::size_t size) {
+  const auto* in = reinterpret_cast<const unsigned char*>(data.data());
+  const std::size_t in_size = data.size();
+
+  // the size comes from the peer, it must not make us allocate more than the data can expand to
+  if (size > in_size * MAX_EXPANSION) {
+    return {};
+  }
+
+  std::string out;
+  out.reserve(size);
+
+  std::size_t pos = 0;
+  while (pos < in_size) {
+    std::size_t ctrl = in[pos++];
+
+    if (ctrl < MAX_LITERAL) {
+      std::size_t length = ctrl + 1;
+      if (pos + length > in_size || out.size() + length > size) {
+        return {};
+      }
+      out.append(reinterpret_cast<const char*>(in + pos), length);
+      pos += length;
+      continue;
+    }
+
+    std::size_t length = ctrl >> 5;
+    if (length == 7) {
+      if (pos >= in_size) {
+        return {};
+      }
+      length += in[pos++];
+    }
+    length += 2;
+
+    if (pos >= in_size) {
+      return {};
+    }
+    std::size_t distance = ((ctrl & 0x1f) << 8) + in[pos++] + 1;
+
+    if (distance > out.size() || out.size() + length > size) {
+      return {};
+    }
+
+    // byte by byte, the reference may overlap the bytes being written
+    std::size_t from = out.size() - distance;
+    for (std::size_t i = 0; i < length; ++i) {
+      out.push_back(out[from + i]);
+    }
+  }
+
+  if (out.size() != size) {
+    return {};
+  }
+  return out;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// LZF compression, the format used by Redis for RDB strings.
+
+// Returns nothing when the data does not get any smaller.
+std::optional<std::string> lzf_compress(std::string_view data);
+
+// Returns nothing when the input is malformed or does not expand to exactly size bytes.
+std::optional<std::string> lzf_decompress(std::string_view data, std::size_t size);
@@ -1,17 +1,18 @@
+#include "append_only_file.h"
 #include "debug.h"
 #include "events.h"
+#include "io_threads.h"
+#include "persistence.h"
 #include "poller.h"
 #include "replica.h"
 #include "server.h"
 #include "server_talker.h"
+#include "shards.h"
 #include "storage.h"
 #include "storage_middleware.h"
 #include "handlers_manager.h"
 
-#include "rdb_parser.h"
-
 #include <iostream>
-#include <fstream>
 #include <filesystem>
 
 class StorageMiddleware;
@@ -24,34 +25,115 @@ int main(int argc, char **argv) {
     auto event_loop = EventLoop::make();
 
     auto poller = std::make_shared<Poller>(event_loop);
+
+    if (info.server.shards > 1) {
+      // The main loop only accepts, clients are dealt to the shard threads which serve them
+      auto server = std::make_shared<Server>(event_loop, info);
+      auto shards = std::make_shared<Shards>(info.server.shards);
+      shards->load(server->info());
+
+      for (std::size_t i = 0; i < shards->count(); ++i) {
+        auto& shard = shards->at(i);
+        shard.handlers_manager()->set_talker([&shard, server, shards_ptr = shards.get()]() {
+          auto talker = std::make_shared<ServerTalker>(shard.event_loop());
+          talker->set_server(server);
+          talker->set_storage(shard.storage());
+          talker->set_shards(shards_ptr, shard.id());
+          return talker;
+        });
+        shard.set_remote_talker([&shard, server]() {
+          auto talker = std::make_shared<ServerTalker>(shard.event_loop());
+          talker->set_server(server);
+          talker->set_storage(shard.storage());
+          return talker;
+        });
+      }
+
+      if (info.server.reuseport) {
+        // the kernel deals connections to the shards' own listeners
+        for (std::size_t i = 0; i < shards->count(); ++i) {
+          shards->at(i).listen(info.server.tcp_port, info.server.tcp_backlog);
+        }
+
+        // and unless it has the unix socket to accept on, the main loop has nothing to do
+        if (info.server.unixsocket.empty()) {
+          shards->start();
+          shards->join();
+
+          return 0;
+        }
+      }
+
+      server->new_server_fd()->connect(poller->add_fd());
+      server->removed_server_fd()->connect(poller->remove_fd());
+      server->new_fd()->connect(shards->add_fd());
+
+      shards->start();
+      event_loop->start();
+
+      return 0;
+    }
+
+    // Built before the append only file, its write phase has to come after the log's flush
+    IOThreadsPtr io_threads;
+    if (info.server.io_threads > 1) {
+      io_threads = std::make_shared<IOThreads>(event_loop, info.server.io_threads);
+    }
+
     auto storage = std::make_shared<Storage>(event_loop);
     auto storage_middleware = std::make_shared<StorageMiddleware>(event_loop);
     auto handlers_manager = std::make_shared<HandlersManager>(event_loop);
+    auto persistence = std::make_shared<Persistence>(event_loop);
     auto server = std::make_shared<Server>(event_loop, info);
 
-    if (std::filesystem::exists(info.server.db_file_path())) {
-      std::ifstream dump(info.server.db_file_path(), std::ios::binary);
-      RDBParse(dump, *storage);
+    AppendOnlyFilePtr aof;
+    if (info.persistence.aof_enabled) {
+      aof = std::make_shared<AppendOnlyFile>(event_loop);
+      aof->set_server(server);
+      aof->set_storage(storage_middleware);
+      persistence->set_aof(aof);
     }
 
+    storage_middleware->set_storage(storage);
+    storage_middleware->set_server(server);
+
+    // The log and the link to the master both need the complete dataset: the log
+    // starts from it when missing and a full sync from the master would replace it.
     ReplicaPtr replica;
-    if (server->is_replica()) {
-      replica = std::make_shared<Replica>(event_loop);
-      replica->set_server(server);
-      replica->set_storage(storage_middleware);
-      replica->new_fd()->connect(poller->add_fd());
-      replica->removed_fd()->connect(poller->remove_fd());
-    }
+    auto loader = std::make_shared<Loader>(event_loop);
+    loader->set_server(server);
+    loader->set_storage(storage);
+    loader->set_on_loaded([&replica, event_loop, poller, server, storage_middleware, aof]() {
+      if (aof) {
+        aof->open();
+        storage_middleware->set_aof(aof);
+      }
 
-    storage_middleware->set_storage(storage);
+      if (server->is_replica()) {
+        replica = std::make_shared<Replica>(event_loop);
+        replica->set_server(server);
+        replica->set_storage(storage_middleware);
+        replica->set_replicas_manager(storage_middleware);
+        replica->new_fd()->connect(poller->add_fd());
+        replica->removed_fd()->connect(poller->remove_fd());
+      }
+    });
 
-    handlers_manager->set_talker([event_loop, server, storage_middleware]() {
+    persistence->set_server(server);
+    persistence->set_storage(storage_middleware);
+
+    handlers_manager->set_talker([event_loop, server, storage_middleware, persistence]() {
       auto talker = std::make_shared<ServerTalker>(event_loop);
       talker->set_server(server);
       talker->set_storage(storage_middleware);
       talker->set_replicas_manager(storage_middleware);
+      talker->set_persistence(persistence);
       return talker;
     });
+    if (io_threads) {
+      io_threads->set_server(server);
+      handlers_manager->set_io_threads(io_threads);
+    }
     handlers_manager->new_fd()->connect(poller->add_fd());
     handlers_manager->removed_fd()->connect(poller->remove_fd());
 
@@ -0,0 +1,55 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::ostringstream ss;
+    ss << "Can't open " << path.string() << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    std::ostringstream ss;
+    ss << "Can't stat " << path.string() << ": " << strerror(errno);
+    ::close(fd);
+    throw std::runtime_error(ss.str());
+  }
+
+  this->_size = st.st_size;
+  if (this->_size > 0) {
+    this->_data = ::mmap(nullptr, this->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (this->_data == MAP_FAILED) {
+      std::ostringstream ss;
+      ss << "Can't map " << path.string() << ": " << strerror(errno);
+      ::close(fd);
+      throw std::runtime_error(ss.str());
+    }
+
+    // the file is read once front to back: aggressive readahead, pages may go right after use
+    ::madvise(this->_data, this->_size, MADV_SEQUENTIAL);
+    ::madvise(this->_data, this->_size, MADV_WILLNEED);
+  }
+
+  // the mapping stays valid without the descriptor
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (this->_size > 0) {
+    ::munmap(this->_data, this->_size);
+  }
+}
+
+std::string_view MappedFile::data() const {
+  return {static_cast<const char*>(this->_data), this->_size};
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+// Read only mapping of a whole file, pages are read in by the kernel as they are touched.
+class MappedFile {
+public:
+  explicit MappedFile(const std::filesystem::path& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::string_view data() const;
+
+private:
+  void* _data = nullptr;
+  std::size_t _size = 0;
+};
@@ -2,8 +2,19 @@
 
 #include "message_common.h"
 
+#include <charconv>
 #include <sstream>
 
+namespace {
+
+void append_number(std::string& out, std::size_t value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out.append(buffer, result.ptr);
+}
+
+} // namespace
+
 Message::Message(Message::Type type, ValueType value)
   : _type(type)
   , _value(std::move(value))
@@ -22,6 +33,17 @@ const Message::ValueType& Message::getValue() const {
   return this->_value;
 }
 
+Message::ValueType& Message::getValue() {
+  return this->_value;
+}
+
+std::string_view Message::raw() const {
+  if (auto shared = std::get_if<SharedBytes>(&this->_value)) {
+    return **shared;
+  }
+  return std::get<std::string>(this->_value);
+}
+
 std::string Message::to_string() const {
   std::ostringstream ss;
   if (this->_type == Message::Type::Undefined) {
@@ -53,14 +75,12 @@ std::string Message::to_string() const {
         ss << element.to_string();
       }
     }
+  } else if (this->_type == Message::Type::Raw || this->_type == Message::Type::SyncChunk) {
+    return std::string(this->raw());
   }
   return ss.str();
 }
 
-std::size_t Message::size() const {
-  return this->to_string().size();
-}
-
 std::ostream& operator<<(std::ostream& stream, const Message& message) {
   if (message._type == Message::Type::Undefined) {
     stream << MESSAGE_UNDEFINED << std::endl;
@@ -92,6 +112,31 @@ std::ostream& operator<<(std::ostream& stream, const Message& message) {
         stream << element;
       }
     }
+  } else if (message._type == Message::Type::SyncChunk) {
+    stream << "[file chunk, size = " << message.raw().size() << "]" << std::endl;
+  } else if (message._type == Message::Type::Raw) {
+    stream << "[raw bytes, size = " << message.raw().size() << "]" << std::endl;
   }
   return stream;
 }
+
+MessageEncoder::MessageEncoder(std::string& out)
+  : _out(out)
+{
+}
+
+MessageEncoder& MessageEncoder::array(std::size_t size) {
+  this->_out.push_back(MESSAGE_ARRAY);
+  append_number(this->_out, size);
+  this->_out.append("\r\n");
+  return *this;
+}
+
+MessageEncoder& MessageEncoder::bulk(std::string_view data) {
+  this->_out.push_back(MESSAGE_BULK_STRING);
+  append_number(this->_out, data.size());
+  this->_out.append("\r\n");
+  this->_out.append(data);
+  this->_out.append("\r\n");
+  return *this;
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -18,23 +20,42 @@ public:
     Integer,
     BulkString,
     SyncResponse,
+    SyncChunk, // piece of SyncResponse payload, an empty one ends the transfer
     Array,
+
+    Raw, // already encoded bytes, sent as is
   };
 
-  using ValueType = std::variant<std::string, int, std::vector<Message>>;
+  // bytes sent as they are to several connections, each one holds a reference only
+  using SharedBytes = std::shared_ptr<const std::string>;
+  using ValueType = std::variant<std::string, int, std::vector<Message>, SharedBytes>;
 
   Message(Type type = Type::Undefined, ValueType value = {});
 
   Type type() const;
   void setValue(ValueType&& value);
   const ValueType& getValue() const;
+  ValueType& getValue();
+  // payload of Raw and SyncChunk messages, owned or shared
+  std::string_view raw() const;
 
   friend std::ostream& operator<<(std::ostream&, const Message&);
   std::string to_string() const;
 
-  std::size_t size() const;
-
 private:
   Type _type;
   ValueType _value;
 };
+
+
+// Writes RESP straight into a string, without building Message trees.
+class MessageEncoder {
+public:
+  explicit MessageEncoder(std::string& out);
+
+  MessageEncoder& array(std::size_t size);
+  MessageEncoder& bulk(std::string_view data);
+
+private:
+  std::string& _out;
+};
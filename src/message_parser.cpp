@@ -16,6 +16,8 @@ const std::unordered_set<char> EXPECTED_TYPES = {
 const std::unordered_set<char> LENGTH_TYPES = {
   '$'
 };
+const std::string_view SYNC_EOF_PREFIX = "EOF:";
+const std::size_t SYNC_EOF_MARK_SIZE = 40;
 
 
 template class MessageParser<std::deque<char>>;
@@ -37,11 +39,11 @@ public:
     return this->buffer.size();
   }
 
-  RawMessage get() {
-    auto message = this->buffer.front();
+  // the line stays owned by the unget stack, references survive further gets
+  const RawMessage& get() {
+    this->unget_stack.push(std::move(this->buffer.front()));
     this->buffer.pop_front();
-    this->unget_stack.push(message);
-    return std::move(message);
+    return this->unget_stack.top();
   }
 
   void clear_unget() {
@@ -64,7 +66,7 @@ public:
       return {};
     }
 
-    auto raw_message = this->get();
+    const auto& raw_message = this->get();
     if (raw_message[0] == MESSAGE_SIMPLE_STRING) {
       auto message = Message(Message::Type::SimpleString);
       message.setValue(std::string{raw_message.begin() + 1, raw_message.end()});
@@ -115,7 +117,7 @@ public:
         return {};
       }
 
-      message.setValue(this->get());
+      message.setValue(std::string(this->get()));
       return message;
     } else if (raw_message[0] == MESSAGE_ARRAY) {
       auto message = Message(Message::Type::Array);
@@ -140,6 +142,7 @@ public:
       }
 
       std::vector<Message> messages;
+      messages.reserve(length);
       for (int i = 0; i < length; ++i) {
         auto element = this->parse();
         if (!element) {
@@ -149,7 +152,7 @@ public:
         messages.emplace_back(std::move(element.value()));
       }
 
-      message.setValue(messages);
+      message.setValue(std::move(messages));
       return message;
     } else {
       std::ostringstream ss;
@@ -162,12 +165,42 @@ public:
 };
 
 template <typename T>
-MessageParser<T>::MessageParser(T& buffer)
-  : _buffer(buffer) {
+MessageParser<T>::MessageParser(T& buffer, bool capture_raw)
+  : _buffer(buffer)
+  , _capture_raw(capture_raw) {
 }
 
 template <typename T>
 std::optional<Message> MessageParser<T>::try_parse(Message::Type expected) {
+  auto message = this->try_parse_next(expected);
+  if (message && this->_capture_raw) {
+    // raw lines are taken one by one until a message completes, so the bytes
+    // taken since the previous message are exactly the ones of this message
+    std::swap(this->_last_message_raw, this->_consumed);
+    this->_consumed.clear();
+  }
+  return message;
+}
+
+template <typename T>
+std::string_view MessageParser<T>::last_message_raw() const {
+  return this->_last_message_raw;
+}
+
+template <typename T>
+void MessageParser<T>::erase_front(std::size_t count) {
+  if (this->_capture_raw) {
+    this->_consumed.append(this->_buffer.begin(), this->_buffer.begin() + count);
+  }
+  this->_buffer.erase(this->_buffer.begin(), this->_buffer.begin() + count);
+}
+
+template <typename T>
+std::optional<Message> MessageParser<T>::try_parse_next(Message::Type expected) {
+  if (expected == Message::Type::SyncChunk) {
+    return this->try_parse_sync_chunk();
+  }
+
   ParseHelper<T> helper(this->_raw_message_buffer);
 
   while (this->_buffer.size() > 0) {
@@ -200,7 +233,7 @@ bool MessageParser<T>::get_next_raw_message(Message::Type expected) {
     auto first = this->_buffer.begin();
     auto last = this->_buffer.begin() + length;
     this->_raw_message_buffer.emplace_back(first, last);
-    this->_buffer.erase(first, last + delim_size);
+    this->erase_front(length + delim_size);
 
     this->_length_encoded_message_expected.reset();
     return true;
@@ -219,7 +252,7 @@ bool MessageParser<T>::get_next_raw_message(Message::Type expected) {
   }
 
   this->_raw_message_buffer.emplace_back(this->_buffer.begin(), result_it);
-  this->_buffer.erase(this->_buffer.begin(), result_it + DELIM.size());
+  this->erase_front(result_it - this->_buffer.begin() + DELIM.size());
 
   if (!LENGTH_TYPES.contains(type)) {
     return true;
@@ -236,3 +269,96 @@ bool MessageParser<T>::get_next_raw_message(Message::Type expected) {
 
   return true;
 }
+
+template <typename T>
+std::optional<Message> MessageParser<T>::try_parse_sync_chunk() {
+  if (this->_sync_eof_mark) {
+    return this->try_parse_sync_eof_chunk();
+  }
+
+  if (!this->_sync_remaining) {
+    if (this->_buffer.size() == 0) {
+      return {};
+    }
+
+    if (this->_buffer[0] != MESSAGE_BULK_STRING) {
+      std::ostringstream ss;
+      ss << "Unexpected message type for sync payload: " << this->_buffer[0];
+      throw std::runtime_error(ss.str());
+    }
+
+    auto result_it = std::search(this->_buffer.begin(), this->_buffer.end(), DELIM.begin(), DELIM.end());
+    if (result_it == this->_buffer.end()) {
+      return {};
+    }
+
+    std::string header(this->_buffer.begin() + 1, result_it);
+    if (header.starts_with(SYNC_EOF_PREFIX)) {
+      // diskless payload of unknown length, terminated by the mark given in the header
+      auto mark = header.substr(SYNC_EOF_PREFIX.size());
+      if (mark.size() != SYNC_EOF_MARK_SIZE) {
+        std::ostringstream ss;
+        ss << "Malformed EOF mark for sync payload: " << header;
+        throw std::runtime_error(ss.str());
+      }
+
+      this->_sync_eof_mark = std::move(mark);
+      this->erase_front(result_it - this->_buffer.begin() + DELIM.size());
+      return this->try_parse_sync_eof_chunk();
+    }
+
+    if (auto value = parseUInt64(header)) {
+      this->_sync_remaining = value.value();
+    } else {
+      std::ostringstream ss;
+      ss << "Malformed length for sync payload: " << header;
+      throw std::runtime_error(ss.str());
+    }
+
+    this->erase_front(result_it - this->_buffer.begin() + DELIM.size());
+  }
+
+  auto& remaining = this->_sync_remaining.value();
+  if (remaining == 0) {
+    this->_sync_remaining.reset();
+    return Message(Message::Type::SyncChunk, std::string{});
+  }
+
+  if (this->_buffer.size() == 0) {
+    return {};
+  }
+
+  auto chunk_size = std::min<std::size_t>(remaining, this->_buffer.size());
+  Message message(Message::Type::SyncChunk, std::string(this->_buffer.begin(), this->_buffer.begin() + chunk_size));
+  this->erase_front(chunk_size);
+  remaining -= chunk_size;
+
+  return message;
+}
+
+template <typename T>
+std::optional<Message> MessageParser<T>::try_parse_sync_eof_chunk() {
+  const auto& mark = this->_sync_eof_mark.value();
+
+  auto mark_it = std::search(this->_buffer.begin(), this->_buffer.end(), mark.begin(), mark.end());
+  if (mark_it == this->_buffer.begin()) {
+    this->erase_front(mark.size());
+    this->_sync_eof_mark.reset();
+    return Message(Message::Type::SyncChunk, std::string{});
+  }
+
+  // without the mark the tail may still be its beginning, hold it back
+  std::size_t chunk_size = mark_it - this->_buffer.begin();
+  if (mark_it == this->_buffer.end()) {
+    chunk_size = this->_buffer.size() > mark.size() ? this->_buffer.size() - mark.size() : 0;
+  }
+
+  if (chunk_size == 0) {
+    return {};
+  }
+
+  Message message(Message::Type::SyncChunk, std::string(this->_buffer.begin(), this->_buffer.begin() + chunk_size));
+  this->erase_front(chunk_size);
+
+  return message;
+}
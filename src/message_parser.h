@@ -4,6 +4,8 @@
 
 #include <deque>
 #include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 
 template<typename T>
@@ -12,14 +14,28 @@ public:
   using RawMessage = std::string;
   using RawMessageBuffer = std::deque<RawMessage>;
 
-  MessageParser(T& buffer);
+  // capture_raw keeps a copy of the bytes of every message, for last_message_raw
+  MessageParser(T& buffer, bool capture_raw = false);
 
   std::optional<Message> try_parse(Message::Type expected);
 
+  // Bytes of the message returned last, exactly as they came in, empty without capture_raw.
+  std::string_view last_message_raw() const;
+
 private:
   T& _buffer;
   RawMessageBuffer _raw_message_buffer;
   std::optional<std::size_t> _length_encoded_message_expected;
+  std::optional<std::size_t> _sync_remaining;
+  std::optional<std::string> _sync_eof_mark;
+
+  bool _capture_raw;
+  std::string _consumed;
+  std::string _last_message_raw;
 
+  std::optional<Message> try_parse_next(Message::Type expected);
+  void erase_front(std::size_t count);
   bool get_next_raw_message(Message::Type expected);
+  std::optional<Message> try_parse_sync_chunk();
+  std::optional<Message> try_parse_sync_eof_chunk();
 };
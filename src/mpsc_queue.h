@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+
+// Unbounded multi producer single consumer queue, a push is one atomic exchange and never waits.
+// The nodes form a list from the consumer's tail to the producers' head, with a stub node so
+// the list is never empty (Dmitry Vyukov's intrusive MPSC design). A producer first swaps its
+// node in as the head and only then links the previous head to it: a consumer running between
+// the two steps sees the list cut short and finds the element on a later pop.
+template <typename T>
+class MPSCQueue {
+  struct Node {
+    std::atomic<Node*> next = nullptr;
+    std::optional<T> value;
+  };
+
+public:
+  MPSCQueue()
+    : _head(&this->_stub)
+    , _tail(&this->_stub)
+  {
+  }
+
+  ~MPSCQueue() {
+    while (this->pop()) {
+    }
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  // Any thread.
+  void push(T value) {
+    auto node = new Node;
+    node->value.emplace(std::move(value));
+    this->push_node(node);
+  }
+
+  // Consumer thread only.
+  std::optional<T> pop() {
+    Node* tail = this->_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &this->_stub) {
+      if (!next) {
+        return {};
+      }
+      this->_tail = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+      this->_tail = next;
+      return take(tail);
+    }
+
+    if (tail != this->_head.load(std::memory_order_acquire)) {
+      return {}; // a producer is between its two steps
+    }
+
+    // the last node can only go once something follows it, the stub is put back for that
+    this->push_node(&this->_stub);
+
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+      this->_tail = next;
+      return take(tail);
+    }
+
+    return {};
+  }
+
+private:
+  alignas(64) std::atomic<Node*> _head; // last pushed, written by producers
+  alignas(64) Node* _tail;              // next to pop, consumer only
+  Node _stub;
+
+  void push_node(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = this->_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  static std::optional<T> take(Node* node) {
+    std::optional<T> value = std::move(node->value);
+    delete node;
+    return value;
+  }
+};
@@ -0,0 +1,573 @@
+#include "persistence.h"
+
+#include "crc64.h"
+#include "debug.h"
+#include "mapped_file.h"
+#include "rdb_writer.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::size_t CRON_INTERVAL_MS = 100;
+constexpr std::size_t WRITE_CHUNK_SIZE = 64 * 1024;
+// loop time given to loading per iteration, clients are served in between
+constexpr auto LOAD_SLICE = std::chrono::milliseconds{20};
+// a failed background job is not restarted automatically sooner than that
+constexpr auto CHILD_RETRY_DELAY = std::chrono::seconds{5};
+
+std::filesystem::path temp_file_path(const std::filesystem::path& path, pid_t pid) {
+  return path.parent_path() / ("temp-" + std::to_string(pid) + ".rdb");
+}
+
+std::filesystem::path rewrite_file_path(const std::filesystem::path& aof_path, pid_t pid) {
+  return aof_path.parent_path() / ("temp-rewriteaof-bg-" + std::to_string(pid) + ".aof");
+}
+
+void write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto written = ::write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      std::ostringstream ss;
+      ss << "Write error saving DB on disk: " << strerror(errno);
+      throw std::runtime_error(ss.str());
+    }
+
+    data.remove_prefix(written);
+  }
+}
+
+// pages touched by either side after fork are private to the child, that is the copy-on-write cost
+std::uint64_t private_dirty_bytes() {
+  std::ifstream smaps("/proc/self/smaps_rollup");
+
+  std::uint64_t total = 0;
+  std::string line;
+  while (std::getline(smaps, line)) {
+    if (!line.starts_with("Private_Dirty:")) {
+      continue;
+    }
+
+    std::istringstream ss(line.substr(line.find(':') + 1));
+    std::uint64_t kb;
+    if (ss >> kb) {
+      total += kb * 1024;
+    }
+  }
+
+  return total;
+}
+
+} // namespace
+
+// The dump goes to a temp file first and replaces the old one only once it is fully
+// on disk, so a crash at any point leaves either the old or the new snapshot.
+void RDBSave(const std::filesystem::path& path, IStorage& storage, bool checksum) {
+  const auto temp_path = temp_file_path(path, ::getpid());
+
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    std::ostringstream ss;
+    ss << "Failed opening the temp RDB file " << temp_path.string() << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  try {
+    std::string buffer;
+    RDBWriter writer(buffer);
+    std::uint64_t crc = 0;
+
+    auto ctime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    // expiry lives on the values here, there is no separate table to give a hint for
+    const auto keys = storage.keys("*");
+    writer.header().aux("redis-ver", "7.2.0").aux("redis-bits", "64").aux("ctime", std::to_string(ctime))
+      .select_db(0).resize_db(keys.size(), 0);
+
+    for (const auto& key : keys) {
+      storage.dump(key, writer);
+
+      if (buffer.size() >= WRITE_CHUNK_SIZE) {
+        if (checksum) {
+          crc = crc64(crc, buffer);
+        }
+        write_all(fd, buffer);
+        buffer.clear();
+      }
+    }
+
+    writer.eof();
+    if (checksum) {
+      crc = crc64(crc, buffer);
+    }
+    writer.checksum(crc);
+    write_all(fd, buffer);
+
+    if (::fsync(fd) != 0) {
+      std::ostringstream ss;
+      ss << "Failed to fsync the temp RDB file: " << strerror(errno);
+      throw std::runtime_error(ss.str());
+    }
+  } catch (...) {
+    ::close(fd);
+    ::unlink(temp_path.c_str());
+    throw;
+  }
+
+  ::close(fd);
+
+  if (::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::ostringstream ss;
+    ss << "Error moving temp DB file " << temp_path.string() << " on the final destination " << path.string() << ": " << strerror(errno);
+    ::unlink(temp_path.c_str());
+    throw std::runtime_error(ss.str());
+  }
+
+  // the rename itself survives a crash only once the directory is synced
+  auto dir = path.parent_path().empty() ? std::filesystem::path(".") : path.parent_path();
+  int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+}
+
+Loader::Loader(EventLoopPtr event_loop)
+  : _event_loop(event_loop)
+{
+  this->_start_handle = this->_event_loop->post([this]() {
+    this->start();
+  });
+}
+
+void Loader::set_server(ServerPtr server) {
+  this->_server = std::move(server);
+}
+
+void Loader::set_storage(IStoragePtr storage) {
+  this->_storage = std::move(storage);
+}
+
+void Loader::set_on_loaded(std::function<void()> on_loaded) {
+  this->_on_loaded = std::move(on_loaded);
+}
+
+void Loader::start() {
+  const auto& info = this->_server->info();
+  auto& persistence = this->_server->info().persistence;
+
+  const bool from_aof = persistence.aof_enabled && std::filesystem::exists(info.aof_file_path());
+  this->_path = from_aof ? info.aof_file_path() : info.server.db_file_path();
+  if (!std::filesystem::exists(this->_path)) {
+    this->_on_loaded();
+    return;
+  }
+
+  this->_started = std::chrono::steady_clock::now();
+  persistence.loading = true;
+  persistence.loading_start_time = std::chrono::system_clock::now();
+  persistence.loading_total_bytes = std::filesystem::file_size(this->_path);
+  persistence.loading_loaded_bytes = 0;
+
+  if (from_aof) {
+    this->_aof.emplace(this->_path, persistence.rdb_checksum);
+  } else {
+    this->_rdb_file.emplace(this->_path);
+    this->_rdb.emplace(this->_rdb_file->data(), persistence.rdb_checksum);
+  }
+
+  this->_step_handle = this->_event_loop->repeat([this]() {
+    this->step();
+  });
+}
+
+void Loader::step() {
+  bool done = false;
+
+  try {
+    if (this->_aof) {
+      done = this->_aof->step(*this->_storage, LOAD_SLICE);
+      this->update_info(this->_aof->progress());
+    } else {
+      done = this->_rdb->step(*this->_storage, LOAD_SLICE);
+      this->update_info(this->_rdb->progress());
+    }
+  } catch (const std::exception& e) {
+    // the loop would keep repeating the failed step, a server with half a dataset must not serve it
+    std::cerr << "Error loading " << this->_path.string() << ": " << e.what() << ". Exiting..." << std::endl;
+    this->_rdb.reset();
+    this->_aof.reset();
+    std::exit(1);
+  }
+
+  if (done) {
+    this->finish();
+  } else {
+    this->_event_loop->keep_awake();
+  }
+}
+
+void Loader::update_info(const RDBLoadProgress& stats) {
+  auto& persistence = this->_server->info().persistence;
+  persistence.loading_loaded_bytes = stats.loaded_bytes;
+  persistence.rdb_last_load_keys_loaded = stats.keys_loaded;
+  persistence.rdb_last_load_keys_expired = stats.keys_expired;
+
+  const auto tenth = stats.total_bytes ? stats.loaded_bytes * 10 / stats.total_bytes : 10;
+  if (tenth > this->_reported_tenth) {
+    this->_reported_tenth = tenth;
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Loading " << this->_path.string() << ": " << tenth * 10 << "%, keys " << stats.keys_loaded << std::endl;
+  }
+}
+
+void Loader::finish() {
+  this->_step_handle.invalidate();
+  this->_rdb.reset();
+  this->_rdb_file.reset();
+  this->_aof.reset();
+
+  auto& persistence = this->_server->info().persistence;
+  persistence.loading = false;
+  persistence.rdb_last_load_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->_started).count();
+
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Dataset loaded in " << persistence.rdb_last_load_duration_ms.value() << "ms" << std::endl;
+
+  this->_on_loaded();
+}
+
+Persistence::Persistence(EventLoopPtr event_loop)
+  : _event_loop(event_loop)
+{
+  this->schedule_cron();
+}
+
+Persistence::~Persistence() {
+  if (this->_child) {
+    ::kill(this->_child->pid, SIGKILL);
+    ::waitpid(this->_child->pid, nullptr, 0);
+    ::close(this->_child->report_fd);
+
+    const auto target = this->child_target_path(this->_child->type, this->_child->pid);
+    ::unlink(temp_file_path(target, this->_child->pid).c_str());
+    if (this->_child->type == ChildType::AofRewrite) {
+      ::unlink(target.c_str());
+    }
+  }
+}
+
+void Persistence::set_server(ServerPtr server) {
+  this->_server = std::move(server);
+}
+
+void Persistence::set_storage(IStoragePtr storage) {
+  this->_storage = std::move(storage);
+}
+
+void Persistence::set_aof(AppendOnlyFilePtr aof) {
+  this->_aof = std::move(aof);
+}
+
+IPersistence::SaveStatus Persistence::save() {
+  if (this->_child) {
+    return SaveStatus::InProgress;
+  }
+
+  auto started = std::chrono::steady_clock::now();
+
+  try {
+    RDBSave(this->_server->info().server.db_file_path(), *this->_storage, this->_server->info().persistence.rdb_checksum);
+  } catch (const std::exception& e) {
+    std::cerr << "Failed saving the DB: " << e.what() << std::endl;
+    return SaveStatus::Failed;
+  }
+
+  auto& persistence = this->_server->info().persistence;
+  persistence.rdb_changes_since_last_save = 0;
+  persistence.rdb_last_save_time = std::chrono::system_clock::now();
+  persistence.rdb_saves += 1;
+  persistence.rdb_last_save_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG DB saved on disk" << std::endl;
+
+  return SaveStatus::Done;
+}
+
+IPersistence::SaveStatus Persistence::bgsave(bool schedule) {
+  if (this->_child) {
+    if (schedule) {
+      this->_bgsave_scheduled = true;
+      return SaveStatus::Scheduled;
+    }
+    return SaveStatus::InProgress;
+  }
+
+  return this->start_child(ChildType::Rdb);
+}
+
+IPersistence::SaveStatus Persistence::bgrewriteaof() {
+  if (!this->_aof) {
+    return SaveStatus::Disabled;
+  }
+
+  if (this->_child) {
+    if (this->_child->type == ChildType::AofRewrite) {
+      return SaveStatus::InProgress;
+    }
+
+    // the rewrite starts as soon as the running save is done
+    this->_server->info().persistence.aof_rewrite_scheduled = true;
+    return SaveStatus::Scheduled;
+  }
+
+  return this->start_child(ChildType::AofRewrite);
+}
+
+void Persistence::schedule_cron() {
+  this->_cron_handle = this->_event_loop->set_timeout(CRON_INTERVAL_MS, [this]() {
+    this->cron();
+    this->schedule_cron();
+  });
+}
+
+void Persistence::cron() {
+  this->check_child();
+
+  // nothing is saved from a half loaded dataset
+  if (this->_child || this->_server->info().persistence.loading) {
+    return;
+  }
+
+  if (this->save_point_reached()) {
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Save point reached, saving in background" << std::endl;
+    this->start_child(ChildType::Rdb);
+  } else if (this->aof_grew_enough()) {
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Append only file grew enough, rewriting in background" << std::endl;
+    this->start_child(ChildType::AofRewrite);
+  }
+}
+
+// Both kinds of child write an RDB, either the snapshot itself or the base of the new log.
+IPersistence::SaveStatus Persistence::start_child(ChildType type) {
+  auto& persistence = this->_server->info().persistence;
+  auto& last_status = type == ChildType::Rdb ? persistence.rdb_last_bgsave_status : persistence.aof_last_bgrewrite_status;
+
+  int report_fds[2];
+  if (::pipe2(report_fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+    std::cerr << "Can't start a background job: pipe: " << strerror(errno) << std::endl;
+    last_status = "err";
+    return SaveStatus::Failed;
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  (type == ChildType::Rdb ? this->_last_bgsave_try : this->_last_rewrite_try) = started;
+
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::close(report_fds[0]);
+
+    int code = 0;
+    try {
+      RDBSave(this->child_target_path(type, ::getpid()), *this->_storage, this->_server->info().persistence.rdb_checksum);
+    } catch (const std::exception& e) {
+      std::cerr << "Background job error: " << e.what() << std::endl;
+      code = 1;
+    }
+
+    std::uint64_t cow_size = private_dirty_bytes();
+    [[maybe_unused]] auto written = ::write(report_fds[1], &cow_size, sizeof(cow_size));
+    ::_exit(code);
+  }
+
+  ::close(report_fds[1]);
+
+  if (pid < 0) {
+    std::cerr << "Can't start a background job: fork: " << strerror(errno) << std::endl;
+    ::close(report_fds[0]);
+    last_status = "err";
+    return SaveStatus::Failed;
+  }
+
+  this->_child = Child{
+    .type = type,
+    .pid = pid,
+    .report_fd = report_fds[0],
+    .started = started,
+    .changes_at_fork = persistence.rdb_changes_since_last_save,
+  };
+
+  if (type == ChildType::Rdb) {
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Background saving started by pid " << pid << std::endl;
+
+    persistence.rdb_bgsave_in_progress = true;
+    persistence.rdb_current_bgsave_start = started;
+  } else {
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Background append only file rewriting started by pid " << pid << std::endl;
+
+    this->_aof->rewrite_started();
+    persistence.aof_rewrite_in_progress = true;
+    persistence.aof_current_rewrite_start = started;
+  }
+
+  return SaveStatus::Started;
+}
+
+void Persistence::check_child() {
+  if (!this->_child) {
+    return;
+  }
+
+  auto child = this->_child.value();
+
+  int status = 0;
+  auto result = ::waitpid(child.pid, &status, WNOHANG);
+  if (result == 0) {
+    return;
+  }
+
+  this->_child.reset();
+
+  const bool ok = result == child.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+  std::uint64_t cow_size = 0;
+  if (::read(child.report_fd, &cow_size, sizeof(cow_size)) != sizeof(cow_size)) {
+    cow_size = 0;
+  }
+  ::close(child.report_fd);
+
+  if (child.type == ChildType::Rdb) {
+    this->_server->info().persistence.rdb_last_cow_size = cow_size;
+    this->bgsave_done(child, ok);
+  } else {
+    this->_server->info().persistence.aof_last_cow_size = cow_size;
+    this->rewrite_done(child, ok);
+  }
+
+  auto& persistence = this->_server->info().persistence;
+  if (persistence.aof_rewrite_scheduled) {
+    persistence.aof_rewrite_scheduled = false;
+    this->start_child(ChildType::AofRewrite);
+  } else if (this->_bgsave_scheduled) {
+    this->_bgsave_scheduled = false;
+    this->start_child(ChildType::Rdb);
+  }
+}
+
+void Persistence::bgsave_done(const Child& child, bool ok) {
+  auto elapsed = std::chrono::steady_clock::now() - child.started;
+
+  auto& persistence = this->_server->info().persistence;
+  persistence.rdb_bgsave_in_progress = false;
+  persistence.rdb_current_bgsave_start.reset();
+  persistence.rdb_last_bgsave_time_sec = std::chrono::duration_cast<std::chrono::seconds>(elapsed).count();
+  persistence.rdb_last_save_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+
+  if (ok) {
+    // writes made while the child was running are not in the snapshot
+    persistence.rdb_changes_since_last_save -= std::min(child.changes_at_fork, persistence.rdb_changes_since_last_save);
+    persistence.rdb_last_save_time = std::chrono::system_clock::now();
+    persistence.rdb_last_bgsave_status = "ok";
+    persistence.rdb_saves += 1;
+
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Background saving terminated with success" << std::endl;
+  } else {
+    persistence.rdb_last_bgsave_status = "err";
+    ::unlink(temp_file_path(this->child_target_path(child.type, child.pid), child.pid).c_str());
+
+    std::cerr << "Background saving terminated with error" << std::endl;
+  }
+}
+
+void Persistence::rewrite_done(const Child& child, bool ok) {
+  auto elapsed = std::chrono::steady_clock::now() - child.started;
+  const auto base_path = this->child_target_path(child.type, child.pid);
+
+  auto& persistence = this->_server->info().persistence;
+  persistence.aof_rewrite_in_progress = false;
+  persistence.aof_current_rewrite_start.reset();
+  persistence.aof_last_rewrite_time_sec = std::chrono::duration_cast<std::chrono::seconds>(elapsed).count();
+
+  if (ok) {
+    try {
+      this->_aof->rewrite_done(base_path);
+    } catch (const std::exception& e) {
+      std::cerr << "Can't switch to the rewritten append only file: " << e.what() << std::endl;
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    persistence.aof_last_bgrewrite_status = "ok";
+    persistence.aof_rewrites += 1;
+
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Background append only file rewriting terminated with success" << std::endl;
+  } else {
+    this->_aof->rewrite_failed();
+    persistence.aof_last_bgrewrite_status = "err";
+    ::unlink(temp_file_path(base_path, child.pid).c_str());
+    ::unlink(base_path.c_str());
+
+    std::cerr << "Background append only file rewriting terminated with error" << std::endl;
+  }
+}
+
+bool Persistence::save_point_reached() const {
+  const auto& persistence = this->_server->info().persistence;
+
+  if (persistence.rdb_last_bgsave_status != "ok" && this->_last_bgsave_try
+      && std::chrono::steady_clock::now() - this->_last_bgsave_try.value() < CHILD_RETRY_DELAY) {
+    return false;
+  }
+
+  auto since_save = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - persistence.rdb_last_save_time).count();
+  for (const auto& point : persistence.save_points) {
+    if (persistence.rdb_changes_since_last_save >= point.changes && static_cast<std::size_t>(since_save) >= point.seconds) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Persistence::aof_grew_enough() const {
+  if (!this->_aof) {
+    return false;
+  }
+
+  const auto& persistence = this->_server->info().persistence;
+  if (persistence.auto_aof_rewrite_percentage == 0 || persistence.aof_current_size < persistence.auto_aof_rewrite_min_size) {
+    return false;
+  }
+
+  if (persistence.aof_last_bgrewrite_status != "ok" && this->_last_rewrite_try
+      && std::chrono::steady_clock::now() - this->_last_rewrite_try.value() < CHILD_RETRY_DELAY) {
+    return false;
+  }
+
+  const auto base = std::max<std::size_t>(persistence.aof_base_size, 1);
+  if (persistence.aof_current_size <= base) {
+    return false;
+  }
+
+  return (persistence.aof_current_size - base) * 100 / base >= persistence.auto_aof_rewrite_percentage;
+}
+
+std::filesystem::path Persistence::child_target_path(ChildType type, pid_t pid) const {
+  if (type == ChildType::Rdb) {
+    return this->_server->info().server.db_file_path();
+  }
+  return rewrite_file_path(this->_server->info().aof_file_path(), pid);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "append_only_file.h"
+#include "events.h"
+#include "server.h"
+#include "storage.h"
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <sys/types.h>
+
+class IPersistence {
+public:
+  enum class SaveStatus {
+    Done,
+    Started,
+    Scheduled,
+    InProgress,
+    Disabled,
+    Failed,
+  };
+
+  virtual ~IPersistence() = default;
+
+  // SAVE: writes the snapshot right away, the loop is blocked meanwhile
+  virtual SaveStatus save() = 0;
+  // BGSAVE: a forked child writes the snapshot, the memory is shared copy-on-write
+  virtual SaveStatus bgsave(bool schedule) = 0;
+  // BGREWRITEAOF: a forked child writes the dataset as the new base of the append only file
+  virtual SaveStatus bgrewriteaof() = 0;
+};
+using IPersistencePtr = std::shared_ptr<IPersistence>;
+
+// Writes the whole keyspace as an RDB file at `path`, blocking until it is on disk.
+void RDBSave(const std::filesystem::path& path, IStorage& storage, bool checksum);
+
+// Startup load from the append only file when it is enabled and exists, from the RDB otherwise.
+// It runs in slices on the loop, so the port is up meanwhile and clients get -LOADING.
+class Loader {
+public:
+  Loader(EventLoopPtr event_loop);
+
+  void set_server(ServerPtr);
+  void set_storage(IStoragePtr);
+  // Called once the dataset is complete, also when there was nothing to load.
+  void set_on_loaded(std::function<void()>);
+
+private:
+  EventLoopPtr _event_loop;
+
+  ServerPtr _server;
+  IStoragePtr _storage;
+  std::function<void()> _on_loaded;
+
+  std::filesystem::path _path;
+  std::optional<MappedFile> _rdb_file;
+  std::optional<RDBLoader> _rdb;
+  std::optional<AOFLoader> _aof;
+
+  std::chrono::steady_clock::time_point _started;
+  std::size_t _reported_tenth = 0;
+
+  EventLoop::JobHandle _start_handle;
+  EventLoop::JobHandle _step_handle;
+
+  void start();
+  void step();
+  void update_info(const RDBLoadProgress&);
+  void finish();
+};
+using LoaderPtr = std::shared_ptr<Loader>;
+
+class Persistence : public IPersistence {
+  enum class ChildType {
+    Rdb,
+    AofRewrite,
+  };
+
+  struct Child {
+    ChildType type;
+    pid_t pid;
+    int report_fd; // the child writes its copy-on-write size here before exit
+    std::chrono::steady_clock::time_point started;
+    std::size_t changes_at_fork;
+  };
+
+public:
+  Persistence(EventLoopPtr event_loop);
+  ~Persistence();
+
+  void set_server(ServerPtr);
+  void set_storage(IStoragePtr);
+  void set_aof(AppendOnlyFilePtr);
+
+  SaveStatus save() override;
+  SaveStatus bgsave(bool schedule) override;
+  SaveStatus bgrewriteaof() override;
+
+private:
+  EventLoopPtr _event_loop;
+
+  ServerPtr _server;
+  IStoragePtr _storage;
+  AppendOnlyFilePtr _aof;
+
+  std::optional<Child> _child;
+  bool _bgsave_scheduled = false;
+  std::optional<std::chrono::steady_clock::time_point> _last_bgsave_try;
+  std::optional<std::chrono::steady_clock::time_point> _last_rewrite_try;
+
+  EventLoop::JobHandle _cron_handle;
+
+  void schedule_cron();
+  void cron();
+
+  SaveStatus start_child(ChildType type);
+  void check_child();
+  void bgsave_done(const Child& child, bool ok);
+  void rewrite_done(const Child& child, bool ok);
+
+  bool save_point_reached() const;
+  bool aof_grew_enough() const;
+
+  std::filesystem::path child_target_path(ChildType type, pid_t pid) const;
+};
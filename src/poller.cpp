@@ -2,14 +2,15 @@
 
 #include "debug.h"
 
+#include <cerrno>
 #include <iostream>
 #include <sstream>
 
 Poller::Poller(EventLoopPtr event_loop)
   : _event_loop(event_loop) {
-  this->_slot_add = std::make_shared<Slot<int, PollEventTypeList, SignalPtr<PollEventType>>>(
-    [this](int fd, PollEventTypeList types, SignalPtr<PollEventType> signal) {
-      short flags;
+  this->_slot_add = std::make_shared<Slot<int, PollEventTypeList, PollCallback>>(
+    [this](int fd, PollEventTypeList types, PollCallback callback) {
+      short flags = 0;
       if (types.contains(PollEventType::ReadyToRead)) {
         flags |= POLLIN;
       }
@@ -22,17 +23,15 @@ Poller::Poller(EventLoopPtr event_loop)
         this->_fds.push_back(pollfd{
             .fd = fd,
             .events = flags});
+        this->_callbacks.push_back(callback);
 
         this->_handlers[fd] = SocketEventHandler{
             .fd = fd,
-            .flags = flags,
-            .signal = signal,
             .pos_in_fds = this->_fds.size() - 1};
       } else {
         auto& handler = it->second;
-        handler.flags = flags;
-        handler.signal = signal;
         this->_fds[handler.pos_in_fds].events = flags;
+        this->_callbacks[handler.pos_in_fds] = callback;
       }
     });
 
@@ -44,16 +43,24 @@ Poller::Poller(EventLoopPtr event_loop)
 
     auto& handler = it->second;
     this->_fds[handler.pos_in_fds].fd = -1; // ignore this socket in polling
+    this->_callbacks[handler.pos_in_fds] = {};
     // TODO make cleanup process, running periodically
     this->_handlers.erase(fd);
   });
 
+  // jobs posted to the loop from other threads end the wait in poll, it also keeps
+  // a loop without sockets from spinning
+  this->_slot_add->call(
+    this->_event_loop->wakeup_fd(),
+    PollEventTypeList{PollEventType::ReadyToRead},
+    PollCallback::bind<&Poller::wakeup>(this));
+
   this->_start_handle = this->_event_loop->post([this](){
     this->start();
   });
 }
 
-SlotPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& Poller::add_fd() {
+SlotPtr<int, PollEventTypeList, PollCallback>& Poller::add_fd() {
   return this->_slot_add;
 }
 
@@ -63,13 +70,14 @@ SlotPtr<int>& Poller::remove_fd() {
 
 void Poller::start() {
   this->_loop_handle = this->_event_loop->repeat([this]() {
-    if (this->_handlers.size() == 0) {
-      return;
-    }
-
-    auto poll_res = ::poll(this->_fds.data(), this->_fds.size(), 1);
+    // the loop's eventfd is polled as well, jobs posted by other threads end the wait
+    auto poll_res = ::poll(this->_fds.data(), this->_fds.size(), this->_event_loop->poll_timeout_ms());
 
     if (poll_res < 0) {
+      if (errno == EINTR) {
+        return;
+      }
+
       std::ostringstream ss;
       ss << "Poller got error on poll: errno=" << errno;
       throw std::runtime_error(ss.str());
@@ -81,41 +89,52 @@ void Poller::start() {
 
     if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG Poller fd with events count = " << poll_res << std::endl;
 
-    for (const auto& fd: this->_fds) {
-      if (fd.revents > 0) {
+    this->_event_loop->keep_awake();
+
+    for (std::size_t pos = 0; pos < this->_fds.size() && poll_res > 0; ++pos) {
+      const auto revents = this->_fds[pos].revents;
+      if (revents > 0) {
         --poll_res;
+        this->dispatch(pos, revents);
+      }
+    }
+  });
+}
 
-        auto& handler = this->_handlers[fd.fd];
+void Poller::dispatch(std::size_t pos, short revents) {
+  // a callback may remove its own socket or one polled later in this round, which are skipped,
+  // or add new ones, which move _fds but never take this position
+  const auto emit = [this, pos](PollEventType type, const char* name) {
+    if (this->_fds[pos].fd < 0) {
+      return;
+    }
 
-        if (fd.revents & POLLNVAL) {
-          handler.signal->emit(PollEventType::InvalidFD);
-          if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG InvalidFD event sent to handler with fd = " << handler.fd << std::endl;
-        }
+    auto callback = this->_callbacks[pos];
+    if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG " << name << " event sent to handler with fd = " << this->_fds[pos].fd << std::endl;
+    callback(type);
+  };
 
-        if (fd.revents & POLLERR) {
-          handler.signal->emit(PollEventType::Error);
-          if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG Error event sent to handler with fd = " << handler.fd << std::endl;
-        }
+  if (revents & POLLNVAL) {
+    emit(PollEventType::InvalidFD, "InvalidFD");
+  }
 
-        if (fd.revents & POLLHUP) {
-          handler.signal->emit(PollEventType::HangUp);
-          if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG HangUp event sent to handler with fd = " << handler.fd << std::endl;
-        }
+  if (revents & POLLERR) {
+    emit(PollEventType::Error, "Error");
+  }
 
-        if (handler.flags & POLLIN && fd.revents & POLLIN) {
-          handler.signal->emit(PollEventType::ReadyToRead);
-          if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG ReadyToRead event sent to handler with fd = " << handler.fd << std::endl;
-        }
+  if (revents & POLLHUP) {
+    emit(PollEventType::HangUp, "HangUp");
+  }
 
-        if (handler.flags & POLLOUT && fd.revents & POLLOUT) {
-          handler.signal->emit(PollEventType::ReadyToWrite);
-          if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG ReadyToWrite event sent to handler with fd = " << handler.fd << std::endl;
-        }
-      }
+  if (this->_fds[pos].events & POLLIN && revents & POLLIN) {
+    emit(PollEventType::ReadyToRead, "ReadyToRead");
+  }
 
-      if (poll_res == 0) {
-        break;
-      }
-    }
-  });
+  if (this->_fds[pos].events & POLLOUT && revents & POLLOUT) {
+    emit(PollEventType::ReadyToWrite, "ReadyToWrite");
+  }
+}
+
+void Poller::wakeup(PollEventType) {
+  this->_event_loop->wakeup();
 }
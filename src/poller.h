@@ -17,23 +17,23 @@ enum class PollEventType {
   InvalidFD,
 };
 using PollEventTypeList = std::unordered_set<PollEventType>;
+// Called for every event on a polled socket, until the socket is removed from the poller.
+using PollCallback = Callback<PollEventType>;
 
 class Poller {
 public:
   Poller(EventLoopPtr event_loop);
 
-  SlotPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& add_fd();
+  SlotPtr<int, PollEventTypeList, PollCallback>& add_fd();
   SlotPtr<int>& remove_fd();
 
 private:
   struct SocketEventHandler {
     int fd;
-    short flags;
-    SignalPtr<PollEventType> signal;
     std::size_t pos_in_fds;
   };
 
-  SlotPtr<int, PollEventTypeList, SignalPtr<PollEventType>> _slot_add;
+  SlotPtr<int, PollEventTypeList, PollCallback> _slot_add;
   SlotPtr<int> _slot_remove;
   EventLoopPtr _event_loop;
 
@@ -41,8 +41,11 @@ private:
   EventLoop::JobHandle _loop_handle;
 
   std::vector<pollfd> _fds;
+  std::vector<PollCallback> _callbacks; // by position in _fds
   std::unordered_map<int, SocketEventHandler> _handlers;
 
   void start();
+  void dispatch(std::size_t pos, short revents);
+  void wakeup(PollEventType);
 };
 using PollerPtr = std::shared_ptr<Poller>;
\ No newline at end of file
@@ -1,11 +1,27 @@
 #include "rdb_parser.h"
 
+#include "crc64.h"
 #include "debug.h"
+#include "intset.h"
+#include "listpack.h"
+#include "lzf.h"
 #include "utils.h"
+#include "ziplist.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <variant>
 
 RDBParseError::RDBParseError(std::string reason)
   : std::runtime_error(reason)
@@ -14,18 +30,174 @@ RDBParseError::RDBParseError(std::string reason)
 
 namespace {
 
+// the worker hands decoded entries over in batches of about that many file bytes
+constexpr std::size_t LOAD_BATCH_SIZE = 1024 * 1024;
+// decoded batches waiting for the listener, bounds the memory held on top of the dataset
+constexpr std::size_t LOAD_QUEUE_DEPTH = 4;
+// the clock is read once per that many entries passed on
+constexpr std::size_t APPLY_CLOCK_CHECK_ITEMS = 256;
+
+// Thrown when the window ends in the middle of an item: `count` bytes from `at` were asked for.
+struct NeedMoreData {
+  const char* at;
+  std::size_t count;
+};
+
+class RDBReader {
+public:
+  RDBReader(const char* begin, const char* end)
+    : pos(begin), end(end)
+  {
+  }
+
+  const char* position() const {
+    return this->pos;
+  }
+
+  std::uint8_t peek_uint8() {
+    this->need(1);
+    return static_cast<std::uint8_t>(*this->pos);
+  }
+
+  std::string parse_string(std::size_t count) {
+    return std::string(this->parse_view(count));
+  }
+
+  // points into the parsed window, valid only as long as it is
+  std::string_view parse_view(std::size_t count) {
+    this->need(count);
+    std::string_view result(this->pos, count);
+    this->pos += count;
+    return result;
+  }
+
+  std::int8_t parse_int8() {
+    return this->parse_raw<std::int8_t>();
+  }
+
+  std::uint8_t parse_uint8() {
+    return this->parse_raw<std::uint8_t>();
+  }
+
+  std::int16_t parse_int16() {
+    return this->parse_raw<std::int16_t>();
+  }
+
+  std::int32_t parse_int32() {
+    return this->parse_raw<std::int32_t>();
+  }
+
+  std::uint32_t parse_uint32() {
+    return this->parse_raw<std::uint32_t>();
+  }
+
+  std::uint64_t parse_uint64() {
+    return this->parse_raw<std::uint64_t>();
+  }
+
+  double parse_double() {
+    return this->parse_raw<double>();
+  }
+
+  std::uint32_t parse_uint32_be() {
+    this->need(4);
+    std::uint32_t result = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+      result = (result << 8) | static_cast<std::uint8_t>(*this->pos++);
+    }
+    return result;
+  }
+
+  std::uint64_t parse_uint64_be() {
+    this->need(8);
+    std::uint64_t result = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+      result = (result << 8) | static_cast<std::uint8_t>(*this->pos++);
+    }
+    return result;
+  }
+
+private:
+  const char* pos;
+  const char* end;
+
+  void need(std::size_t count) const {
+    if (static_cast<std::size_t>(this->end - this->pos) < count) {
+      throw NeedMoreData{this->pos, count};
+    }
+  }
+
+  template <typename T>
+  T parse_raw() {
+    this->need(sizeof(T));
+    T result;
+    std::memcpy(&result, this->pos, sizeof(T));
+    this->pos += sizeof(T);
+    return result;
+  }
+};
+
 class RDBParser {
   enum OpCode : std::uint8_t {
-    OP_AUX,
-    OP_SELECTDB,
-    OP_EXPIRETIME,
-    OP_EXPIRETIMEMS,
-    OP_RESIZEDB,
-    OP_EOF
+    OP_AUX = 0xFA,
+    OP_RESIZEDB = 0xFB,
+    OP_EXPIRETIMEMS = 0xFC,
+    OP_EXPIRETIME = 0xFD,
+    OP_SELECTDB = 0xFE,
+    OP_EOF = 0xFF,
   };
 
   enum ValueType : std::uint8_t {
     VT_STRING_ENCODING = 0x00,
+    VT_LIST = 0x01,
+    VT_SET = 0x02,
+    VT_ZSET = 0x03,
+    VT_HASH = 0x04,
+    VT_ZSET_2 = 0x05,
+    VT_HASH_ZIPMAP = 0x09,
+    VT_LIST_ZIPLIST = 0x0A,
+    VT_SET_INTSET = 0x0B,
+    VT_ZSET_ZIPLIST = 0x0C,
+    VT_HASH_ZIPLIST = 0x0D,
+    VT_LIST_QUICKLIST = 0x0E,
+    VT_STREAM_LISTPACKS = 0x0F,
+    VT_HASH_LISTPACK = 0x10,
+    VT_ZSET_LISTPACK = 0x11,
+    VT_LIST_QUICKLIST_2 = 0x12,
+    VT_STREAM_LISTPACKS_2 = 0x13,
+    VT_SET_LISTPACK = 0x14,
+    VT_STREAM_LISTPACKS_3 = 0x15,
+  };
+
+  enum StringSpecial : std::uint8_t {
+    STRING_INT8 = 0,
+    STRING_INT16 = 1,
+    STRING_INT32 = 2,
+    STRING_LZF = 3,
+  };
+
+  enum QuicklistContainer : std::uint64_t {
+    QUICKLIST_NODE_CONTAINER_PLAIN = 1,
+    QUICKLIST_NODE_CONTAINER_PACKED = 2,
+  };
+
+  // one byte length prefixes of scores in the old sorted set encoding
+  enum ZSetScoreLength : std::uint8_t {
+    ZSET_SCORE_NAN = 253,
+    ZSET_SCORE_POS_INF = 254,
+    ZSET_SCORE_NEG_INF = 255,
+  };
+
+  enum StreamItemFlag : std::int64_t {
+    STREAM_ITEM_FLAG_DELETED = 1,
+    STREAM_ITEM_FLAG_SAMEFIELDS = 2,
+  };
+
+  enum class State {
+    HEADER,
+    BODY,
+    CHECKSUM,
+    DONE,
   };
 
   struct LengthEncoding {
@@ -34,178 +206,199 @@ class RDBParser {
       SPECIAL
     } type = LENGTH;
 
-    std::uint32_t length = 0;
+    std::uint64_t length = 0;
     std::uint8_t special = 0;
   };
 
-  struct Entry {
+  // An entry decoded up to the first piece the window did not hold. Values made of many
+  // pieces (elements, members, list or stream nodes) keep the pieces decoded so far, the
+  // next parse goes on from the first missing one instead of the entry start.
+  struct PendingEntry {
+    std::uint8_t type = 0;
     std::string key;
-    std::string value;
-
     std::optional<Timepoint> expire_time;
+
+    std::optional<std::uint64_t> pieces; // announced by the value
+    std::uint64_t parsed = 0;
+
+    ListpackWriter lp;
+    std::size_t length = 0;
+    std::vector<std::pair<double, std::string>> members;
+    RDBStream stream;
+    std::optional<RDBAggregate> aggregate; // a value kept as it came
   };
 
 public:
-  RDBParser(std::istream& from, IRDBParserListener& to)
-    : from(from), to(to)
+  RDBParser(IRDBParserListener& to, bool verify_checksum)
+    : to(to)
+    , verify_checksum(verify_checksum)
   {
   }
 
-  void parse() {
-    if (!this->from) throw RDBParseError("Invalid input stream");
+  bool done() const {
+    return this->state == State::DONE;
+  }
 
-    {
-      auto redis_magic = this->parse_string(5);
-      if (redis_magic != "REDIS") {
-        throw RDBParseError("Missing magic");
+  std::size_t keys_expired() const {
+    return this->expired;
+  }
+
+  // Parses as many items as the window holds, or stops once `limit` bytes were parsed.
+  // Returns where the next parse has to start: the end of the last parsed item, or of the
+  // last parsed piece of an entry which did not fit.
+  const char* parse(const char* begin, const char* end, std::size_t limit = std::numeric_limits<std::size_t>::max()) {
+    this->committed = begin;
+    this->wanted = 0;
+    // parsed items are checksummed in one go, only the checksum itself is left out
+    const char* unchecked = begin;
+
+    try {
+      while (this->state != State::DONE && static_cast<std::size_t>(this->committed - begin) < limit) {
+        if (this->state == State::CHECKSUM) {
+          this->update_checksum(unchecked, this->committed);
+          unchecked = this->committed;
+        }
+
+        RDBReader reader(this->committed, end);
+        this->parse_item(reader);
+        this->commit(reader);
       }
+    } catch (const NeedMoreData& need) {
+      this->wanted = need.at - this->committed + need.count;
     }
 
-    auto rdb_version = this->parse_string(4);
-    if (auto maybe_rdb_version = parseInt(rdb_version)) {
-      this->rdb_version = maybe_rdb_version.value();
-    } else {
-      throw RDBParseError("Missing rdb version");
+    if (this->state != State::DONE) {
+      this->update_checksum(unchecked, this->committed);
     }
 
-    if (DEBUG_LEVEL >= 1) std::cerr << "RDB verison: " << this->rdb_version << std::endl;
-
-    while (true) {
-      auto opcode = this->parse_op_code();
+    return this->committed;
+  }
 
-      if (opcode == OP_AUX) {
-        this->parse_aux_field();
-      } else if (opcode == OP_SELECTDB) {
-        this->parse_db();
-      } else if (opcode == OP_EOF) {
-        if (this->rdb_version >= 5) {
-          auto crc64_checksum = this->parse_string(8);
-        }
-        break;
-      } else {
-        throw RDBParseError(print_args("Unexpected section 0x", to_hex(static_cast<std::underlying_type_t<OpCode>>(opcode))));
-      }
-    }
+  // How many bytes from where the last parse stopped the next one needs to get any further.
+  std::size_t wanted_bytes() const {
+    return this->wanted;
   }
 
 private:
-  std::istream& from;
   IRDBParserListener& to;
 
+  State state = State::HEADER;
   int rdb_version = 0;
+  std::size_t expired = 0;
 
-  std::string parse_string(std::size_t count) {
-    std::string result;
-    result.resize(count);
-
-    this->from.read(result.data(), count);
+  bool verify_checksum;
+  std::uint64_t crc = 0;
 
-    if (!this->from) throw RDBParseError("Invalid input stream");
+  const char* committed = nullptr;
+  std::size_t wanted = 0;
+  std::optional<PendingEntry> pending;
 
-    return result;
+  void commit(const RDBReader& reader) {
+    this->committed = reader.position();
   }
 
-  OpCode parse_op_code() {
-    auto ch = this->parse_uint8();
-
-    if (ch == 0xFF) {
-      return OP_EOF;
-    }
-
-    if (ch == 0xFA) {
-      return OP_AUX;
-    }
-
-    if (ch == 0xFB) {
-      return OP_RESIZEDB;
+  // Parses the count a value starts with, then that many pieces times `per_count`, each
+  // committed once parsed. A piece has to be parsed completely before it changes the entry.
+  template <typename F>
+  void parse_pieces(RDBReader& reader, PendingEntry& entry, std::uint64_t per_count, F parse_piece) {
+    if (!entry.pieces) {
+      entry.pieces = this->parse_length_encoding(reader).length * per_count;
+      this->commit(reader);
     }
 
-    if (ch == 0xFC) {
-      return OP_EXPIRETIMEMS;
-    }
-
-    if (ch == 0xFE) {
-      return OP_SELECTDB;
+    for (; entry.parsed < entry.pieces.value(); ++entry.parsed) {
+      parse_piece();
+      this->commit(reader);
     }
+  }
 
-    if (ch == 0xFD) {
-      return OP_EXPIRETIME;
+  void update_checksum(const char* begin, const char* end) {
+    if (this->verify_checksum) {
+      this->crc = crc64(this->crc, std::string_view(begin, end - begin));
     }
-
-    throw RDBParseError(print_args("Unexpected opcode 0x", to_hex(ch)));
   }
 
-  std::uint8_t peek_uint8() {
-    std::uint8_t ch = this->from.peek();
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    return ch;
-  }
+  void parse_item(RDBReader& reader) {
+    if (this->state == State::HEADER) {
+      this->parse_header(reader);
+      this->state = State::BODY;
 
-  std::int8_t parse_int8() {
-    std::int8_t result;
-    this->from.read(reinterpret_cast<char*>(&result), sizeof(result));
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    return result;
-  }
+    } else if (this->state == State::CHECKSUM) {
+      auto expected = reader.parse_uint64();
+      // zero means the writer did not compute it
+      if (this->verify_checksum && expected != 0 && expected != this->crc) {
+        throw RDBParseError(print_args("Wrong RDB checksum expected: 0x", to_hex(expected), " got: 0x", to_hex(this->crc)));
+      }
+      this->state = State::DONE;
 
-  std::uint8_t parse_uint8() {
-    std::uint8_t result;
-    this->from.read(reinterpret_cast<char*>(&result), sizeof(result));
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    return result;
-  }
+    } else if (this->state == State::BODY) {
+      if (this->pending) {
+        this->parse_entry(reader);
+        return;
+      }
 
-  std::int16_t parse_int16() {
-    std::int16_t result;
-    this->from.read(reinterpret_cast<char*>(&result), sizeof(result));
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    // return byteswap(result);
-    return result;
-  }
+      auto opcode = reader.peek_uint8();
 
-  std::int32_t parse_int32() {
-    std::int32_t result;
-    this->from.read(reinterpret_cast<char*>(&result), sizeof(result));
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    // return byteswap(result);
-    return result;
+      if (opcode == OP_AUX) {
+        reader.parse_uint8();
+        this->parse_aux_field(reader);
+      } else if (opcode == OP_SELECTDB) {
+        reader.parse_uint8();
+        this->parse_select_db(reader);
+      } else if (opcode == OP_RESIZEDB) {
+        reader.parse_uint8();
+        this->parse_resize_db(reader);
+      } else if (opcode == OP_EOF) {
+        reader.parse_uint8();
+        this->state = this->rdb_version >= 5 ? State::CHECKSUM : State::DONE;
+      } else {
+        this->parse_entry(reader);
+      }
+    }
   }
 
-  std::uint32_t parse_uint32(){
-    std::uint32_t result;
-    this->from.read(reinterpret_cast<char*>(&result), sizeof(result));
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    // return byteswap(result);
-    return result;
-  }
+  void parse_header(RDBReader& reader) {
+    {
+      auto redis_magic = reader.parse_string(5);
+      if (redis_magic != "REDIS") {
+        throw RDBParseError("Missing magic");
+      }
+    }
 
-  std::uint64_t parse_uint64(){
-    std::uint64_t result;
-    this->from.read(reinterpret_cast<char*>(&result), sizeof(result));
-    if (!this->from) throw RDBParseError("Invalid input stream");
-    // return byteswap(result);
-    return result;
+    auto rdb_version = reader.parse_string(4);
+    if (auto maybe_rdb_version = parseInt(rdb_version)) {
+      this->rdb_version = maybe_rdb_version.value();
+    } else {
+      throw RDBParseError("Missing rdb version");
+    }
+
+    if (DEBUG_LEVEL >= 1) std::cerr << "RDB verison: " << this->rdb_version << std::endl;
   }
 
-  LengthEncoding parse_length_encoding() {
-    std::uint8_t ch = this->parse_uint8();
+  LengthEncoding parse_length_encoding(RDBReader& reader) {
+    std::uint8_t ch = reader.parse_uint8();
     LengthEncoding result;
 
     std::uint8_t type = (ch & 0xc0) >> 6;
     if (type == 0) {
       result = {
         .type = LengthEncoding::LENGTH,
-        .length = uint32_t(ch & 0x3f),
+        .length = std::uint64_t(ch & 0x3f),
       };
     } else if (type == 1) {
       result = {
         .type = LengthEncoding::LENGTH,
-        .length = uint32_t(ch & 0x3f) << 8 + this->parse_uint8(),
+        .length = (std::uint64_t(ch & 0x3f) << 8) | reader.parse_uint8(),
       };
-    } else if (type == 2) {
+    } else if (ch == 0x80) {
       result = {
         .type = LengthEncoding::LENGTH,
-        .length = this->parse_uint32(),
+        .length = reader.parse_uint32_be(),
+      };
+    } else if (ch == 0x81) {
+      result = {
+        .type = LengthEncoding::LENGTH,
+        .length = reader.parse_uint64_be(),
       };
     } else if (type == 3) {
       result = {
@@ -213,7 +406,7 @@ private:
         .special = uint8_t(ch & 0x3f),
       };
     } else {
-      throw RDBParseError("Broken parser");
+      throw RDBParseError(print_args("Unknown length encoding 0x", to_hex(ch)));
     }
 
     if (DEBUG_LEVEL >= 2) {
@@ -226,19 +419,29 @@ private:
     return result;
   }
 
-  std::string parse_string_encoded() {
+  std::string parse_string_encoded(RDBReader& reader) {
     if (DEBUG_LEVEL >= 2) std::cerr << "Parsing string encoded" << std::endl;
-    auto encoding = this->parse_length_encoding();
+    return this->parse_string_body(reader, this->parse_length_encoding(reader));
+  }
 
+  std::string parse_string_body(RDBReader& reader, const LengthEncoding& encoding) {
     if (encoding.type == LengthEncoding::LENGTH) {
-      return this->parse_string(encoding.length);
+      return reader.parse_string(encoding.length);
     } else if (encoding.type == LengthEncoding::SPECIAL) {
-      if (encoding.special == 0) {
-        return std::to_string(this->parse_int8());
-      } else if (encoding.special == 1) {
-        return std::to_string(this->parse_int16());
-      } else if (encoding.special == 2) {
-        return std::to_string(this->parse_int32());
+      if (encoding.special == STRING_INT8) {
+        return std::to_string(reader.parse_int8());
+      } else if (encoding.special == STRING_INT16) {
+        return std::to_string(reader.parse_int16());
+      } else if (encoding.special == STRING_INT32) {
+        return std::to_string(reader.parse_int32());
+      } else if (encoding.special == STRING_LZF) {
+        auto compressed_length = this->parse_length_encoding(reader).length;
+        auto length = this->parse_length_encoding(reader).length;
+        auto result = lzf_decompress(reader.parse_view(compressed_length), length);
+        if (!result) {
+          throw RDBParseError("Malformed LZF compressed string");
+        }
+        return std::move(result.value());
       } else {
         throw RDBParseError("Unknown string encoding special type");
       }
@@ -247,103 +450,816 @@ private:
     }
   }
 
-  void parse_aux_field() {
+  // Same as parse_string_encoded, but integer encoded strings stay integers and plain
+  // ones are copied straight from the file into the listpack.
+  void parse_element(RDBReader& reader, ListpackWriter& to) {
+    auto encoding = this->parse_length_encoding(reader);
+
+    if (encoding.type == LengthEncoding::LENGTH) {
+      to.string(reader.parse_view(encoding.length));
+    } else if (encoding.special == STRING_INT8) {
+      to.integer(reader.parse_int8());
+    } else if (encoding.special == STRING_INT16) {
+      to.integer(reader.parse_int16());
+    } else if (encoding.special == STRING_INT32) {
+      to.integer(reader.parse_int32());
+    } else {
+      to.string(this->parse_string_body(reader, encoding));
+    }
+  }
+
+  void parse_aux_field(RDBReader& reader) {
     if (DEBUG_LEVEL >= 2) std::cerr << "Parsing aux field" << std::endl;
-    auto key = this->parse_string_encoded();
-    auto value = this->parse_string_encoded();
+    auto key = this->parse_string_encoded(reader);
+    auto value = this->parse_string_encoded(reader);
 
     if (DEBUG_LEVEL >= 1) std::cerr << "Met aux field, key = " << key << ", value = " << value << std::endl;
   }
 
-  std::optional<Entry> parse_entry(std::uint8_t type) {
-    if (type != VT_STRING_ENCODING) {
-      return {};
+  void parse_select_db(RDBReader& reader) {
+    auto db_number = this->parse_length_encoding(reader).length;
+    if (DEBUG_LEVEL >= 1) std::cerr << "Parsing db #" << db_number << std::endl;
+  }
+
+  void parse_resize_db(RDBReader& reader) {
+    auto hash_table_size = this->parse_length_encoding(reader).length;
+    auto expire_hash_table_size = this->parse_length_encoding(reader).length;
+    if (DEBUG_LEVEL >= 1) {
+      std::cerr << "Resizedb info: HT size = " << hash_table_size << ", expire HT size = " << expire_hash_table_size << std::endl;
     }
 
-    this->parse_uint8();
-    auto key = this->parse_string_encoded();
-    auto value = this->parse_string_encoded();
+    this->to.resize_db(hash_table_size, expire_hash_table_size);
+  }
+
+  RDBStreamId parse_stream_id(RDBReader& reader) {
+    RDBStreamId id;
+    id.ms = this->parse_length_encoding(reader).length;
+    id.seq = this->parse_length_encoding(reader).length;
+    return id;
+  }
+
+  // node keys and PEL ids are 128 bit big endian
+  RDBStreamId parse_raw_stream_id(std::string_view raw) {
+    if (raw.size() != 16) {
+      throw RDBParseError("Malformed stream id");
+    }
+
+    RDBReader reader(raw.data(), raw.data() + raw.size());
+    RDBStreamId id;
+    id.ms = reader.parse_uint64_be();
+    id.seq = reader.parse_uint64_be();
+    return id;
+  }
+
+  RDBStream parse_stream(RDBReader& reader, PendingEntry& entry) {
+    const auto type = entry.type;
+    auto& stream = entry.stream;
+
+    this->parse_pieces(reader, entry, 1, [this, &reader, &stream]() {
+      auto node_key = this->parse_string_encoded(reader);
+      auto node = this->parse_string_encoded(reader);
+
+      try {
+        this->parse_stream_node(this->parse_raw_stream_id(node_key), node, stream);
+      } catch (const RDBParseError&) {
+        throw;
+      } catch (const std::runtime_error& err) {
+        throw RDBParseError(print_args("Malformed stream node: ", err.what()));
+      }
+    });
+
+    auto length = this->parse_length_encoding(reader).length;
+    stream.last_id = this->parse_stream_id(reader);
+
+    if (type >= VT_STREAM_LISTPACKS_2) {
+      stream.first_id = this->parse_stream_id(reader);
+      stream.max_deleted_id = this->parse_stream_id(reader);
+      stream.entries_added = this->parse_length_encoding(reader).length;
+    } else {
+      if (!stream.entries.empty()) {
+        stream.first_id = stream.entries.front().first;
+      }
+      stream.entries_added = length;
+    }
+
+    // consumer groups are not kept, they are read only to get past them
+    auto groups = this->parse_length_encoding(reader).length;
+    for (std::uint64_t i = 0; i < groups; ++i) {
+      this->skip_stream_group(reader, type);
+    }
+
+    if (groups > 0 && DEBUG_LEVEL >= 1) std::cerr << "DEBUG Dropped " << groups << " stream consumer groups" << std::endl;
+
+    return std::move(stream);
+  }
+
+  void parse_stream_node(RDBStreamId master_id, std::string_view node, RDBStream& stream) {
+    ListpackReader lp(node);
+
+    auto integer = [&lp]() {
+      auto value = lp.next_integer();
+      if (!value) {
+        throw RDBParseError("Stream node ended unexpectedly");
+      }
+      return value.value();
+    };
 
-    return Entry{
-      .key = std::move(key),
-      .value = std::move(value)
+    auto string = [&lp]() {
+      auto value = lp.next_string();
+      if (!value) {
+        throw RDBParseError("Stream node ended unexpectedly");
+      }
+      return std::move(value.value());
     };
+
+    // master entry: count, deleted, fields shared by entries flagged SAMEFIELDS, terminator
+    integer();
+    integer();
+    std::vector<std::string> master_fields(integer());
+    for (auto& field : master_fields) {
+      field = string();
+    }
+    integer();
+
+    while (auto flags = lp.next_integer()) {
+      RDBStreamId id;
+      id.ms = master_id.ms + integer();
+      id.seq = master_id.seq + integer();
+
+      RDBStream::Values values;
+      if (flags.value() & STREAM_ITEM_FLAG_SAMEFIELDS) {
+        values.reserve(master_fields.size());
+        for (const auto& field : master_fields) {
+          values.emplace_back(field, string());
+        }
+      } else {
+        auto count = integer();
+        values.reserve(count);
+        for (std::int64_t i = 0; i < count; ++i) {
+          auto field = string();
+          values.emplace_back(std::move(field), string());
+        }
+      }
+
+      integer(); // lp-count, only needed to walk the node backwards
+
+      if (!(flags.value() & STREAM_ITEM_FLAG_DELETED)) {
+        stream.entries.emplace_back(id, std::move(values));
+      }
+    }
   }
 
-  void parse_db() {
-    if (DEBUG_LEVEL >= 2) std::cerr << "Parsing db" << std::endl;
+  void skip_stream_group(RDBReader& reader, std::uint8_t type) {
+    this->parse_string_encoded(reader);
+    this->parse_stream_id(reader);
+    if (type >= VT_STREAM_LISTPACKS_2) {
+      this->parse_length_encoding(reader); // entries read
+    }
 
-    int db_number = this->parse_uint8();
-    if (DEBUG_LEVEL >= 1) std::cerr << "Parsing db #" << db_number << std::endl;
+    auto pending = this->parse_length_encoding(reader).length;
+    for (std::uint64_t i = 0; i < pending; ++i) {
+      reader.parse_string(16); // id
+      reader.parse_uint64(); // delivery time
+      this->parse_length_encoding(reader); // delivery count
+    }
 
-    if (this->parse_op_code() == OP_RESIZEDB) {
-      auto hash_table_size = this->parse_length_encoding().length;
-      auto expire_hash_table_size = this->parse_length_encoding().length;
-      if (DEBUG_LEVEL >= 1) {
-        std::cerr << "Resizedb info: HT size = " << hash_table_size << ", expire HT size = " << expire_hash_table_size << std::endl;
+    auto consumers = this->parse_length_encoding(reader).length;
+    for (std::uint64_t i = 0; i < consumers; ++i) {
+      this->parse_string_encoded(reader);
+      reader.parse_uint64(); // seen time
+      if (type >= VT_STREAM_LISTPACKS_3) {
+        reader.parse_uint64(); // active time
+      }
+
+      auto consumer_pending = this->parse_length_encoding(reader).length;
+      for (std::uint64_t j = 0; j < consumer_pending; ++j) {
+        reader.parse_string(16);
       }
     }
+  }
 
-    while (true) {
-      auto next = this->peek_uint8();
+  RDBAggregate parse_aggregate(RDBReader& reader, PendingEntry& entry) {
+    using Type = RDBAggregate::Type;
+    const auto type = entry.type;
 
-      Entry entry;
-      if (next == 0xFD) {
-        this->parse_uint8();
-        auto expire_time_s = this->parse_uint32();
-        auto maybe_entry = this->parse_entry(this->peek_uint8());
-        if (!maybe_entry) {
-          throw RDBParseError("Expected entry");
+    try {
+      switch (type) {
+        case VT_LIST:
+          return this->parse_elements(reader, entry, Type::List, 1);
+        case VT_SET:
+          return this->parse_elements(reader, entry, Type::Set, 1);
+        case VT_HASH:
+          return this->parse_elements(reader, entry, Type::Hash, 2);
+        case VT_ZSET:
+        case VT_ZSET_2:
+          return this->parse_zset(reader, entry);
+        case VT_LIST_QUICKLIST:
+        case VT_LIST_QUICKLIST_2:
+          return this->parse_quicklist(reader, entry);
+        case VT_HASH_ZIPMAP:
+          return convert_zipmap(this->parse_string_encoded(reader));
+        case VT_LIST_ZIPLIST:
+          return convert_ziplist(Type::List, 1, this->parse_string_encoded(reader));
+        case VT_ZSET_ZIPLIST:
+          return convert_ziplist(Type::ZSet, 2, this->parse_string_encoded(reader));
+        case VT_HASH_ZIPLIST:
+          return convert_ziplist(Type::Hash, 2, this->parse_string_encoded(reader));
+        case VT_SET_INTSET: {
+          auto data = this->parse_string_encoded(reader);
+          auto length = IntsetReader(data).size();
+          return {Type::Set, RDBAggregate::Encoding::Intset, std::move(data), length};
         }
-        entry = std::move(maybe_entry.value());
-        entry.expire_time = Timepoint(std::chrono::seconds(expire_time_s));
-
-      } else if (next == 0xFC) {
-        this->parse_uint8();
-        auto expire_time_ms = this->parse_uint64();
-        auto maybe_entry = this->parse_entry(this->peek_uint8());
-        if (!maybe_entry) {
-          throw RDBParseError("Expected entry");
+        case VT_SET_LISTPACK:
+          return keep_listpack(Type::Set, 1, this->parse_string_encoded(reader));
+        case VT_ZSET_LISTPACK:
+          return keep_listpack(Type::ZSet, 2, this->parse_string_encoded(reader));
+        case VT_HASH_LISTPACK:
+          return keep_listpack(Type::Hash, 2, this->parse_string_encoded(reader));
+      }
+    } catch (const RDBParseError&) {
+      throw;
+    } catch (const std::runtime_error& err) {
+      throw RDBParseError(print_args("Malformed value of type 0x", to_hex(type), ": ", err.what()));
+    }
+
+    throw RDBParseError(print_args("Unsupported value type 0x", to_hex(type)));
+  }
+
+  // plain lists, sets and hashes: every element is a string of its own
+  RDBAggregate parse_elements(RDBReader& reader, PendingEntry& entry, RDBAggregate::Type type, std::size_t per_entry) {
+    this->parse_pieces(reader, entry, per_entry, [this, &reader, &entry]() {
+      this->parse_element(reader, entry.lp);
+    });
+
+    return {type, RDBAggregate::Encoding::Listpack, entry.lp.finish(), entry.pieces.value() / per_entry};
+  }
+
+  // Skiplist encoded sorted sets are saved from the highest score down, the listpack
+  // wants them ascending.
+  RDBAggregate parse_zset(RDBReader& reader, PendingEntry& entry) {
+    auto& members = entry.members;
+
+    this->parse_pieces(reader, entry, 1, [this, &reader, &entry, &members]() {
+      auto member = this->parse_string_encoded(reader);
+      auto score = entry.type == VT_ZSET_2 ? reader.parse_double() : this->parse_zset_score(reader);
+      if (std::isnan(score)) {
+        throw RDBParseError("Sorted set with a NaN score");
+      }
+      members.emplace_back(score, std::move(member));
+    });
+
+    std::sort(members.begin(), members.end());
+
+    ListpackWriter lp;
+    for (const auto& [score, member] : members) {
+      lp.string(member);
+      append_score(lp, score);
+    }
+
+    return {RDBAggregate::Type::ZSet, RDBAggregate::Encoding::Listpack, lp.finish(), members.size()};
+  }
+
+  double parse_zset_score(RDBReader& reader) {
+    auto length = reader.parse_uint8();
+    if (length == ZSET_SCORE_NAN) {
+      return std::numeric_limits<double>::quiet_NaN();
+    } else if (length == ZSET_SCORE_POS_INF) {
+      return std::numeric_limits<double>::infinity();
+    } else if (length == ZSET_SCORE_NEG_INF) {
+      return -std::numeric_limits<double>::infinity();
+    }
+
+    auto text = reader.parse_view(length);
+    double score;
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), score);
+    if (ec != std::errc() || ptr != text.data() + text.size()) {
+      throw RDBParseError("Malformed sorted set score");
+    }
+    return score;
+  }
+
+  // The nodes are merged into one listpack; a single packed node is kept as it is.
+  RDBAggregate parse_quicklist(RDBReader& reader, PendingEntry& entry) {
+    const auto type = entry.type;
+    auto& lp = entry.lp;
+    auto& length = entry.length;
+
+    this->parse_pieces(reader, entry, 1, [this, &reader, &entry, type, &lp, &length]() {
+      auto container = type == VT_LIST_QUICKLIST_2 ? this->parse_length_encoding(reader).length : QUICKLIST_NODE_CONTAINER_PACKED;
+      auto node = this->parse_string_encoded(reader);
+
+      if (type == VT_LIST_QUICKLIST) {
+        ZiplistReader zl(node);
+        while (auto element = zl.next()) {
+          append_element(lp, element.value());
+          ++length;
+        }
+      } else if (container == QUICKLIST_NODE_CONTAINER_PLAIN) {
+        lp.string(node);
+        ++length;
+      } else if (container == QUICKLIST_NODE_CONTAINER_PACKED) {
+        if (entry.pieces.value() == 1) {
+          entry.aggregate = keep_listpack(RDBAggregate::Type::List, 1, std::move(node));
+          return;
         }
-        entry = std::move(maybe_entry.value());
-        entry.expire_time = Timepoint(std::chrono::milliseconds(expire_time_ms));
 
-      } else {
-        auto maybe_entry = this->parse_entry(next);
-        if (!maybe_entry) {
-          break;
+        ListpackReader packed(node);
+        while (auto element = packed.next()) {
+          append_element(lp, element.value());
+          ++length;
         }
-        entry = std::move(maybe_entry.value());
+      } else {
+        throw RDBParseError(print_args("Unknown quicklist container ", container));
       }
+    });
 
-      if (DEBUG_LEVEL >= 1) {
+    if (entry.aggregate) {
+      return std::move(entry.aggregate.value());
+    }
+    return {RDBAggregate::Type::List, RDBAggregate::Encoding::Listpack, lp.finish(), length};
+  }
+
+  static void append_element(ListpackWriter& to, const ListpackReader::Element& element) {
+    if (auto str = std::get_if<std::string_view>(&element)) {
+      to.string(*str);
+    } else {
+      to.integer(std::get<std::int64_t>(element));
+    }
+  }
+
+  // integral scores are kept as integers, the way Redis stores them in listpacks
+  static void append_score(ListpackWriter& to, double score) {
+    constexpr double MAX_EXACT = 9007199254740992.0; // 2^53
+
+    if (std::isfinite(score) && std::trunc(score) == score && std::abs(score) <= MAX_EXACT) {
+      to.integer(static_cast<std::int64_t>(score));
+      return;
+    }
+
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), score);
+    to.string(std::string_view(buffer, end));
+  }
+
+  // the blob is walked once anyway to validate it, which also gives the element count
+  static RDBAggregate keep_listpack(RDBAggregate::Type type, std::size_t per_entry, std::string data) {
+    ListpackReader lp(data);
+    std::size_t elements = 0;
+    while (lp.next()) {
+      ++elements;
+    }
+
+    return {type, RDBAggregate::Encoding::Listpack, std::move(data), elements / per_entry};
+  }
+
+  static RDBAggregate convert_ziplist(RDBAggregate::Type type, std::size_t per_entry, std::string_view data) {
+    ZiplistReader zl(data);
+    ListpackWriter lp;
+    std::size_t elements = 0;
+    while (auto element = zl.next()) {
+      append_element(lp, element.value());
+      ++elements;
+    }
+
+    return {type, RDBAggregate::Encoding::Listpack, lp.finish(), elements / per_entry};
+  }
+
+  // Zipmap, the hash encoding of RDB versions before 4: a count byte, then field and
+  // value strings with one byte lengths (254 announces a 4 byte one), values followed
+  // by unused padding. 255 ends it.
+  static RDBAggregate convert_zipmap(std::string_view data) {
+    constexpr std::uint8_t ZIPMAP_BIG_LENGTH = 254;
+    constexpr std::uint8_t ZIPMAP_END = 255;
+
+    std::size_t pos = 1;
+    auto need = [&](std::size_t count) {
+      if (pos + count > data.size()) {
+        throw std::runtime_error("Zipmap element out of bounds");
+      }
+    };
+
+    auto length = [&]() -> std::optional<std::size_t> {
+      need(1);
+      auto first = static_cast<std::uint8_t>(data[pos++]);
+      if (first == ZIPMAP_END) {
+        return {};
+      } else if (first < ZIPMAP_BIG_LENGTH) {
+        return first;
+      }
+
+      need(4);
+      std::uint32_t value;
+      std::memcpy(&value, data.data() + pos, 4);
+      pos += 4;
+      return value;
+    };
+
+    ListpackWriter lp;
+    std::size_t fields = 0;
+
+    while (auto field_length = length()) {
+      need(field_length.value());
+      lp.string(data.substr(pos, field_length.value()));
+      pos += field_length.value();
+
+      auto value_length = length();
+      if (!value_length) {
+        throw std::runtime_error("Zipmap field without value");
+      }
+
+      need(1 + value_length.value());
+      auto padding = static_cast<std::uint8_t>(data[pos++]);
+      lp.string(data.substr(pos, value_length.value()));
+      pos += value_length.value() + padding;
+
+      ++fields;
+    }
+
+    return {RDBAggregate::Type::Hash, RDBAggregate::Encoding::Listpack, lp.finish(), fields};
+  }
+
+  void parse_entry(RDBReader& reader) {
+    if (!this->pending) {
+      PendingEntry entry;
+
+      entry.type = reader.parse_uint8();
+      if (entry.type == OP_EXPIRETIME) {
+        entry.expire_time = Timepoint(std::chrono::seconds(reader.parse_uint32()));
+        entry.type = reader.parse_uint8();
+      } else if (entry.type == OP_EXPIRETIMEMS) {
+        entry.expire_time = Timepoint(std::chrono::milliseconds(reader.parse_uint64()));
+        entry.type = reader.parse_uint8();
+      }
+
+      entry.key = this->parse_string_encoded(reader);
+
+      this->pending.emplace(std::move(entry));
+      this->commit(reader);
+    }
+
+    auto& entry = this->pending.value();
+    const auto type = entry.type;
+
+    if (type == VT_STREAM_LISTPACKS || type == VT_STREAM_LISTPACKS_2 || type == VT_STREAM_LISTPACKS_3) {
+      auto stream = this->parse_stream(reader, entry);
+      auto key = std::move(entry.key);
+      this->pending.reset();
+
+      if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Met stream entry: key = " << key << ", length = " << stream.entries.size() << std::endl;
+
+      this->to.restore_stream(std::move(key), std::move(stream));
+      return;
+    }
+
+    std::string value;
+    std::optional<RDBAggregate> aggregate;
+    if (type == VT_STRING_ENCODING) {
+      value = this->parse_string_encoded(reader);
+    } else {
+      aggregate = this->parse_aggregate(reader, entry);
+    }
+
+    auto key = std::move(entry.key);
+    const auto expire_time = entry.expire_time;
+    this->pending.reset();
+
+    if (DEBUG_LEVEL >= 1) {
+      if (aggregate) {
+        std::cerr << "DEBUG Met aggregate entry: key = " << key << ", type 0x" << to_hex(type)
+          << ", length = " << aggregate->length << std::endl;
+      } else {
         std::cerr << "DEBUG Met kv entry:" << std::endl
-          << "  key = " << entry.key << std::endl
-          << "  value = " << entry.value << std::endl;
+          << "  key = " << key << std::endl
+          << "  value = " << value << std::endl;
       }
+    }
 
-      auto now = Clock::now();
-      if (entry.expire_time) {
-        if (DEBUG_LEVEL >= 1) {
-          std::cerr << "  now         = " << now.time_since_epoch() << std::endl;
-          std::cerr << "  expire time = " << entry.expire_time.value().time_since_epoch() << std::endl;
-        }
+    auto now = Clock::now();
+    if (expire_time) {
+      if (DEBUG_LEVEL >= 1) {
+        std::cerr << "  now         = " << now.time_since_epoch() << std::endl;
+        std::cerr << "  expire time = " << expire_time.value().time_since_epoch() << std::endl;
+      }
+    }
+
+    if (expire_time && expire_time <= now) {
+      ++this->expired;
+      if (DEBUG_LEVEL >= 1) std::cerr << "  SKIP" << std::endl;
+    } else if (!aggregate) {
+      this->to.restore(std::move(key), std::move(value), expire_time);
+    } else if (aggregate->length > 0) {
+      this->to.restore_aggregate(std::move(key), std::move(aggregate.value()), expire_time);
+    } else {
+      // Redis never keeps empty aggregates, older versions could still save them
+      if (DEBUG_LEVEL >= 1) std::cerr << "  SKIP empty" << std::endl;
+    }
+  }
+};
+
+// Entries decoded by the load worker, kept until the loading thread passes them on.
+class RDBBatch : public IRDBParserListener {
+  struct StringItem {
+    std::string key;
+    std::string value;
+    std::optional<Timepoint> expire_time;
+  };
+
+  struct StreamItem {
+    std::string key;
+    RDBStream stream;
+  };
+
+  struct AggregateItem {
+    std::string key;
+    RDBAggregate value;
+    std::optional<Timepoint> expire_time;
+  };
+
+  struct ResizeItem {
+    std::size_t keys;
+    std::size_t expires;
+  };
+
+public:
+  std::size_t bytes = 0;
+  std::size_t keys_expired = 0;
+
+  void restore(std::string key, std::string value, std::optional<Timepoint> expire_time) override {
+    this->items.emplace_back(StringItem{std::move(key), std::move(value), expire_time});
+  }
+
+  void restore_stream(std::string key, RDBStream stream) override {
+    this->items.emplace_back(StreamItem{std::move(key), std::move(stream)});
+  }
+
+  void restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) override {
+    this->items.emplace_back(AggregateItem{std::move(key), std::move(value), expire_time});
+  }
+
+  void resize_db(std::size_t keys, std::size_t expires) override {
+    this->items.emplace_back(ResizeItem{keys, expires});
+  }
+
+  // Passes items on until the deadline, a later call continues where this one stopped.
+  // Returns how many keys were passed.
+  std::size_t apply(IRDBParserListener& to, std::chrono::steady_clock::time_point deadline) {
+    std::size_t keys = 0;
+
+    for (; this->next < this->items.size(); ++this->next) {
+      if (this->next % APPLY_CLOCK_CHECK_ITEMS == 0 && this->next > 0 && std::chrono::steady_clock::now() >= deadline) {
+        break;
       }
 
-      if (!entry.expire_time || entry.expire_time > now) {
-        this->to.restore(entry.key, entry.value, entry.expire_time);
+      auto& item = this->items[this->next];
+      if (auto str = std::get_if<StringItem>(&item)) {
+        to.restore(std::move(str->key), std::move(str->value), str->expire_time);
+        ++keys;
+      } else if (auto stream = std::get_if<StreamItem>(&item)) {
+        to.restore_stream(std::move(stream->key), std::move(stream->stream));
+        ++keys;
+      } else if (auto aggregate = std::get_if<AggregateItem>(&item)) {
+        to.restore_aggregate(std::move(aggregate->key), std::move(aggregate->value), aggregate->expire_time);
+        ++keys;
       } else {
-        std::cerr << "  SKIP" << std::endl;
+        const auto& resize = std::get<ResizeItem>(item);
+        to.resize_db(resize.keys, resize.expires);
       }
     }
+
+    return keys;
+  }
+
+  bool applied() const {
+    return this->next == this->items.size();
   }
+
+  void clear() {
+    this->items.clear();
+    this->next = 0;
+    this->bytes = 0;
+    this->keys_expired = 0;
+  }
+
+private:
+  std::vector<std::variant<StringItem, StreamItem, AggregateItem, ResizeItem>> items;
+  std::size_t next = 0;
 };
 
 } // namespace
 
-void RDBParse(std::istream& from, IRDBParserListener& to) {
-  RDBParser parser(from, to);
+class RDBStreamParser::Impl {
+public:
+  Impl(IRDBParserListener& to, bool verify_checksum)
+    : parser(to, verify_checksum)
+  {
+  }
+
+  std::size_t feed(std::string_view data) {
+    if (this->parser.done()) {
+      return 0;
+    }
+
+    if (this->buffer.empty() && data.size() >= this->parser.wanted_bytes()) {
+      // fast path: parse straight from the caller's memory, keep only the incomplete tail
+      auto parsed_end = this->parser.parse(data.data(), data.data() + data.size());
+      std::size_t consumed = parsed_end - data.data();
+      this->bytes_parsed += consumed;
 
-  parser.parse();
+      if (this->parser.done()) {
+        return consumed;
+      }
+
+      this->buffer.assign(parsed_end, data.data() + data.size());
+      return data.size();
+    }
+
+    const auto buffered = this->buffer.size();
+    this->buffer.append(data);
+
+    // a big piece, a string or a stream node, is parsed once it is all there
+    if (this->buffer.size() < this->parser.wanted_bytes()) {
+      return data.size();
+    }
+
+    auto parsed_end = this->parser.parse(this->buffer.data(), this->buffer.data() + this->buffer.size());
+    std::size_t consumed = parsed_end - this->buffer.data();
+    this->bytes_parsed += consumed;
+
+    if (this->parser.done()) {
+      this->buffer.clear();
+      return consumed - buffered;
+    }
+
+    this->buffer.erase(0, consumed);
+    return data.size();
+  }
+
+  RDBParser parser;
+  std::string buffer;
+  std::size_t bytes_parsed = 0;
+};
+
+RDBStreamParser::RDBStreamParser(IRDBParserListener& to, bool verify_checksum)
+  : _impl(std::make_unique<Impl>(to, verify_checksum))
+{
+}
+
+RDBStreamParser::~RDBStreamParser() = default;
+
+std::size_t RDBStreamParser::feed(std::string_view data) {
+  return this->_impl->feed(data);
+}
+
+bool RDBStreamParser::done() const {
+  return this->_impl->parser.done();
+}
+
+std::size_t RDBStreamParser::bytes_parsed() const {
+  return this->_impl->bytes_parsed;
 }
 
+// Inserting into the keyspace can not be shared between threads, so a single worker
+// decodes: it takes the allocations and listpack walking off the loading thread, and
+// more decoders would just wait on the one inserting.
+class RDBLoader::Impl {
+public:
+  Impl(std::string_view data, bool verify_checksum)
+    : data(data)
+  {
+    this->stats.total_bytes = data.size();
+
+    this->worker = std::thread([this, verify_checksum]() {
+      this->decode(verify_checksum);
+    });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard lock(this->mutex);
+      this->cancelled = true;
+    }
+    this->cv.notify_all();
+    this->worker.join();
+  }
+
+  bool step(IRDBParserListener& to, std::chrono::steady_clock::duration budget) {
+    const auto deadline = std::chrono::steady_clock::now() + budget;
+
+    while (!this->done) {
+      if (!this->current) {
+        std::unique_lock lock(this->mutex);
+        if (this->ready.empty()) {
+          if (!this->finished) {
+            return false;
+          }
+
+          if (this->error) {
+            std::rethrow_exception(this->error);
+          }
+          this->done = true;
+          break;
+        }
+
+        this->current = std::move(this->ready.front());
+        this->ready.pop_front();
+        lock.unlock();
+        this->cv.notify_all();
+      }
+
+      this->stats.keys_loaded += this->current->apply(to, deadline);
+      if (!this->current->applied()) {
+        return false;
+      }
+
+      this->stats.loaded_bytes += this->current->bytes;
+      this->stats.keys_expired += this->current->keys_expired;
+      this->current.reset();
+
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  std::string_view data;
+  RDBLoadProgress stats;
+  std::size_t rdb_size = 0;
+  bool done = false;
+
+private:
+  std::thread worker;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<RDBBatch> ready;
+  bool finished = false;
+  bool cancelled = false;
+  std::exception_ptr error;
+
+  // owned by the loading thread
+  std::optional<RDBBatch> current;
+
+  void decode(bool verify_checksum) {
+    try {
+      RDBBatch batch;
+      RDBParser parser(batch, verify_checksum);
+
+      const char* pos = this->data.data();
+      const char* end = this->data.data() + this->data.size();
+      std::size_t expired = 0;
+
+      while (!parser.done()) {
+        auto next = parser.parse(pos, end, LOAD_BATCH_SIZE);
+        if (next == pos && !parser.done()) {
+          throw RDBParseError("Unexpected end of RDB file");
+        }
+
+        batch.bytes = next - pos;
+        batch.keys_expired = parser.keys_expired() - expired;
+        expired = parser.keys_expired();
+        pos = next;
+
+        std::unique_lock lock(this->mutex);
+        this->cv.wait(lock, [this]() {
+          return this->ready.size() < LOAD_QUEUE_DEPTH || this->cancelled;
+        });
+        if (this->cancelled) {
+          break;
+        }
+
+        this->ready.push_back(std::move(batch));
+        batch.clear();
+      }
+
+      // read by the loading thread only after it saw `finished` under the lock
+      this->rdb_size = pos - this->data.data();
+    } catch (...) {
+      std::lock_guard lock(this->mutex);
+      this->error = std::current_exception();
+    }
+
+    std::lock_guard lock(this->mutex);
+    this->finished = true;
+  }
+};
+
+RDBLoader::RDBLoader(std::string_view data, bool verify_checksum)
+  : _impl(std::make_unique<Impl>(data, verify_checksum))
+{
+}
+
+RDBLoader::~RDBLoader() = default;
+
+bool RDBLoader::step(IRDBParserListener& to, std::chrono::steady_clock::duration budget) {
+  return this->_impl->step(to, budget);
+}
+
+const RDBLoadProgress& RDBLoader::progress() const {
+  return this->_impl->stats;
+}
+
+std::size_t RDBLoader::rdb_size() const {
+  return this->_impl->rdb_size;
+}
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <exception>
-#include <istream>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 using Clock = std::chrono::system_clock;
 using Timepoint = Clock::time_point;
@@ -14,11 +18,101 @@ public:
   RDBParseError(std::string);
 };
 
+struct RDBStreamId {
+  std::uint64_t ms = 0;
+  std::uint64_t seq = 0;
+};
+
+// Stream as it is stored in RDB, entries come in id order.
+struct RDBStream {
+  using Values = std::vector<std::pair<std::string, std::string>>;
+
+  std::vector<std::pair<RDBStreamId, Values>> entries;
+
+  RDBStreamId last_id;
+  RDBStreamId first_id;
+  RDBStreamId max_deleted_id;
+  std::uint64_t entries_added = 0;
+};
+
+// List, set, sorted set or hash in a compact encoding, kept as a single blob instead of
+// an allocation per element. Older encodings are converted to listpacks while loading.
+struct RDBAggregate {
+  enum class Type {
+    List,
+    Set,
+    ZSet,
+    Hash,
+  };
+
+  enum class Encoding {
+    Listpack, // elements in order; sorted sets as member, score pairs by score; hashes as field, value pairs
+    Intset,   // sets of integers only
+  };
+
+  Type type;
+  Encoding encoding;
+  std::string data;
+  std::size_t length = 0; // elements, members or fields
+};
+
 class IRDBParserListener {
 public:
   virtual ~IRDBParserListener() = default;
 
   virtual void restore(std::string key, std::string value, std::optional<Timepoint> expire_time) = 0;
+  virtual void restore_stream(std::string key, RDBStream stream) = 0;
+  virtual void restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) = 0;
+
+  // RESIZEDB: how many keys the following database has, comes before them
+  virtual void resize_db(std::size_t /* keys */, std::size_t /* expires */) {}
 };
 
-void RDBParse(std::istream& from, IRDBParserListener& to);
\ No newline at end of file
+// Incremental RDB parser: bytes may be fed in arbitrary chunks, every complete
+// entry is passed to the listener right away. An entry split over chunks is decoded
+// piece by piece as they come, only its incomplete piece is buffered.
+class RDBStreamParser {
+public:
+  RDBStreamParser(IRDBParserListener& to, bool verify_checksum);
+  ~RDBStreamParser();
+
+  // Returns how many bytes of data were consumed, less than data.size() only once done.
+  std::size_t feed(std::string_view data);
+  bool done() const;
+
+  std::size_t bytes_parsed() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> _impl;
+};
+
+struct RDBLoadProgress {
+  std::size_t loaded_bytes = 0;
+  std::size_t total_bytes = 0;
+  std::size_t keys_loaded = 0;
+  std::size_t keys_expired = 0;
+};
+
+// Loads a complete RDB image from memory. Entries are decoded on a worker thread and
+// passed to the listener by the owner in slices of its own time, so the listener is
+// never called concurrently and the owner's loop keeps running in between.
+class RDBLoader {
+public:
+  RDBLoader(std::string_view data, bool verify_checksum);
+  ~RDBLoader();
+
+  // Passes decoded entries on until `budget` is used up or nothing is decoded yet.
+  // Returns true once the whole image was passed, rethrows what decoding threw (after
+  // the entries before it were passed), a checksum mismatch included.
+  bool step(IRDBParserListener& to, std::chrono::steady_clock::duration budget);
+
+  const RDBLoadProgress& progress() const;
+
+  // The size of the RDB image at the front of data, known once done.
+  std::size_t rdb_size() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> _impl;
+};
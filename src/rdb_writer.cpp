@@ -0,0 +1,248 @@
+#include "rdb_writer.h"
+
+#include "listpack.h"
+
+namespace {
+
+constexpr std::string_view RDB_MAGIC = "REDIS0011";
+
+enum OpCode : std::uint8_t {
+  OP_AUX = 0xFA,
+  OP_RESIZEDB = 0xFB,
+  OP_EXPIRETIMEMS = 0xFC,
+  OP_SELECTDB = 0xFE,
+  OP_EOF = 0xFF,
+};
+
+enum ValueType : std::uint8_t {
+  VT_STRING_ENCODING = 0x00,
+  VT_SET_INTSET = 0x0B,
+  VT_HASH_LISTPACK = 0x10,
+  VT_ZSET_LISTPACK = 0x11,
+  VT_LIST_QUICKLIST_2 = 0x12,
+  VT_SET_LISTPACK = 0x14,
+  VT_STREAM_LISTPACKS_3 = 0x15,
+};
+
+constexpr std::uint64_t QUICKLIST_NODE_CONTAINER_PACKED = 2;
+
+enum StreamItemFlag : std::int64_t {
+  STREAM_ITEM_FLAG_NONE = 0,
+  STREAM_ITEM_FLAG_SAMEFIELDS = 2,
+};
+
+// same node limits as Redis uses by default
+constexpr std::size_t STREAM_NODE_MAX_ENTRIES = 100;
+constexpr std::size_t STREAM_NODE_MAX_BYTES = 4096;
+
+bool same_fields(const StreamPartValue& values, const StreamPartValue& master) {
+  if (values.size() != master.size()) {
+    return false;
+  }
+
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    if (values[i].first != master[i].first) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void append_be64(std::string& out, std::uint64_t value) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+
+} // namespace
+
+RDBWriter::RDBWriter(std::string& out)
+  : _out(out)
+{
+}
+
+RDBWriter& RDBWriter::header() {
+  this->_out.append(RDB_MAGIC);
+  return *this;
+}
+
+RDBWriter& RDBWriter::aux(std::string_view key, std::string_view value) {
+  this->_out.push_back(static_cast<char>(OP_AUX));
+  this->string(key);
+  this->string(value);
+  return *this;
+}
+
+RDBWriter& RDBWriter::select_db(std::size_t db_number) {
+  this->_out.push_back(static_cast<char>(OP_SELECTDB));
+  this->length(db_number);
+  return *this;
+}
+
+RDBWriter& RDBWriter::resize_db(std::size_t keys, std::size_t expires) {
+  this->_out.push_back(static_cast<char>(OP_RESIZEDB));
+  this->length(keys);
+  this->length(expires);
+  return *this;
+}
+
+RDBWriter& RDBWriter::string_entry(std::string_view key, std::string_view value, std::optional<Timepoint> expire_time) {
+  this->expire(expire_time);
+  this->_out.push_back(static_cast<char>(VT_STRING_ENCODING));
+  this->string(key);
+  this->string(value);
+  return *this;
+}
+
+// Entries are packed into listpack nodes, each keyed by its first id. Within a node ids
+// are kept as deltas from that key, and entries with the same field names as the first
+// one carry only values.
+RDBWriter& RDBWriter::stream_entry(std::string_view key, const StreamInfo& stream) {
+  this->_out.push_back(static_cast<char>(VT_STREAM_LISTPACKS_3));
+  this->string(key);
+
+  std::string nodes;
+  std::size_t nodes_count = 0;
+
+  auto it = stream.entries.begin();
+  while (it != stream.entries.end()) {
+    const auto& master_id = it->first;
+    const auto& master_fields = it->second;
+
+    // the entry count in the master entry is only known once the node is full
+    std::size_t count = 0;
+
+    ListpackWriter entries;
+    for (; it != stream.entries.end() && count < STREAM_NODE_MAX_ENTRIES && entries.size() < STREAM_NODE_MAX_BYTES; ++it, ++count) {
+      const auto& [id, values] = *it;
+      const bool same = same_fields(values, master_fields);
+
+      entries.integer(same ? STREAM_ITEM_FLAG_SAMEFIELDS : STREAM_ITEM_FLAG_NONE);
+      entries.integer(static_cast<std::int64_t>(id.ms - master_id.ms));
+      entries.integer(static_cast<std::int64_t>(id.id - master_id.id));
+
+      if (same) {
+        for (const auto& [field, value] : values) {
+          entries.string(value);
+        }
+        entries.integer(values.size() + 3);
+      } else {
+        entries.integer(values.size());
+        for (const auto& [field, value] : values) {
+          entries.string(field);
+          entries.string(value);
+        }
+        entries.integer(2 * values.size() + 4);
+      }
+    }
+
+    ListpackWriter node;
+    node.integer(count).integer(0).integer(master_fields.size());
+    for (const auto& [field, value] : master_fields) {
+      node.string(field);
+    }
+    node.integer(0);
+    node.append(entries);
+
+    std::string node_key;
+    append_be64(node_key, master_id.ms);
+    append_be64(node_key, master_id.id);
+
+    RDBWriter(nodes).string(node_key);
+    RDBWriter(nodes).string(node.finish());
+    ++nodes_count;
+  }
+
+  this->length(nodes_count);
+  this->_out.append(nodes);
+
+  this->length(stream.length);
+  this->stream_id(stream.last_generated_id);
+  this->stream_id(stream.recorded_first_entry_id);
+  this->stream_id(stream.max_deleted_entry_id);
+  this->length(stream.entries_added);
+  this->length(0); // consumer groups
+
+  return *this;
+}
+
+// The blob goes out as it is kept, a list as a quicklist of that single node.
+RDBWriter& RDBWriter::aggregate_entry(std::string_view key, const RDBAggregate& value, std::optional<Timepoint> expire_time) {
+  this->expire(expire_time);
+
+  ValueType type = VT_SET_LISTPACK;
+  switch (value.type) {
+    case RDBAggregate::Type::List: type = VT_LIST_QUICKLIST_2; break;
+    case RDBAggregate::Type::Set:
+      type = value.encoding == RDBAggregate::Encoding::Intset ? VT_SET_INTSET : VT_SET_LISTPACK;
+      break;
+    case RDBAggregate::Type::ZSet: type = VT_ZSET_LISTPACK; break;
+    case RDBAggregate::Type::Hash: type = VT_HASH_LISTPACK; break;
+  }
+
+  this->_out.push_back(static_cast<char>(type));
+  this->string(key);
+
+  if (type == VT_LIST_QUICKLIST_2) {
+    this->length(1);
+    this->length(QUICKLIST_NODE_CONTAINER_PACKED);
+  }
+  this->string(value.data);
+
+  return *this;
+}
+
+RDBWriter& RDBWriter::eof() {
+  this->_out.push_back(static_cast<char>(OP_EOF));
+  return *this;
+}
+
+RDBWriter& RDBWriter::checksum(std::uint64_t crc) {
+  for (std::size_t i = 0; i < 8; ++i) {
+    this->_out.push_back(static_cast<char>((crc >> (8 * i)) & 0xff));
+  }
+  return *this;
+}
+
+void RDBWriter::expire(std::optional<Timepoint> expire_time) {
+  if (!expire_time) {
+    return;
+  }
+
+  std::uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(expire_time.value().time_since_epoch()).count();
+
+  this->_out.push_back(static_cast<char>(OP_EXPIRETIMEMS));
+  for (std::size_t i = 0; i < 8; ++i) {
+    this->_out.push_back(static_cast<char>((ms >> (8 * i)) & 0xff));
+  }
+}
+
+void RDBWriter::length(std::uint64_t length) {
+  if (length < (1 << 6)) {
+    this->_out.push_back(static_cast<char>(length));
+  } else if (length < (1 << 14)) {
+    this->_out.push_back(static_cast<char>(0x40 | (length >> 8)));
+    this->_out.push_back(static_cast<char>(length & 0xff));
+  } else if (length <= 0xffffffff) {
+    this->_out.push_back(static_cast<char>(0x80));
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      this->_out.push_back(static_cast<char>((length >> shift) & 0xff));
+    }
+  } else {
+    this->_out.push_back(static_cast<char>(0x81));
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      this->_out.push_back(static_cast<char>((length >> shift) & 0xff));
+    }
+  }
+}
+
+void RDBWriter::string(std::string_view str) {
+  this->length(str.size());
+  this->_out.append(str);
+}
+
+void RDBWriter::stream_id(const StreamId& id) {
+  this->length(id.ms);
+  this->length(id.id);
+}
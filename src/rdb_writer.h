@@ -0,0 +1,36 @@
+#pragma once
+
+#include "storage.h"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Appends RDB encoded items to the given string, so a dump can be produced
+// piece by piece and shipped without ever being kept in memory as a whole.
+class RDBWriter {
+public:
+  explicit RDBWriter(std::string& out);
+
+  RDBWriter& header();
+  RDBWriter& aux(std::string_view key, std::string_view value);
+  RDBWriter& select_db(std::size_t db_number);
+  RDBWriter& resize_db(std::size_t keys, std::size_t expires);
+  RDBWriter& string_entry(std::string_view key, std::string_view value, std::optional<Timepoint> expire_time);
+  RDBWriter& stream_entry(std::string_view key, const StreamInfo& stream);
+  RDBWriter& aggregate_entry(std::string_view key, const RDBAggregate& value, std::optional<Timepoint> expire_time);
+  RDBWriter& eof();
+  // CRC64 of everything before it, the caller keeps it as the dump is flushed in parts.
+  // Zero tells the loader the checksum was not computed.
+  RDBWriter& checksum(std::uint64_t crc);
+
+private:
+  std::string& _out;
+
+  void expire(std::optional<Timepoint> expire_time);
+  void length(std::uint64_t length);
+  void string(std::string_view str);
+  void stream_id(const StreamId& id);
+};
@@ -1,5 +1,7 @@
 #include "replica.h"
 
+#include "debug.h"
+
 #include <arpa/inet.h>
 #include <cstring>
 #include <iostream>
@@ -8,6 +10,9 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <string.h>
+#include <unistd.h>
+
+constexpr std::size_t RECONNECT_DELAY_MS = 1000;
 
 std::string addr_to_string(const struct addrinfo* info) {
   void *addr;
@@ -32,9 +37,13 @@ std::string addr_to_string(const struct addrinfo* info) {
 Replica::Replica(EventLoopPtr event_loop) 
   : _event_loop(event_loop)
 {
-  this->_new_fd_signal = std::make_shared<Signal<int, PollEventTypeList, SignalPtr<PollEventType>>>();
+  this->_new_fd_signal = std::make_shared<Signal<int, PollEventTypeList, PollCallback>>();
   this->_removed_fd_signal = std::make_shared<Signal<int>>();
 
+  this->_slot_disconnected = std::make_shared<Slot<>>([this]() {
+    this->schedule_reconnect();
+  });
+
   this->_start_handle =  this->_event_loop->post([this]() {
     this->start();
   });
@@ -48,7 +57,11 @@ void Replica::set_storage(IStoragePtr storage) {
   this->_storage = storage;
 }
 
-SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>> &Replica::new_fd() {
+void Replica::set_replicas_manager(IReplicasManagerPtr replicas_manager) {
+  this->_replicas_manager = replicas_manager;
+}
+
+SignalPtr<int, PollEventTypeList, PollCallback> &Replica::new_fd() {
   return this->_new_fd_signal;
 }
 
@@ -57,6 +70,26 @@ SignalPtr<int> &Replica::removed_fd() {
 }
 
 void Replica::start() {
+  try {
+    this->connect();
+  } catch (const std::exception& e) {
+    std::cerr << "Replica failed to connect to master: " << e.what() << std::endl;
+    this->schedule_reconnect();
+  }
+}
+
+void Replica::schedule_reconnect() {
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Replica reconnects to master in " << RECONNECT_DELAY_MS << "ms" << std::endl;
+
+  this->_master_fd.reset();
+  this->_reconnect_handle = this->_event_loop->set_timeout(RECONNECT_DELAY_MS, [this]() {
+    this->start();
+  });
+}
+
+void Replica::connect() {
+  this->_handler.reset();
+
   struct addrinfo hints, *master_address;
 
   std::memset(&hints, 0, sizeof hints);
@@ -82,25 +115,32 @@ void Replica::start() {
 
   int master_fd = socket(master_address->ai_family, SOCK_STREAM, 0);
   if (master_fd < 0) {
+    auto error = errno;
+    freeaddrinfo(master_address);
     std::ostringstream ss;
-    ss << "Failed to create socket for connection to master, error: " << strerror(errno);
+    ss << "Failed to create socket for connection to master, error: " << strerror(error);
     throw std::runtime_error(ss.str());
   }
-  this->_master_fd = master_fd;
 
-  auto connect_result = connect(this->_master_fd.value(), master_address->ai_addr, master_address->ai_addrlen);
+  auto connect_result = ::connect(master_fd, master_address->ai_addr, master_address->ai_addrlen);
 
   if (connect_result != 0) {
+    auto error = errno;
+    ::close(master_fd);
+    freeaddrinfo(master_address);
     std::ostringstream ss;
-    ss << "Cannot connect to master, error: " << strerror(errno);
+    ss << "Cannot connect to master, error: " << strerror(error);
     throw std::runtime_error(ss.str());
   }
 
   freeaddrinfo(master_address);
+  this->_master_fd = master_fd;
 
   this->_talker = std::make_shared<ReplicaTalker>();
   this->_talker->set_server(this->_server);
   this->_talker->set_storage(this->_storage);
+  this->_talker->set_replicas_manager(this->_replicas_manager);
+  this->_talker->disconnected()->connect(this->_slot_disconnected);
 
   this->_handler = std::make_unique<Handler>(this->_event_loop, this->_master_fd.value(), this->_talker);
   this->_handler->new_fd()->connect(this->_new_fd_signal);
@@ -5,6 +5,7 @@
 #include "replica_talker.h"
 #include "server.h"
 #include "storage.h"
+#include "storage_middleware.h"
 
 #include <memory>
 #include <optional>
@@ -15,25 +16,32 @@ public:
 
   void set_server(ServerPtr);
   void set_storage(IStoragePtr);
+  void set_replicas_manager(IReplicasManagerPtr);
 
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& new_fd();
+  SignalPtr<int, PollEventTypeList, PollCallback>& new_fd();
   SignalPtr<int>& removed_fd();
 
 private:
   IStoragePtr _storage;
+  IReplicasManagerPtr _replicas_manager;
   ServerPtr _server;
 
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>> _new_fd_signal;
+  SignalPtr<int, PollEventTypeList, PollCallback> _new_fd_signal;
   SignalPtr<int> _removed_fd_signal;
 
   EventLoopPtr _event_loop;
 
   EventLoop::JobHandle _start_handle;
+  EventLoop::JobHandle _reconnect_handle;
+
+  SlotPtr<> _slot_disconnected;
 
   std::optional<int> _master_fd;
   std::unique_ptr<Handler> _handler;
   std::shared_ptr<ReplicaTalker> _talker;
 
   void start();
+  void connect();
+  void schedule_reconnect();
 };
 using ReplicaPtr = std::shared_ptr<Replica>;
@@ -2,9 +2,15 @@
 
 #include "command.h"
 #include "command_storage.h"
+#include "debug.h"
+#include "lzf.h"
 #include "rdb_parser.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
 enum : int {
   INIT = 0,
   UNDEFINED = 1,
@@ -17,11 +23,13 @@ enum : int {
 };
 
 ReplicaTalker::ReplicaTalker() {
+  this->_disconnected_signal = std::make_shared<Signal<>>();
+
   this->_state = WAIT_FIRST_PONG;
   this->_pending.push_back(PingCommand().construct());
 }
 
-void ReplicaTalker::listen(Message message) {
+void ReplicaTalker::listen(Message message, std::string_view raw) {
   if (this->_state == WAIT_FIRST_PONG) {
     if (message.type() == Message::Type::SimpleString) {
       auto str = to_lower_case(get<std::string>(message.getValue()));
@@ -30,6 +38,10 @@ void ReplicaTalker::listen(Message message) {
         this->_state = WAIT_OK_FOR_REPLCONF_PORT;
         this->next_say<ReplConfCommand>("listening-port", std::to_string(this->_server->info().server.tcp_port));
       }
+    } else if (message.type() == Message::Type::SimpleError) {
+      // e.g. -LOADING from a master still loading its dataset, the link is retried later
+      std::cerr << "Error reply to PING from master: " << get<std::string>(message.getValue()) << std::endl;
+      this->next_say(Message::Type::Leave);
     }
   } else if (this->_state == WAIT_OK_FOR_REPLCONF_PORT) {
     if (message.type() == Message::Type::SimpleString) {
@@ -37,7 +49,11 @@ void ReplicaTalker::listen(Message message) {
 
       if (str == "ok") {
         this->_state = WAIT_OK_FOR_REPLCONF_CAPA;
-        this->next_say<ReplConfCommand>("capa", "psync2");
+        if (this->_server->info().replication.repl_compression) {
+          this->next_say<ReplConfCommand>("capa", "eof", "capa", "psync2", "capa", "lzf");
+        } else {
+          this->next_say<ReplConfCommand>("capa", "eof", "capa", "psync2");
+        }
       }
     }
   } else if (this->_state == WAIT_OK_FOR_REPLCONF_CAPA) {
@@ -46,34 +62,79 @@ void ReplicaTalker::listen(Message message) {
 
       if (str == "ok") {
         this->_state = WAIT_FOR_PSYNC_ANSWER;
-        this->next_say<PsyncCommand>("?", "-1");
+
+        const auto& replication = this->_server->info().replication;
+        if (replication.has_cached_master) {
+          this->next_say<PsyncCommand>(replication.master_replid, std::to_string(replication.master_repl_offset + 1));
+        } else {
+          this->next_say<PsyncCommand>("?", "-1");
+        }
       }
     }
   } else if (this->_state == WAIT_FOR_PSYNC_ANSWER) {
     if (message.type() == Message::Type::SimpleString) {
-      auto str = get<std::string>(message.getValue());
-
-      this->_state = WAIT_FOR_RDB_FILE_SYNC;
+      this->process_psync_answer(get<std::string>(message.getValue()));
+    } else {
+      std::cerr << "Unexpected answer for PSYNC from master" << std::endl;
+      this->next_say(Message::Type::Leave);
     }
   } else if (this->_state == WAIT_FOR_RDB_FILE_SYNC) {
-    if (message.type() == Message::Type::SyncResponse) {
-      auto str = get<std::string>(message.getValue());
-      std::istringstream rdb_dump(str);
-      RDBParse(rdb_dump, static_cast<IRDBParserListener&>(*this->_storage.get()));
+    if (message.type() != Message::Type::SyncChunk) {
+      return;
+    }
+
+    // loading failed and the link is leaving already, the rest of the payload is dropped
+    if (!this->_rdb_parser) {
+      return;
+    }
+
+    const auto& chunk = get<std::string>(message.getValue());
+    if (!chunk.empty()) {
+      try {
+        this->_rdb_parser->feed(chunk);
+      } catch (const RDBParseError& err) {
+        std::cerr << "Failed loading the RDB from master: " << err.what() << std::endl;
+        this->_rdb_parser.reset();
+        this->next_say(Message::Type::Leave);
+      }
+      return;
+    }
 
-      this->_state = WAIT_SERVER_COMMANDS;
+    if (!this->_rdb_parser->done()) {
+      std::cerr << "RDB from master ended unexpectedly" << std::endl;
+      this->next_say(Message::Type::Leave);
+      return;
     }
+
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG RDB from master loaded, bytes = " << this->_rdb_parser->bytes_parsed() << std::endl;
+
+    this->_rdb_parser.reset();
+    this->_state = WAIT_SERVER_COMMANDS;
+
+    auto& replication = this->_server->info().replication;
+    replication.has_cached_master = true;
+    replication.master_link_status = "up";
   } else if (this->_state == WAIT_SERVER_COMMANDS) {
-    this->process(message);
+    this->process(std::move(message), raw);
   } else if (this->_state == UNDEFINED) {
   } else {
     this->next_say(Message::Type::Leave);
   }
 }
 
+// the stream is forwarded to sub-replicas and counted in offsets byte for byte
+bool ReplicaTalker::wants_raw() const {
+  return true;
+}
+
+void ReplicaTalker::interrupt() {
+  this->_server->info().replication.master_link_status = "down";
+  this->_disconnected_signal->emit();
+}
+
 Message::Type ReplicaTalker::expected() {
   if (this->_state == WAIT_FOR_RDB_FILE_SYNC) {
-    return Message::Type::SyncResponse;
+    return Message::Type::SyncChunk;
   }
   return Message::Type::Any;
 }
@@ -86,7 +147,152 @@ void ReplicaTalker::set_storage(IStoragePtr storage) {
   this->_storage = std::move(storage);
 }
 
-void ReplicaTalker::process(const Message& message) {
+void ReplicaTalker::set_replicas_manager(IReplicasManagerPtr replicas_manager) {
+  this->_replicas_manager = std::move(replicas_manager);
+}
+
+SignalPtr<>& ReplicaTalker::disconnected() {
+  return this->_disconnected_signal;
+}
+
+void ReplicaTalker::process_psync_answer(const std::string& answer) {
+  auto& replication = this->_server->info().replication;
+
+  std::istringstream ss(answer);
+  std::string verb;
+  ss >> verb;
+  verb = to_lower_case(verb);
+
+  if (verb == "fullresync") {
+    std::string replid;
+    std::size_t offset;
+    if (!(ss >> replid >> offset)) {
+      std::cerr << "Malformed FULLRESYNC answer from master: " << answer << std::endl;
+      this->next_say(Message::Type::Leave);
+      return;
+    }
+
+    replication.master_replid = replid;
+    replication.master_repl_offset = offset;
+    replication.has_cached_master = false;
+    this->_replicas_manager->upstream_reset(offset);
+    this->_storage->clear();
+    this->_rdb_parser = std::make_unique<RDBStreamParser>(static_cast<IRDBParserListener&>(*this->_storage), this->_server->info().persistence.rdb_checksum);
+
+    this->_state = WAIT_FOR_RDB_FILE_SYNC;
+
+  } else if (verb == "continue") {
+    std::string replid;
+    if (ss >> replid) {
+      replication.master_replid = replid;
+    }
+
+    replication.master_link_status = "up";
+    this->_state = WAIT_SERVER_COMMANDS;
+
+  } else {
+    std::cerr << "Unexpected answer for PSYNC from master: " << answer << std::endl;
+    this->next_say(Message::Type::Leave);
+  }
+}
+
+void ReplicaTalker::batch_started(std::size_t bytes_read) {
+  this->_batch_start = std::chrono::steady_clock::now();
+  this->_batch_bytes = bytes_read;
+  this->_batch_commands = 0;
+
+  if (bytes_read > 0) {
+    this->_server->info().replication.master_last_io = this->_batch_start;
+  }
+}
+
+void ReplicaTalker::batch_finished() {
+  if (this->_batch_commands == 0) {
+    return;
+  }
+
+  auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->_batch_start).count();
+
+  auto& replication = this->_server->info().replication;
+  replication.slave_apply_batches += 1;
+  replication.slave_apply_commands += this->_batch_commands;
+  replication.slave_apply_last_batch_commands = this->_batch_commands;
+  replication.slave_apply_last_batch_bytes = this->_batch_bytes;
+  replication.slave_apply_last_batch_usec = usec;
+  replication.slave_apply_max_batch_usec = std::max<std::size_t>(replication.slave_apply_max_batch_usec, usec);
+}
+
+void ReplicaTalker::process(Message message, std::string_view raw) {
+  // the frame itself is not a part of the stream, only what it carries
+  if (this->try_unpack_frame(message)) {
+    return;
+  }
+
+  ++this->_batch_commands;
+
+  if (!this->try_apply_set(message)) {
+    this->apply(message);
+  }
+
+  // every byte of the stream counts, and goes down the chain as it came
+  this->_server->info().replication.master_repl_offset += raw.size();
+  this->_replicas_manager->upstream_feed(raw);
+}
+
+// REPLCONF FRAME <size> <payload> carries LZF compressed stream bytes.
+// They are parsed as if they came from the socket directly.
+bool ReplicaTalker::try_unpack_frame(const Message& message) {
+  if (message.type() != Message::Type::Array) {
+    return false;
+  }
+
+  const auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() != 4) {
+    return false;
+  }
+
+  for (const auto& part : data) {
+    if (part.type() != Message::Type::BulkString) {
+      return false;
+    }
+  }
+
+  auto arg = [&data](std::size_t pos) -> const std::string& {
+    return std::get<std::string>(data[pos].getValue());
+  };
+
+  if (!equals_ignore_case(arg(0), "replconf") || !equals_ignore_case(arg(1), "frame")) {
+    return false;
+  }
+
+  auto started = std::chrono::steady_clock::now();
+
+  std::optional<std::string> unpacked;
+  if (auto size = parseUInt64(arg(2))) {
+    unpacked = lzf_decompress(arg(3), size.value());
+  }
+
+  if (!unpacked) {
+    std::cerr << "Malformed compressed frame from master" << std::endl;
+    this->next_say(Message::Type::Leave);
+    return true;
+  }
+
+  auto& replication = this->_server->info().replication;
+  replication.repl_decompression_frames += 1;
+  replication.repl_decompression_in_bytes += arg(3).size();
+  replication.repl_decompression_out_bytes += unpacked->size();
+  replication.repl_decompression_cpu_usec += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+
+  this->_frame_input.insert(this->_frame_input.end(), unpacked->begin(), unpacked->end());
+  while (auto maybe_message = this->_frame_parser.try_parse(Message::Type::Any)) {
+    this->process(std::move(maybe_message.value()), this->_frame_parser.last_message_raw());
+  }
+
+  return true;
+}
+
+void ReplicaTalker::apply(const Message& message) {
   try {
     auto command = Command::try_parse(message);
     auto type = command->type();
@@ -95,6 +301,14 @@ void ReplicaTalker::process(const Message& message) {
       auto& set_command = dynamic_cast<SetCommand&>(*command);
       this->_storage->set(set_command.key(), set_command.value(), set_command.expire_ms());
 
+    } else if (type == CommandType::XAdd) {
+      auto& cmd = static_cast<XAddCommand&>(*command);
+
+      auto result = this->_storage->xadd(cmd.key(), cmd.stream_id(), std::move(cmd.values()));
+      if (std::get<1>(result) != StreamErrorType::None) {
+        std::cerr << "Failed to apply XADD from master: " << to_string(std::get<1>(result)) << std::endl;
+      }
+
     } else if (type == CommandType::ReplConf) {
       auto& replconf_command = dynamic_cast<ReplConfCommand&>(*command);
 
@@ -105,16 +319,56 @@ void ReplicaTalker::process(const Message& message) {
       }
       if (to_lower_case(argv[0]) == "getack") {
         if (argv[1] == "*") {
-          this->next_say<ReplConfCommand>("ACK", std::to_string(this->_bytes_in));
+          this->next_say<ReplConfCommand>("ACK", std::to_string(this->_server->info().replication.master_repl_offset));
         }
       }
 
     } else {
       std::cerr << "Unexpected command from master" << std::endl;
     }
-
-    this->_bytes_in += message.size();
   } catch (const CommandParseError& err) {
     std::cerr << "Error in parsing command from master: " << err.what() << std::endl;
   }
 }
+
+// SET as the master propagates it is applied without building a Command,
+// key and value are moved out of the message. Anything else takes the general path.
+bool ReplicaTalker::try_apply_set(Message& message) {
+  if (message.type() != Message::Type::Array) {
+    return false;
+  }
+
+  auto& data = std::get<std::vector<Message>>(message.getValue());
+  if (data.size() != 3 && data.size() != 5) {
+    return false;
+  }
+
+  for (const auto& part : data) {
+    if (part.type() != Message::Type::BulkString) {
+      return false;
+    }
+  }
+
+  auto arg = [&data](std::size_t pos) -> std::string& {
+    return std::get<std::string>(data[pos].getValue());
+  };
+
+  if (!equals_ignore_case(arg(0), "set")) {
+    return false;
+  }
+
+  std::optional<int> expire_ms;
+  if (data.size() == 5) {
+    if (!equals_ignore_case(arg(3), "px")) {
+      return false;
+    }
+
+    expire_ms = parseInt(arg(4).data(), arg(4).size());
+    if (!expire_ms || expire_ms.value() <= 0) {
+      return false;
+    }
+  }
+
+  this->_storage->set(std::move(arg(1)), std::move(arg(2)), expire_ms);
+  return true;
+}
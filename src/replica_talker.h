@@ -1,29 +1,60 @@
 #pragma once
 
+#include "message_parser.h"
+#include "rdb_parser.h"
 #include "server.h"
+#include "signal_slot.h"
 #include "storage.h"
+#include "storage_middleware.h"
 #include "talker.h"
 
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <string>
+#include <string_view>
 
 class ReplicaTalker : public Talker {
 public:
   ReplicaTalker();
 
-  void listen(Message) override;
+  void listen(Message, std::string_view raw) override;
+  bool wants_raw() const override;
+  void interrupt() override;
+
+  void batch_started(std::size_t bytes_read) override;
+  void batch_finished() override;
 
   Message::Type expected() override;
 
   void set_server(ServerPtr);
   void set_storage(IStoragePtr);
+  void set_replicas_manager(IReplicasManagerPtr);
+
+  SignalPtr<>& disconnected();
 
 private:
   ServerPtr _server;
   IStoragePtr _storage;
+  IReplicasManagerPtr _replicas_manager;
+
+  SignalPtr<> _disconnected_signal;
 
   int _state = 0;
 
-  std::size_t _bytes_in = 0;
+  std::unique_ptr<RDBStreamParser> _rdb_parser;
+
+  // stream bytes unpacked from compressed frames
+  std::deque<char> _frame_input;
+  MessageParser<std::deque<char>> _frame_parser{_frame_input, true};
+
+  std::chrono::steady_clock::time_point _batch_start;
+  std::size_t _batch_bytes = 0;
+  std::size_t _batch_commands = 0;
 
-  void process(const Message&);
+  void process_psync_answer(const std::string&);
+  void process(Message, std::string_view raw);
+  bool try_unpack_frame(const Message&);
+  void apply(const Message&);
+  bool try_apply_set(Message&);
 };
@@ -0,0 +1,80 @@
+#include "replication_backlog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+ReplicationBacklog::ReplicationBacklog(std::size_t capacity)
+  : _capacity(capacity)
+{
+  if (this->_capacity == 0) {
+    throw std::runtime_error("Replication backlog size should be positive");
+  }
+}
+
+void ReplicationBacklog::append(std::string_view data) {
+  if (this->_buffer.empty()) {
+    this->_buffer.resize(this->_capacity); // allocated on first use only
+  }
+
+  this->_offset += data.size();
+
+  if (data.size() >= this->_capacity) {
+    data.remove_prefix(data.size() - this->_capacity);
+  }
+
+  while (!data.empty()) {
+    auto chunk = std::min(data.size(), this->_capacity - this->_pos);
+    std::memcpy(this->_buffer.data() + this->_pos, data.data(), chunk);
+    data.remove_prefix(chunk);
+
+    this->_pos = (this->_pos + chunk) % this->_capacity;
+    this->_histlen = std::min(this->_histlen + chunk, this->_capacity);
+  }
+}
+
+void ReplicationBacklog::reset(std::size_t offset) {
+  this->_offset = offset;
+  this->_histlen = 0;
+  this->_pos = 0;
+}
+
+std::size_t ReplicationBacklog::capacity() const {
+  return this->_capacity;
+}
+
+std::size_t ReplicationBacklog::offset() const {
+  return this->_offset;
+}
+
+std::size_t ReplicationBacklog::first_offset() const {
+  return this->_offset - this->_histlen;
+}
+
+std::size_t ReplicationBacklog::histlen() const {
+  return this->_histlen;
+}
+
+bool ReplicationBacklog::contains(std::size_t offset) const {
+  return this->first_offset() <= offset && offset <= this->_offset;
+}
+
+std::string ReplicationBacklog::read(std::size_t from) const {
+  if (!this->contains(from)) {
+    throw std::runtime_error("Requested offset is out of replication backlog");
+  }
+
+  std::size_t length = this->_offset - from;
+  std::size_t start = (this->_pos + this->_capacity - length % this->_capacity) % this->_capacity;
+
+  std::string result;
+  result.reserve(length);
+
+  while (result.size() < length) {
+    auto chunk = std::min(length - result.size(), this->_capacity - start);
+    result.append(this->_buffer.data() + start, chunk);
+    start = 0;
+  }
+
+  return result;
+}
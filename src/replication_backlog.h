@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr std::size_t DEFAULT_REPL_BACKLOG_SIZE = 1024 * 1024;
+
+// Fixed-size circular buffer with the tail of the replication stream.
+// Offsets are absolute positions in the stream (master_repl_offset).
+class ReplicationBacklog {
+public:
+  ReplicationBacklog(std::size_t capacity = DEFAULT_REPL_BACKLOG_SIZE);
+
+  void append(std::string_view data);
+  void reset(std::size_t offset);
+
+  std::size_t capacity() const;
+  std::size_t offset() const;
+  std::size_t first_offset() const;
+  std::size_t histlen() const;
+
+  bool contains(std::size_t offset) const;
+  std::string read(std::size_t from) const;
+
+private:
+  std::size_t _capacity;
+  std::vector<char> _buffer;
+
+  std::size_t _offset = 0;
+  std::size_t _histlen = 0;
+  std::size_t _pos = 0;
+};
@@ -3,22 +3,20 @@
 #include "debug.h"
 #include "handlers_manager.h"
 #include "poller.h"
+#include "replication_backlog.h"
+#include "shards.h"
 #include "utils.h"
 
-#include <arpa/inet.h>
 #include <cstdlib>
-#include <cstring>
+#include <iomanip>
 #include <iostream>
-#include <netdb.h>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <unistd.h>
 
 
-constexpr const int CONN_BACKLOG = 5;
 constexpr const int DEFAULT_PORT = 6379;
+constexpr const std::size_t MAX_IO_THREADS = 128; // as in Redis
 
 
 
@@ -26,9 +24,15 @@ ServerInfo ServerInfo::build(std::size_t argc, char** argv) {
   ServerInfo info;
 
   info.server.tcp_port = DEFAULT_PORT;
+  info.server.dir = DEFAULT_DIR;
+  info.server.dbfilename = DEFAULT_DBFILENAME;
   info.replication.role = "master";
   info.replication.master_replid = random_hexstring(40);
   info.replication.master_repl_offset = 0;
+  info.replication.repl_backlog_size = DEFAULT_REPL_BACKLOG_SIZE;
+  info.replication.repl_diskless_sync_delay = DEFAULT_REPL_DISKLESS_SYNC_DELAY_MS;
+  info.persistence.rdb_last_save_time = std::chrono::system_clock::now();
+  info.persistence.aof_filename = DEFAULT_APPENDFILENAME;
 
   int arg_pos = 1;
   while (arg_pos < argc) {
@@ -40,6 +44,55 @@ ServerInfo ServerInfo::build(std::size_t argc, char** argv) {
       info.server.tcp_port = std::atoi(argv[arg_pos + 1]);
       arg_pos += 2;
 
+    } else if (std::string("--tcp-backlog") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--tcp-backlog requires argument");
+      }
+
+      auto backlog = parseUInt64(argv[arg_pos + 1]);
+      if (!backlog || backlog.value() == 0 || backlog.value() > std::numeric_limits<int>::max()) {
+        throw std::runtime_error("--tcp-backlog requires a positive number of connections");
+      }
+
+      info.server.tcp_backlog = backlog.value();
+      arg_pos += 2;
+
+    } else if (std::string("--reuseport") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--reuseport requires argument");
+      }
+
+      auto value = to_lower_case(argv[arg_pos + 1]);
+      if (value != "yes" && value != "no") {
+        throw std::runtime_error("--reuseport expects yes or no");
+      }
+
+      info.server.reuseport = value == "yes";
+      arg_pos += 2;
+
+    } else if (std::string("--unixsocket") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--unixsocket requires argument");
+      }
+
+      info.server.unixsocket = argv[arg_pos + 1];
+      arg_pos += 2;
+
+    } else if (std::string("--unixsocketperm") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--unixsocketperm requires argument");
+      }
+
+      std::string_view value = argv[arg_pos + 1];
+      mode_t perm = 0;
+      auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), perm, 8);
+      if (ec != std::errc{} || end != value.data() + value.size() || perm > 0777) {
+        throw std::runtime_error("--unixsocketperm requires octal permissions, as 700");
+      }
+
+      info.server.unixsocketperm = perm;
+      arg_pos += 2;
+
     } else if (std::string("--replicaof") == argv[arg_pos]) {
       if (arg_pos + 1 >= argc) {
         throw std::runtime_error("--replicaof requires argument \"[host port]\"");
@@ -57,6 +110,34 @@ ServerInfo ServerInfo::build(std::size_t argc, char** argv) {
       info.replication.master_port = std::atoi(std::string(arg.begin() + delim_pos + 1, arg.end()).data());
       arg_pos += 2;
 
+    } else if (std::string("--shards") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--shards requires argument");
+      }
+
+      auto shards = parseUInt64(argv[arg_pos + 1]);
+      if (!shards || shards.value() == 0 || shards.value() > HASH_SLOTS) {
+        throw std::runtime_error("--shards requires number of threads, from 1 to 16384");
+      }
+
+      info.server.shards = shards.value();
+      arg_pos += 2;
+
+    } else if (std::string("--io-threads") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--io-threads requires argument");
+      }
+
+      auto io_threads = parseUInt64(argv[arg_pos + 1]);
+      if (!io_threads || io_threads.value() == 0 || io_threads.value() > MAX_IO_THREADS) {
+        std::ostringstream ss;
+        ss << "--io-threads requires number of threads, from 1 to " << MAX_IO_THREADS;
+        throw std::runtime_error(ss.str());
+      }
+
+      info.server.io_threads = io_threads.value();
+      arg_pos += 2;
+
     } else if (std::string("--dir") == argv[arg_pos]) {
       if (arg_pos + 1 >= argc) {
         throw std::runtime_error("--dir requires argument");
@@ -73,6 +154,162 @@ ServerInfo ServerInfo::build(std::size_t argc, char** argv) {
       info.server.dbfilename = argv[arg_pos + 1];
       arg_pos += 2;
 
+    } else if (std::string("--repl-backlog-size") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--repl-backlog-size requires argument");
+      }
+
+      auto size = parseUInt64(argv[arg_pos + 1]);
+      if (!size || size.value() == 0) {
+        throw std::runtime_error("--repl-backlog-size requires positive number of bytes");
+      }
+
+      info.replication.repl_backlog_size = size.value();
+      arg_pos += 2;
+
+    } else if (std::string("--repl-diskless-sync-delay") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--repl-diskless-sync-delay requires argument");
+      }
+
+      auto delay = parseUInt64(argv[arg_pos + 1]);
+      if (!delay) {
+        throw std::runtime_error("--repl-diskless-sync-delay requires number of milliseconds");
+      }
+
+      info.replication.repl_diskless_sync_delay = delay.value();
+      arg_pos += 2;
+
+    } else if (std::string("--repl-compression") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--repl-compression requires argument");
+      }
+
+      auto value = to_lower_case(argv[arg_pos + 1]);
+      if (value != "yes" && value != "no") {
+        throw std::runtime_error("--repl-compression expects yes or no");
+      }
+
+      info.replication.repl_compression = value == "yes";
+      arg_pos += 2;
+
+    } else if (std::string("--save") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--save requires argument \"[seconds changes ...]\"");
+      }
+
+      // every --save adds points, an empty one drops all given before
+      std::istringstream points(argv[arg_pos + 1]);
+      std::string seconds, changes;
+      if (std::string_view(argv[arg_pos + 1]).empty()) {
+        info.persistence.save_points.clear();
+      }
+
+      while (points >> seconds) {
+        if (!(points >> changes)) {
+          throw std::runtime_error("--save requires pairs of seconds and changes");
+        }
+
+        auto maybe_seconds = parseUInt64(seconds);
+        auto maybe_changes = parseUInt64(changes);
+        if (!maybe_seconds || !maybe_changes) {
+          throw std::runtime_error("--save requires pairs of seconds and changes");
+        }
+
+        info.persistence.save_points.push_back({maybe_seconds.value(), maybe_changes.value()});
+      }
+      arg_pos += 2;
+
+    } else if (std::string("--rdbchecksum") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--rdbchecksum requires argument");
+      }
+
+      auto value = to_lower_case(argv[arg_pos + 1]);
+      if (value != "yes" && value != "no") {
+        throw std::runtime_error("--rdbchecksum expects yes or no");
+      }
+
+      info.persistence.rdb_checksum = value == "yes";
+      arg_pos += 2;
+
+    } else if (std::string("--loading-serve-reads") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--loading-serve-reads requires argument");
+      }
+
+      auto value = to_lower_case(argv[arg_pos + 1]);
+      if (value != "yes" && value != "no") {
+        throw std::runtime_error("--loading-serve-reads expects yes or no");
+      }
+
+      info.persistence.loading_serve_reads = value == "yes";
+      arg_pos += 2;
+
+    } else if (std::string("--appendonly") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--appendonly requires argument");
+      }
+
+      auto value = to_lower_case(argv[arg_pos + 1]);
+      if (value != "yes" && value != "no") {
+        throw std::runtime_error("--appendonly expects yes or no");
+      }
+
+      info.persistence.aof_enabled = value == "yes";
+      arg_pos += 2;
+
+    } else if (std::string("--appendfilename") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--appendfilename requires argument");
+      }
+
+      info.persistence.aof_filename = argv[arg_pos + 1];
+      arg_pos += 2;
+
+    } else if (std::string("--appendfsync") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--appendfsync requires argument");
+      }
+
+      auto value = to_lower_case(argv[arg_pos + 1]);
+      if (value == "always") {
+        info.persistence.aof_fsync = Persistence::AppendFsync::Always;
+      } else if (value == "everysec") {
+        info.persistence.aof_fsync = Persistence::AppendFsync::EverySec;
+      } else if (value == "no") {
+        info.persistence.aof_fsync = Persistence::AppendFsync::No;
+      } else {
+        throw std::runtime_error("--appendfsync expects always, everysec or no");
+      }
+      arg_pos += 2;
+
+    } else if (std::string("--auto-aof-rewrite-percentage") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--auto-aof-rewrite-percentage requires argument");
+      }
+
+      auto percentage = parseUInt64(argv[arg_pos + 1]);
+      if (!percentage) {
+        throw std::runtime_error("--auto-aof-rewrite-percentage requires a number");
+      }
+
+      info.persistence.auto_aof_rewrite_percentage = percentage.value();
+      arg_pos += 2;
+
+    } else if (std::string("--auto-aof-rewrite-min-size") == argv[arg_pos]) {
+      if (arg_pos + 1 >= argc) {
+        throw std::runtime_error("--auto-aof-rewrite-min-size requires argument");
+      }
+
+      auto size = parseUInt64(argv[arg_pos + 1]);
+      if (!size) {
+        throw std::runtime_error("--auto-aof-rewrite-min-size requires number of bytes");
+      }
+
+      info.persistence.auto_aof_rewrite_min_size = size.value();
+      arg_pos += 2;
+
     } else if (std::string("-v") == argv[arg_pos]) {
       info.debug_level = 1;
 
@@ -90,6 +327,22 @@ ServerInfo ServerInfo::build(std::size_t argc, char** argv) {
     }
   }
 
+  // a sharded keyspace has no single place to log writes, stream them to replicas or fork a snapshot from
+  if (info.server.shards > 1) {
+    if (info.replication.role == "slave") {
+      throw std::runtime_error("--shards can not be used together with --replicaof");
+    }
+    if (info.persistence.aof_enabled) {
+      throw std::runtime_error("--shards can not be used together with --appendonly yes");
+    }
+    if (!info.persistence.save_points.empty()) {
+      throw std::runtime_error("--shards can not be used together with --save");
+    }
+    if (info.server.io_threads > 1) {
+      throw std::runtime_error("--shards can not be used together with --io-threads");
+    }
+  }
+
   return info;
 }
 
@@ -104,6 +357,10 @@ std::string ServerInfo::to_string(std::unordered_set<std::string> parts) const {
     ss << this->replication.to_string();
   }
 
+  if (parts.contains("persistence")) {
+    ss << this->persistence.to_string();
+  }
+
   return ss.str();
 }
 
@@ -112,16 +369,54 @@ std::optional<std::string> ServerInfo::get_config_value(std::string_view key) co
     return this->server.dir;
   } else if (key == "dbfilename") {
     return this->server.dbfilename;
+  } else if (key == "shards") {
+    return std::to_string(this->server.shards);
+  } else if (key == "tcp-backlog") {
+    return std::to_string(this->server.tcp_backlog);
+  } else if (key == "reuseport") {
+    return this->server.reuseport ? "yes" : "no";
+  } else if (key == "unixsocket") {
+    return this->server.unixsocket;
+  } else if (key == "unixsocketperm") {
+    std::ostringstream ss;
+    ss << std::oct << this->server.unixsocketperm;
+    return ss.str();
+  } else if (key == "io-threads") {
+    return std::to_string(this->server.io_threads);
+  } else if (key == "save") {
+    return this->persistence.save_points_string();
+  } else if (key == "rdbchecksum") {
+    return this->persistence.rdb_checksum ? "yes" : "no";
+  } else if (key == "loading-serve-reads") {
+    return this->persistence.loading_serve_reads ? "yes" : "no";
+  } else if (key == "appendonly") {
+    return this->persistence.aof_enabled ? "yes" : "no";
+  } else if (key == "appendfilename") {
+    return this->persistence.aof_filename;
+  } else if (key == "appendfsync") {
+    return this->persistence.aof_fsync_string();
+  } else if (key == "auto-aof-rewrite-percentage") {
+    return std::to_string(this->persistence.auto_aof_rewrite_percentage);
+  } else if (key == "auto-aof-rewrite-min-size") {
+    return std::to_string(this->persistence.auto_aof_rewrite_min_size);
   }
   
   return {};
 }
 
+std::filesystem::path ServerInfo::aof_file_path() const {
+  return std::filesystem::path{this->server.dir} / this->persistence.aof_filename;
+}
+
 std::string ServerInfo::Server::to_string() const {
   std::ostringstream ss;
 
   ss << "#Server" << std::endl;
   ss << "tcp_port:" << this->tcp_port << std::endl;
+  ss << "shards:" << this->shards << std::endl;
+  ss << "io_threads_active:" << this->io_threads << std::endl;
+  ss << "io_threaded_reads_processed:" << this->io_threaded_reads_processed << std::endl;
+  ss << "io_threaded_writes_processed:" << this->io_threaded_writes_processed << std::endl;
 
   return ss.str();
 }
@@ -141,49 +436,190 @@ std::string ServerInfo::Replication::to_string() const {
   if (this->role == "slave") {
     ss << "master_host:" << this->master_host << std::endl;
     ss << "master_port:" << this->master_port << std::endl;
+    ss << "master_link_status:" << this->master_link_status << std::endl;
+
+    if (this->master_last_io) {
+      auto idle = std::chrono::steady_clock::now() - this->master_last_io.value();
+      ss << "master_last_io_seconds_ago:" << std::chrono::duration_cast<std::chrono::seconds>(idle).count() << std::endl;
+    } else {
+      ss << "master_last_io_seconds_ago:-1" << std::endl;
+    }
+
+    ss << "slave_repl_offset:" << this->master_repl_offset << std::endl;
+    ss << "slave_apply_batches:" << this->slave_apply_batches << std::endl;
+    ss << "slave_apply_commands:" << this->slave_apply_commands << std::endl;
+    ss << "slave_apply_last_batch_commands:" << this->slave_apply_last_batch_commands << std::endl;
+    ss << "slave_apply_last_batch_bytes:" << this->slave_apply_last_batch_bytes << std::endl;
+    ss << "slave_apply_last_batch_usec:" << this->slave_apply_last_batch_usec << std::endl;
+    ss << "slave_apply_max_batch_usec:" << this->slave_apply_max_batch_usec << std::endl;
+  }
+
+  ss << "connected_slaves:" << this->connected_slaves << std::endl;
+  ss << "repl_backlog_active:" << (this->repl_backlog_histlen > 0 ? 1 : 0) << std::endl;
+  ss << "repl_backlog_size:" << this->repl_backlog_size << std::endl;
+  ss << "repl_backlog_first_byte_offset:" << this->repl_backlog_first_byte_offset << std::endl;
+  ss << "repl_backlog_histlen:" << this->repl_backlog_histlen << std::endl;
+
+  auto ratio = [](std::size_t in, std::size_t out) {
+    return out > 0 ? static_cast<double>(in) / out : 0.0;
+  };
+
+  ss << std::fixed << std::setprecision(2);
+  ss << "repl_compression_frames:" << this->repl_compression_frames << std::endl;
+  ss << "repl_compression_in_bytes:" << this->repl_compression_in_bytes << std::endl;
+  ss << "repl_compression_out_bytes:" << this->repl_compression_out_bytes << std::endl;
+  ss << "repl_compression_ratio:" << ratio(this->repl_compression_in_bytes, this->repl_compression_out_bytes) << std::endl;
+  ss << "repl_compression_cpu_usec:" << this->repl_compression_cpu_usec << std::endl;
+
+  if (this->role == "slave") {
+    ss << "repl_decompression_frames:" << this->repl_decompression_frames << std::endl;
+    ss << "repl_decompression_in_bytes:" << this->repl_decompression_in_bytes << std::endl;
+    ss << "repl_decompression_out_bytes:" << this->repl_decompression_out_bytes << std::endl;
+    ss << "repl_decompression_ratio:" << ratio(this->repl_decompression_out_bytes, this->repl_decompression_in_bytes) << std::endl;
+    ss << "repl_decompression_cpu_usec:" << this->repl_decompression_cpu_usec << std::endl;
+  }
+
+  return ss.str();
+}
+
+std::string ServerInfo::Persistence::save_points_string() const {
+  std::ostringstream ss;
+
+  for (const auto& point : this->save_points) {
+    if (ss.tellp() > 0) {
+      ss << " ";
+    }
+    ss << point.seconds << " " << point.changes;
   }
 
   return ss.str();
 }
 
+std::string ServerInfo::Persistence::aof_fsync_string() const {
+  switch (this->aof_fsync) {
+    case AppendFsync::Always:
+      return "always";
+    case AppendFsync::EverySec:
+      return "everysec";
+    case AppendFsync::No:
+      return "no";
+  }
+  return {};
+}
+
+std::string ServerInfo::Persistence::to_string() const {
+  std::ostringstream ss;
+
+  auto or_never = [](const std::optional<std::size_t>& value) {
+    return value ? std::to_string(value.value()) : std::string("-1");
+  };
+
+  ss << "#Persistence" << std::endl;
+  ss << "loading:" << (this->loading ? 1 : 0) << std::endl;
+
+  if (this->loading) {
+    auto perc = this->loading_total_bytes ? 100.0 * this->loading_loaded_bytes / this->loading_total_bytes : 0.0;
+    ss << "loading_start_time:" << std::chrono::duration_cast<std::chrono::seconds>(this->loading_start_time.value().time_since_epoch()).count() << std::endl;
+    ss << "loading_total_bytes:" << this->loading_total_bytes << std::endl;
+    ss << "loading_loaded_bytes:" << this->loading_loaded_bytes << std::endl;
+    ss << "loading_loaded_perc:" << std::fixed << std::setprecision(2) << perc << std::endl;
+
+    // the rest is assumed to go at the pace so far, 1 until there is a pace to go by
+    std::size_t eta_seconds = 1;
+    if (this->loading_loaded_bytes > 0) {
+      auto elapsed = std::chrono::duration<double>(std::chrono::system_clock::now() - this->loading_start_time.value()).count();
+      eta_seconds = static_cast<std::size_t>(elapsed * (this->loading_total_bytes - this->loading_loaded_bytes) / this->loading_loaded_bytes);
+    }
+    ss << "loading_eta_seconds:" << eta_seconds << std::endl;
+  }
+
+  ss << "rdb_changes_since_last_save:" << this->rdb_changes_since_last_save << std::endl;
+  ss << "rdb_bgsave_in_progress:" << (this->rdb_bgsave_in_progress ? 1 : 0) << std::endl;
+  ss << "rdb_last_save_time:" << std::chrono::duration_cast<std::chrono::seconds>(this->rdb_last_save_time.time_since_epoch()).count() << std::endl;
+  ss << "rdb_saves:" << this->rdb_saves << std::endl;
+  ss << "rdb_last_bgsave_status:" << this->rdb_last_bgsave_status << std::endl;
+  ss << "rdb_last_bgsave_time_sec:" << or_never(this->rdb_last_bgsave_time_sec) << std::endl;
+
+  if (this->rdb_current_bgsave_start) {
+    auto running = std::chrono::steady_clock::now() - this->rdb_current_bgsave_start.value();
+    ss << "rdb_current_bgsave_time_sec:" << std::chrono::duration_cast<std::chrono::seconds>(running).count() << std::endl;
+  } else {
+    ss << "rdb_current_bgsave_time_sec:-1" << std::endl;
+  }
+
+  ss << "rdb_last_save_duration_ms:" << or_never(this->rdb_last_save_duration_ms) << std::endl;
+  ss << "rdb_last_cow_size:" << this->rdb_last_cow_size << std::endl;
+  ss << "rdb_last_load_keys_expired:" << this->rdb_last_load_keys_expired << std::endl;
+  ss << "rdb_last_load_keys_loaded:" << this->rdb_last_load_keys_loaded << std::endl;
+  ss << "rdb_last_load_duration_ms:" << or_never(this->rdb_last_load_duration_ms) << std::endl;
+  ss << "aof_enabled:" << (this->aof_enabled ? 1 : 0) << std::endl;
+
+  if (this->aof_enabled) {
+    ss << "aof_current_size:" << this->aof_current_size << std::endl;
+    ss << "aof_buffer_length:" << this->aof_buffer_length << std::endl;
+    ss << "aof_last_write_status:" << this->aof_last_write_status << std::endl;
+    ss << "aof_pending_bio_fsync:" << (this->aof_pending_bio_fsync ? 1 : 0) << std::endl;
+    ss << "aof_delayed_fsync:" << this->aof_delayed_fsync << std::endl;
+    ss << "aof_writes:" << this->aof_writes << std::endl;
+    ss << "aof_written_commands:" << this->aof_written_commands << std::endl;
+    ss << "aof_base_size:" << this->aof_base_size << std::endl;
+  }
+
+  ss << "aof_rewrite_in_progress:" << (this->aof_rewrite_in_progress ? 1 : 0) << std::endl;
+  ss << "aof_rewrite_scheduled:" << (this->aof_rewrite_scheduled ? 1 : 0) << std::endl;
+  ss << "aof_last_rewrite_time_sec:" << or_never(this->aof_last_rewrite_time_sec) << std::endl;
+
+  if (this->aof_current_rewrite_start) {
+    auto running = std::chrono::steady_clock::now() - this->aof_current_rewrite_start.value();
+    ss << "aof_current_rewrite_time_sec:" << std::chrono::duration_cast<std::chrono::seconds>(running).count() << std::endl;
+  } else {
+    ss << "aof_current_rewrite_time_sec:-1" << std::endl;
+  }
+
+  ss << "aof_last_bgrewrite_status:" << this->aof_last_bgrewrite_status << std::endl;
+  ss << "aof_rewrites:" << this->aof_rewrites << std::endl;
+  ss << "aof_last_cow_size:" << this->aof_last_cow_size << std::endl;
+  ss << "aof_rewrite_buffer_length:" << this->aof_rewrite_buffer_length << std::endl;
+
+  return ss.str();
+}
+
 Server::Server(EventLoopPtr event_loop, ServerInfo info)
     : _event_loop(event_loop)
     , _info(std::move(info))
 {
   this->_is_replica = this->_info.replication.role == "slave";
 
-  this->_new_server_fd_signal = std::make_shared<Signal<int, PollEventTypeList, SignalPtr<PollEventType>>>();
+  this->_new_server_fd_signal = std::make_shared<Signal<int, PollEventTypeList, PollCallback>>();
   this->_removed_server_fd_signal = std::make_shared<Signal<int>>();
   this->_new_fd_signal = std::make_shared<Signal<int>>();
   this->_removed_fd_signal = std::make_shared<Signal<int>>();
 
-  this->_fd_event_signal = std::make_shared<Signal<PollEventType>>();
-  this->_slot_fd_event = std::make_shared<Slot<PollEventType>>([this](PollEventType type) {
-    if (type != PollEventType::ReadyToRead) {
-      throw std::runtime_error("Server got unexpected poll event");
-      // TODO make error more verbose
-    }
-
-    try {
-      while (auto maybe_client_fd = this->accept()) {
-        this->_new_fd_signal->emit(maybe_client_fd.value());
-      }
-    } catch (std::exception& e) {
-      std::cerr << "Client accepting error: " << e.what() << std::endl;
-    }
-  });
-  this->_fd_event_signal->connect(this->_slot_fd_event);
-
-  this->_start_handle = this->_event_loop->post([this]() {
-    this->start();
-  });
-}
+  // with reuseport every shard listens itself, the main loop only has to run
+  if (!this->_info.server.reuseport || this->_info.server.shards == 1) {
+    this->_listener = std::make_shared<Listener>(
+      this->_event_loop,
+      this->_info.server.tcp_port,
+      this->_info.server.tcp_backlog,
+      this->_info.server.reuseport);
+    this->_listener->new_server_fd()->connect(this->_new_server_fd_signal);
+    this->_listener->removed_server_fd()->connect(this->_removed_server_fd_signal);
+    this->_listener->new_fd()->connect(this->_new_fd_signal);
+  }
 
-Server::~Server() {
-  this->close();
+  if (!this->_info.server.unixsocket.empty()) {
+    this->_unix_listener = std::make_shared<Listener>(
+      this->_event_loop,
+      this->_info.server.unixsocket,
+      this->_info.server.unixsocketperm,
+      this->_info.server.tcp_backlog);
+    this->_unix_listener->new_server_fd()->connect(this->_new_server_fd_signal);
+    this->_unix_listener->removed_server_fd()->connect(this->_removed_server_fd_signal);
+    this->_unix_listener->new_fd()->connect(this->_new_fd_signal);
+  }
 }
 
-SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& Server::new_server_fd() {
+SignalPtr<int, PollEventTypeList, PollCallback>& Server::new_server_fd() {
   return this->_new_server_fd_signal;
 }
 
@@ -203,92 +639,6 @@ bool Server::is_replica() const {
   return this->_is_replica;
 }
 
-void Server::start() {
-  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Server starting on 0.0.0.0:" << this->_info.server.tcp_port << std::endl;
-
-  int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-  if (server_fd < 0) {
-    std::ostringstream ss;
-    ss << "Failed to create server socket: " << strerror(errno);
-    throw std::runtime_error(ss.str());
-  }
-
-  this->_server_fd = server_fd;
-
-  int reuse = 1;
-  if (setsockopt(*this->_server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-    std::ostringstream ss;
-    ss << "Setsockopt failed: " << strerror(errno);
-    throw std::runtime_error(ss.str());
-  }
-
-  struct sockaddr_in server_addr;
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr.s_addr = INADDR_ANY;
-  server_addr.sin_port = htons(this->_info.server.tcp_port);
-
-  bool binded = false;
-  const int retry_ms = 250;
-  const int max_tries = 8;
-  for (std::size_t tries = 0; tries < max_tries; ++tries) {
-    if (bind(*this->_server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
-      if (errno != EADDRINUSE) {
-        break;
-      }
-      if (DEBUG_LEVEL >= 2) std::cerr << "DEBUG Failed to bind, address in use, retrying in " << retry_ms << "ms, try #" << tries + 1 << std::endl;
-      usleep(retry_ms * 1000);
-    } else {
-      binded = true;
-      break;
-    }
-  }
-
-  if (!binded) {
-    std::ostringstream ss;
-    ss << "Failed to bind to port " << this->_info.server.tcp_port << ": " << strerror(errno);
-    throw std::runtime_error(ss.str());
-  }
-
-  if (listen(*this->_server_fd, CONN_BACKLOG) != 0) {
-    std::ostringstream ss;
-    ss << "Listen failed: " << strerror(errno);
-    throw std::runtime_error(ss.str());
-  }
-
-  this->_new_server_fd_signal->emit(
-      this->_server_fd.value(),
-      PollEventTypeList{PollEventType::ReadyToRead},
-      this->_fd_event_signal);
-  
-  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Server ready!" << std::endl;
-}
-
-std::optional<int> Server::accept() {
-  struct sockaddr_in client_addr;
-  std::size_t client_addr_len = sizeof(client_addr);
-
-  int accept_res = ::accept(this->_server_fd.value(), (struct sockaddr *)&client_addr, (socklen_t *)&client_addr_len);
-  if (accept_res < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return {};
-    } else {
-      std::ostringstream ss;
-      ss << "Server got error on accept: errno=" << errno;
-      throw std::runtime_error(ss.str());
-    }
-  }
-
-  return accept_res;
-}
-
 ServerInfo& Server::info() {
   return this->_info;
 }
-
-void Server::close() {
-  if (this->_server_fd) {
-    this->_removed_server_fd_signal->emit(this->_server_fd.value());
-    ::close(this->_server_fd.value());
-    this->_server_fd.reset();
-  }
-}
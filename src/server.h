@@ -1,16 +1,26 @@
 #pragma once
 
 #include "events.h"
+#include "listener.h"
 #include "poller.h"
 #include "signal_slot.h"
 
+#include <chrono>
 #include <filesystem>
 #include <memory>
 #include <optional>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 constexpr int DEFAULT_DEBUG_LEVEL = 0;
+constexpr int DEFAULT_TCP_BACKLOG = 511;
+constexpr std::size_t DEFAULT_REPL_DISKLESS_SYNC_DELAY_MS = 100;
+constexpr std::string_view DEFAULT_DIR = ".";
+constexpr std::string_view DEFAULT_DBFILENAME = "dump.rdb";
+constexpr std::string_view DEFAULT_APPENDFILENAME = "appendonly.aof";
+constexpr std::size_t DEFAULT_AUTO_AOF_REWRITE_PERCENTAGE = 100;
+constexpr std::size_t DEFAULT_AUTO_AOF_REWRITE_MIN_SIZE = 64 * 1024 * 1024;
 
 struct ServerInfo {
   static ServerInfo build(std::size_t argc, char** argv);
@@ -20,6 +30,22 @@ struct ServerInfo {
   struct Server {
     int tcp_port;
 
+    // event loop threads, each owning a range of hash slots, 1 keeps everything on the main thread
+    std::size_t shards = 1;
+
+    int tcp_backlog = DEFAULT_TCP_BACKLOG;
+    // SO_REUSEPORT on the listening socket, with shards each of them gets a listener of its own
+    bool reuseport = false;
+
+    // extra listener for local clients, none when empty
+    std::string unixsocket;
+    mode_t unixsocketperm = 0;
+
+    // threads reading, parsing and writing client sockets, the loop thread included, 1 keeps all I/O on it
+    std::size_t io_threads = 1;
+    std::size_t io_threaded_reads_processed = 0;
+    std::size_t io_threaded_writes_processed = 0;
+
     std::string dir;
     std::string dbfilename;
 
@@ -31,16 +57,116 @@ struct ServerInfo {
   struct Replication {
     std::string role;
     std::string master_replid;
-    int master_repl_offset;
+    std::size_t master_repl_offset;
 
     std::string master_host;
     int master_port;
+    std::string master_link_status = "down";
+    bool has_cached_master = false;
+
+    std::optional<std::chrono::steady_clock::time_point> master_last_io;
+    std::size_t slave_apply_batches = 0;
+    std::size_t slave_apply_commands = 0;
+    std::size_t slave_apply_last_batch_commands = 0;
+    std::size_t slave_apply_last_batch_bytes = 0;
+    std::size_t slave_apply_last_batch_usec = 0;
+    std::size_t slave_apply_max_batch_usec = 0;
+
+    std::size_t connected_slaves = 0;
+    std::size_t repl_diskless_sync_delay;
+    bool repl_compression = false;
+
+    std::size_t repl_compression_frames = 0;
+    std::size_t repl_compression_in_bytes = 0;
+    std::size_t repl_compression_out_bytes = 0;
+    std::size_t repl_compression_cpu_usec = 0;
+
+    std::size_t repl_decompression_frames = 0;
+    std::size_t repl_decompression_in_bytes = 0;
+    std::size_t repl_decompression_out_bytes = 0;
+    std::size_t repl_decompression_cpu_usec = 0;
+
+    std::size_t repl_backlog_size;
+    std::size_t repl_backlog_first_byte_offset = 0;
+    std::size_t repl_backlog_histlen = 0;
 
     std::string to_string() const;
   } replication;
 
+  struct Persistence {
+    // snapshot is taken once `changes` writes happened and `seconds` passed since the last one
+    struct SavePoint {
+      std::size_t seconds;
+      std::size_t changes;
+    };
+    std::vector<SavePoint> save_points;
+
+    // CRC64 written at the end of dumps and verified on load, off trades safety for faster saves and restarts
+    bool rdb_checksum = true;
+
+    std::size_t rdb_changes_since_last_save = 0;
+    std::chrono::system_clock::time_point rdb_last_save_time;
+    std::size_t rdb_saves = 0;
+
+    bool rdb_bgsave_in_progress = false;
+    std::optional<std::chrono::steady_clock::time_point> rdb_current_bgsave_start;
+    std::string rdb_last_bgsave_status = "ok";
+    std::optional<std::size_t> rdb_last_bgsave_time_sec;
+
+    std::optional<std::size_t> rdb_last_save_duration_ms;
+    std::size_t rdb_last_cow_size = 0;
+
+    bool loading = false;
+    // while loading, reads of keys already loaded are answered instead of -LOADING
+    bool loading_serve_reads = false;
+    std::optional<std::chrono::system_clock::time_point> loading_start_time;
+    std::size_t loading_total_bytes = 0;
+    std::size_t loading_loaded_bytes = 0;
+    std::size_t rdb_last_load_keys_loaded = 0;
+    std::size_t rdb_last_load_keys_expired = 0;
+    std::optional<std::size_t> rdb_last_load_duration_ms;
+
+    enum class AppendFsync {
+      Always,
+      EverySec,
+      No,
+    };
+
+    bool aof_enabled = false;
+    std::string aof_filename;
+    AppendFsync aof_fsync = AppendFsync::EverySec;
+
+    std::size_t aof_current_size = 0;
+    std::size_t aof_buffer_length = 0;
+    std::string aof_last_write_status = "ok";
+    bool aof_pending_bio_fsync = false;
+    std::size_t aof_delayed_fsync = 0;
+    std::size_t aof_writes = 0; // one per loop iteration with writes, however many commands it had
+    std::size_t aof_written_commands = 0;
+
+    // rewrite starts once the log grew by the percentage over its size after the last rewrite, 0 disables
+    std::size_t auto_aof_rewrite_percentage = DEFAULT_AUTO_AOF_REWRITE_PERCENTAGE;
+    std::size_t auto_aof_rewrite_min_size = DEFAULT_AUTO_AOF_REWRITE_MIN_SIZE;
+
+    std::size_t aof_base_size = 0;
+    bool aof_rewrite_in_progress = false;
+    bool aof_rewrite_scheduled = false;
+    std::optional<std::chrono::steady_clock::time_point> aof_current_rewrite_start;
+    std::optional<std::size_t> aof_last_rewrite_time_sec;
+    std::string aof_last_bgrewrite_status = "ok";
+    std::size_t aof_rewrites = 0;
+    std::size_t aof_last_cow_size = 0;
+    std::size_t aof_rewrite_buffer_length = 0;
+
+    std::string save_points_string() const;
+    std::string aof_fsync_string() const;
+    std::string to_string() const;
+  } persistence;
+
   std::string to_string(std::unordered_set<std::string>) const;
   std::optional<std::string> get_config_value(std::string_view) const;
+
+  std::filesystem::path aof_file_path() const;
 };
 
 class Server;
@@ -48,9 +174,8 @@ using ServerPtr = std::shared_ptr<Server>;
 class Server {
 public:
   Server(EventLoopPtr event_loop, ServerInfo info = {});
-  ~Server();
 
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>>& new_server_fd();
+  SignalPtr<int, PollEventTypeList, PollCallback>& new_server_fd();
   SignalPtr<int>& removed_server_fd();
   SignalPtr<int>& new_fd();
   SignalPtr<int>& removed_fd();
@@ -62,23 +187,13 @@ private:
   ServerInfo _info;
   bool _is_replica;
 
-  SignalPtr<int, PollEventTypeList, SignalPtr<PollEventType>> _new_server_fd_signal;
+  SignalPtr<int, PollEventTypeList, PollCallback> _new_server_fd_signal;
   SignalPtr<int> _removed_server_fd_signal;
   SignalPtr<int> _new_fd_signal;
   SignalPtr<int> _removed_fd_signal;
 
-  SignalPtr<PollEventType> _fd_event_signal;
-  SlotPtr<PollEventType> _slot_fd_event;
-
   EventLoopPtr _event_loop;
 
-  EventLoop::JobHandle _start_handle;
-
-  std::optional<int> _server_fd;
-
-  void start();
-
-  std::optional<int> accept();
-
-  void close();
+  ListenerPtr _listener;
+  ListenerPtr _unix_listener;
 };
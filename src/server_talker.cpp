@@ -1,13 +1,71 @@
 #include "server_talker.h"
 
-#include "base64.h"
 #include "command_storage.h"
 #include "utils.h"
 
-#include <filesystem>
-#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <unordered_map>
 
-const std::string empty_rdb_file = "UkVESVMwMDEx+glyZWRpcy12ZXIFNy4yLjD6CnJlZGlzLWJpdHPAQPoFY3RpbWXCbQi8ZfoIdXNlZC1tZW3CsMQQAPoIYW9mLWJhc2XAAP/wbjv+wP9aog==";
+namespace {
+
+Message stream_entry_message(const StreamId& id, const StreamPartValue& values) {
+  std::vector<Message> entry_values;
+  for (const auto& [key, value] : values) {
+    entry_values.emplace_back(Message::Type::BulkString, key);
+    entry_values.emplace_back(Message::Type::BulkString, value);
+  }
+
+  std::vector<Message> entry;
+  entry.emplace_back(Message::Type::BulkString, id.to_string());
+  entry.emplace_back(Message::Type::Array, std::move(entry_values));
+  return Message(Message::Type::Array, std::move(entry));
+}
+
+// Commands that are answered while the dataset is still loading, none of them looks at the keyspace
+bool is_allowed_while_loading(CommandType type) {
+  return type == CommandType::Info || type == CommandType::Config
+    || type == CommandType::ReplConf || type == CommandType::LastSave;
+}
+
+// Key of a single key read, those can be served once the key itself is loaded
+std::optional<std::string> loading_read_key(const Command& command) {
+  switch (command.type()) {
+    case CommandType::Get: return static_cast<const GetCommand&>(command).key();
+    case CommandType::Type: return static_cast<const TypeCommand&>(command).key();
+    case CommandType::XRange: return static_cast<const XRangeCommand&>(command).key();
+    case CommandType::XLen: return static_cast<const XLenCommand&>(command).key();
+    case CommandType::XInfo: return static_cast<const XInfoCommand&>(command).key();
+    default: return std::nullopt;
+  }
+}
+
+// Key of a command touching a single key, it runs on the shard owning that key
+std::optional<std::string> single_key(const Command& command) {
+  switch (command.type()) {
+    case CommandType::Set: return static_cast<const SetCommand&>(command).key();
+    case CommandType::XAdd: return static_cast<const XAddCommand&>(command).key();
+    default: return loading_read_key(command);
+  }
+}
+
+// Concatenates the arrays the shards replied with, an error of any of them is the reply
+Message merge_arrays(std::vector<Message> parts) {
+  std::vector<Message> merged;
+  for (auto& part : parts) {
+    if (part.type() != Message::Type::Array) {
+      return std::move(part);
+    }
+
+    auto& items = std::get<std::vector<Message>>(part.getValue());
+    std::move(items.begin(), items.end(), std::back_inserter(merged));
+  }
+
+  return Message(Message::Type::Array, std::move(merged));
+}
+
+} // namespace
 
 ServerTalker::ServerTalker(EventLoopPtr event_loop)
   : _event_loop(event_loop)
@@ -17,200 +75,338 @@ ServerTalker::ServerTalker(EventLoopPtr event_loop)
   });
 }
 
-void ServerTalker::listen(Message message) {
-  const bool is_replica = this->_server->is_replica();
+void ServerTalker::listen(Message message, std::string_view) {
+  // behind a reply still awaited from another shard, whatever this command says waits as well
+  const bool queued = !this->_replies.empty();
+  const auto said_before = this->_pending.size();
 
   try {
     auto command = Command::try_parse(message);
-    auto type = command->type();
+    if (!this->_shards || !this->forward(*command, message)) {
+      this->execute(std::move(command));
+    }
+  } catch (const CommandParseError& err) {
+    this->next_say(Message::Type::SimpleError, err.what());
+  }
 
-    if (type == CommandType::Ping) {
-      this->next_say(Message::Type::SimpleString, "PONG");
+  if (queued && this->_pending.size() > said_before) {
+    auto& reply = this->_replies.emplace_back();
+    reply.parts.assign(
+      std::make_move_iterator(this->_pending.begin() + said_before),
+      std::make_move_iterator(this->_pending.end()));
+    this->_pending.erase(this->_pending.begin() + said_before, this->_pending.end());
+  }
+}
 
-    } else if (type == CommandType::Echo) {
-      auto& echo_command = dynamic_cast<EchoCommand&>(*command);
+void ServerTalker::execute(CommandPtr command) {
+  const bool is_replica = this->_server->is_replica();
+  auto type = command->type();
+
+  if (this->_server->info().persistence.loading && !is_allowed_while_loading(type)) {
+    auto key = loading_read_key(*command);
+    const bool serve = key && this->_server->info().persistence.loading_serve_reads
+      && this->_storage->type(key.value()) != StorageType::None;
+    if (!serve) {
+      this->next_say(Message::Type::SimpleError, "LOADING Redis is loading the dataset in memory");
+      return;
+    }
+  }
 
-      this->next_say(Message::Type::BulkString, echo_command.data());
+  if (type == CommandType::Ping) {
+    this->next_say(Message::Type::SimpleString, "PONG");
 
-    } else if (type == CommandType::Set) {
-      if (is_replica) {
-        this->next_say(Message::Type::SimpleError, "cannot write: replica mode");
-        return;
-      }
+  } else if (type == CommandType::Echo) {
+    auto& echo_command = dynamic_cast<EchoCommand&>(*command);
 
-      auto& set_command = dynamic_cast<SetCommand&>(*command);
-      this->_storage->set(set_command.key(), set_command.value(), set_command.expire_ms());
-      this->next_say(Message::Type::SimpleString, "OK");
+    this->next_say(Message::Type::BulkString, echo_command.data());
 
-    } else if (type == CommandType::Get) {
-      auto& get_command = static_cast<GetCommand&>(*command);
-      if (auto result = this->_storage->get(get_command.key())) {
-        this->next_say(Message::Type::BulkString, result.value());
-      } else {
-        this->next_say(Message::Type::BulkString);
-      }
+  } else if (type == CommandType::Set) {
+    if (is_replica) {
+      this->next_say(Message::Type::SimpleError, "cannot write: replica mode");
+      return;
+    }
+
+    auto& set_command = dynamic_cast<SetCommand&>(*command);
+    this->_storage->set(set_command.key(), set_command.value(), set_command.expire_ms());
+    this->next_say(Message::Type::SimpleString, "OK");
+
+  } else if (type == CommandType::Get) {
+    auto& get_command = static_cast<GetCommand&>(*command);
+    if (auto result = this->_storage->get(get_command.key())) {
+      this->next_say(Message::Type::BulkString, result.value());
+    } else {
+      this->next_say(Message::Type::BulkString);
+    }
 
-    } else if (type == CommandType::Type) {
-      auto& type_command = static_cast<TypeCommand&>(*command);
-      auto result = to_string(this->_storage->type(type_command.key()));
-      this->next_say(Message::Type::BulkString, std::move(result));
+  } else if (type == CommandType::Type) {
+    auto& type_command = static_cast<TypeCommand&>(*command);
+    auto result = to_string(this->_storage->type(type_command.key()));
+    this->next_say(Message::Type::BulkString, std::move(result));
 
-    } else if (type == CommandType::Keys) {
-      auto& keys_command = static_cast<KeysCommand&>(*command);
-      auto keys = this->_storage->keys(keys_command.arg());
+  } else if (type == CommandType::Keys) {
+    auto& keys_command = static_cast<KeysCommand&>(*command);
+    auto keys = this->_storage->keys(keys_command.arg());
 
+    std::vector<Message> array;
+    for (auto& key : keys) {
+      array.emplace_back(Message::Type::BulkString, std::move(key));
+    }
+    this->next_say(Message::Type::Array, std::move(array));
+
+  } else if (type == CommandType::Config) {
+    auto& config_command = static_cast<ConfigCommand&>(*command);
+
+    auto action = to_lower_case(config_command.action());
+    if (action == "get") {
       std::vector<Message> array;
-      for (auto& key : keys) {
-        array.emplace_back(Message::Type::BulkString, std::move(key));
+      for (const auto& key : config_command.args()) {
+        auto value = this->_server->info().get_config_value(key);
+        if (value) {
+          array.emplace_back(Message::Type::BulkString, key);
+          array.emplace_back(Message::Type::BulkString, value.value());
+        }
       }
       this->next_say(Message::Type::Array, std::move(array));
+    } else {
+      this->next_say(Message::Type::SimpleError, "unknown action for config command");
+    }
 
-    } else if (type == CommandType::Config) {
-      auto& config_command = static_cast<ConfigCommand&>(*command);
-
-      auto action = to_lower_case(config_command.action());
-      if (action == "get") {
-        std::vector<Message> array;
-        for (const auto& key : config_command.args()) {
-          auto value = this->_server->info().get_config_value(key);
-          if (value) {
-            array.emplace_back(Message::Type::BulkString, key);
-            array.emplace_back(Message::Type::BulkString, value.value());
-          }
-        }
-        this->next_say(Message::Type::Array, std::move(array));
+  } else if (type == CommandType::Info) {
+    auto& info_command = static_cast<InfoCommand&>(*command);
+
+    std::unordered_set<std::string> info_parts;
+
+    auto default_parts = [&info_parts]() {
+      info_parts.insert("server");
+      info_parts.insert("persistence");
+      info_parts.insert("replication");
+    };
+
+    for (const auto& info_part : info_command.args()) {
+      if (info_part == "default") {
+        default_parts();
       } else {
-        this->next_say(Message::Type::SimpleError, "unknown action for config command");
+        info_parts.insert(info_part);
       }
+    }
 
-    } else if (type == CommandType::Info) {
-      auto& info_command = static_cast<InfoCommand&>(*command);
+    if (info_parts.size() == 0) {
+      default_parts();
+    }
 
-      std::unordered_set<std::string> info_parts;
+    this->next_say(Message::Type::BulkString, this->_server->info().to_string(info_parts));
 
-      auto default_parts = [&info_parts]() {
-        info_parts.insert("server");
-        info_parts.insert("replication");
-      };
+  } else if (type == CommandType::ReplConf) {
+    auto& cmd = static_cast<ReplConfCommand&>(*command);
 
-      for (const auto& info_part : info_command.args()) {
-        if (info_part == "default") {
-          default_parts();
-        } else {
-          info_parts.insert(info_part);
-        }
-      }
+    if (!this->_replica_id) {
+      this->_replica_id = this->_replicas_manager->add_replica(this->_slot_message);
+    }
+    if (this->_replicas_manager->replica_process_conf(this->_replica_id.value(), command)) {
+      this->next_say(Message::Type::SimpleString, "OK");
+    }
 
-      if (info_parts.size() == 0) {
-        default_parts();
-      }
+  } else if (type == CommandType::Psync) {
+    auto& cmd = static_cast<PsyncCommand&>(*command);
 
-      this->next_say(Message::Type::BulkString, this->_server->info().to_string(info_parts));
+    if (!this->_replica_id) {
+      this->_replica_id = this->_replicas_manager->add_replica(this->_slot_message);
+    }
 
-    } else if (type == CommandType::ReplConf) {
-      auto& cmd = static_cast<ReplConfCommand&>(*command);
+    const auto& replication = this->_server->info().replication;
 
-      if (!this->_replica_id) {
-        this->_replica_id = this->_replicas_manager->add_replica(this->_slot_message);
-      }
-      if (this->_replicas_manager->replica_process_conf(this->_replica_id.value(), command)) {
-        this->next_say(Message::Type::SimpleString, "OK");
+    if (is_replica && replication.master_link_status != "up") {
+      this->next_say(Message::Type::SimpleError, "NOMASTERLINK Can't SYNC while not connected with my master");
+      return;
+    }
+
+    // replica asks for the offset of the next byte it needs, counting from 1
+    std::optional<std::size_t> psync_offset;
+    if (cmd.args().size() == 2) {
+      if (auto value = parseUInt64(cmd.args()[1]); value && value.value() > 0) {
+        psync_offset = value.value() - 1;
       }
+    }
 
-    } else if (type == CommandType::Psync) {
-      auto& cmd = static_cast<PsyncCommand&>(*command);
+    if (psync_offset && this->_replicas_manager->can_partial_resync(cmd.args()[0], psync_offset.value())) {
+      this->next_say(Message::Type::SimpleString, "CONTINUE " + replication.master_replid);
+      this->_replicas_manager->replica_start_stream(this->_replica_id.value(), psync_offset.value());
+      return;
+    }
 
-      std::ostringstream ss;
-      ss << "FULLRESYNC"
-        << " " << this->_server->info().replication.master_replid
-        << " " << this->_server->info().replication.master_repl_offset;
-      this->next_say(Message::Type::SimpleString, ss.str());
+    // FULLRESYNC and the payload are sent once the snapshot pass starts
+    this->_replicas_manager->replica_full_sync(this->_replica_id.value());
 
-      if (std::filesystem::exists(this->_server->info().server.db_file_path())) {
-        std::ifstream ifs(this->_server->info().server.db_file_path(), std::ios::binary);
-        std::string contents(std::istreambuf_iterator<char>(ifs), {});
-        this->next_say(Message::Type::SyncResponse, contents);
-      } else {
-        this->next_say(Message::Type::SyncResponse, base64_decode(empty_rdb_file));
-      }
+  } else if (type == CommandType::Wait) {
+    auto& wait_command = static_cast<WaitCommand&>(*command);
+    this->_replicas_manager->wait_for(wait_command.replicas(), wait_command.timeout_ms(), this->_slot_message);
 
-      this->_replicas_manager->replica_set_state(this->_replica_id.value(), IReplicasManager::ReplState::WRITE);
+  } else if (type == CommandType::XAdd) {
+    if (is_replica) {
+      this->next_say(Message::Type::SimpleError, "cannot write: replica mode");
+      return;
+    }
 
-    } else if (type == CommandType::Wait) {
-      auto& wait_command = static_cast<WaitCommand&>(*command);
-      this->_replicas_manager->wait_for(wait_command.replicas(), wait_command.timeout_ms(), this->_slot_message);
+    auto& cmd = static_cast<XAddCommand&>(*command);
 
-    } else if (type == CommandType::XAdd) {
-      auto& cmd = static_cast<XAddCommand&>(*command);
+    auto result = this->_storage->xadd(cmd.key(), std::move(cmd.stream_id()), std::move(cmd.values()));
+    if (std::get<1>(result) == StreamErrorType::None) {
+      this->next_say(Message::Type::BulkString, std::get<0>(result).to_string());
+    } else {
+      this->next_say(Message::Type::SimpleError, to_string(std::get<1>(result)));
+    }
 
-      auto result = this->_storage->xadd(cmd.key(), std::move(cmd.stream_id()), std::move(cmd.values()));
-      if (std::get<1>(result) == StreamErrorType::None) {
-        this->next_say(Message::Type::BulkString, std::get<0>(result).to_string());
-      } else {
-        this->next_say(Message::Type::SimpleError, to_string(std::get<1>(result)));
-      }
+  } else if (type == CommandType::XRange) {
+    auto& cmd = static_cast<XRangeCommand&>(*command);
 
-    } else if (type == CommandType::XRange) {
-      auto& cmd = static_cast<XRangeCommand&>(*command);
+    auto result = this->_storage->xrange(cmd.key(), cmd.left_id(), cmd.right_id());
+    std::vector<Message> entries;
+    for (const auto& [id, values]: result) {
+      entries.emplace_back(stream_entry_message(id, values));
+    }
+
+    this->next_say(Message::Type::Array, std::move(entries));
+
+  } else if (type == CommandType::XRead) {
+    auto& cmd = static_cast<XReadCommand&>(*command);
+
+    this->_storage->xread(std::move(cmd.request()), cmd.block_ms(),
+    [slot_wptr = std::weak_ptr(this->_slot_message)] (StreamsReadResult result) {
+      auto slot_ptr = slot_wptr.lock();
+      if (!slot_ptr) {
+        return;
+      }
 
-      auto result = this->_storage->xrange(cmd.key(), cmd.left_id(), cmd.right_id());
       std::vector<Message> entries;
-      for (const auto& [id, values]: result) {
-        std::vector<Message> entry_values;
-        for (const auto& [key, value] : values) {
-          entry_values.emplace_back(Message::Type::BulkString, key);
-          entry_values.emplace_back(Message::Type::BulkString, value);
+      for (const auto& [stream_id, stream_range]: result) {
+        std::vector<Message> stream_entries;
+        for (const auto& [id, values] : stream_range) {
+          stream_entries.emplace_back(stream_entry_message(id, values));
         }
 
-        std::vector<Message> entry;
-        entry.emplace_back(Message::Type::BulkString, id.to_string());
-        entry.emplace_back(Message::Type::Array, std::move(entry_values));
-        entries.emplace_back(Message::Type::Array, std::move(entry));
+        std::vector<Message> stream_entry;
+        stream_entry.emplace_back(Message::Type::BulkString, stream_id);
+        stream_entry.emplace_back(Message::Type::Array, std::move(stream_entries));
+        entries.emplace_back(Message::Type::Array, std::move(stream_entry));
       }
 
-      this->next_say(Message::Type::Array, std::move(entries));
+      slot_ptr->call(Message(Message::Type::Array, std::move(entries)));
 
-    } else if (type == CommandType::XRead) {
-      auto& cmd = static_cast<XReadCommand&>(*command);
+    });
 
-      this->_storage->xread(std::move(cmd.request()), cmd.block_ms(),
-      [slot_wptr = std::weak_ptr(this->_slot_message)] (StreamsReadResult result) {
-        auto slot_ptr = slot_wptr.lock();
-        if (!slot_ptr) {
-          return;
-        }
+  } else if (type == CommandType::XLen) {
+    auto& cmd = static_cast<XLenCommand&>(*command);
+
+    auto [length, error] = this->_storage->xlen(cmd.key());
+    if (error == StreamErrorType::None) {
+      this->next_say(Message::Type::Integer, static_cast<int>(length));
+    } else {
+      this->next_say(Message::Type::SimpleError, to_string(error));
+    }
+
+  } else if (type == CommandType::XInfo) {
+    auto& cmd = static_cast<XInfoCommand&>(*command);
+
+    auto [info, error] = this->_storage->xinfo(cmd.key());
+    if (error != StreamErrorType::None) {
+      this->next_say(Message::Type::SimpleError, to_string(error));
+      return;
+    }
+
+    if (cmd.action() == XInfoCommand::Action::Groups) {
+      this->next_say(Message::Type::Array, std::vector<Message>{});
+      return;
+    } else if (cmd.action() == XInfoCommand::Action::Consumers) {
+      this->next_say(Message::Type::SimpleError,
+        print_args("NOGROUP No such consumer group '", cmd.group(), "' for key name '", cmd.key(), "'"));
+      return;
+    }
+
+    std::vector<Message> reply;
+    auto field = [&reply](std::string name, Message value) {
+      reply.emplace_back(Message::Type::BulkString, std::move(name));
+      reply.emplace_back(std::move(value));
+    };
 
-        std::vector<Message> entries;
-        for (const auto& [stream_id, stream_range]: result) {
-          std::vector<Message> stream_entries;
-          for (const auto& [id, values] : stream_range) {
-            std::vector<Message> entry_values;
-            for (const auto& [key, value] : values) {
-              entry_values.emplace_back(Message::Type::BulkString, key);
-              entry_values.emplace_back(Message::Type::BulkString, value);
-            }
-
-            std::vector<Message> entry;
-            entry.emplace_back(Message::Type::BulkString, id.to_string());
-            entry.emplace_back(Message::Type::Array, std::move(entry_values));
-            stream_entries.emplace_back(Message::Type::Array, std::move(entry));
-          }
-
-          std::vector<Message> stream_entry;
-          stream_entry.emplace_back(Message::Type::BulkString, stream_id);
-          stream_entry.emplace_back(Message::Type::Array, std::move(stream_entries));
-          entries.emplace_back(Message::Type::Array, std::move(stream_entry));
+    field("length", Message(Message::Type::Integer, static_cast<int>(info.length)));
+    // entries are kept in a plain ordered map, there is no radix tree to report on
+    field("last-generated-id", Message(Message::Type::BulkString, info.last_generated_id.to_string()));
+    field("max-deleted-entry-id", Message(Message::Type::BulkString, info.max_deleted_entry_id.to_string()));
+    field("entries-added", Message(Message::Type::Integer, static_cast<int>(info.entries_added)));
+    field("recorded-first-entry-id", Message(Message::Type::BulkString, info.recorded_first_entry_id.to_string()));
+
+    if (cmd.full()) {
+      std::vector<Message> entries;
+      for (auto it = info.entries.begin(); it != info.entries.end(); ++it) {
+        if (cmd.count() > 0 && entries.size() >= cmd.count()) {
+          break;
         }
+        entries.emplace_back(stream_entry_message(it->first, it->second));
+      }
+      field("entries", Message(Message::Type::Array, std::move(entries)));
+      field("groups", Message(Message::Type::Array, std::vector<Message>{}));
+    } else {
+      field("groups", Message(Message::Type::Integer, static_cast<int>(info.groups)));
 
-        slot_ptr->call(Message(Message::Type::Array, std::move(entries)));
+      if (info.length > 0) {
+        auto first = info.entries.begin();
+        auto last = std::prev(info.entries.end());
+        field("first-entry", stream_entry_message(first->first, first->second));
+        field("last-entry", stream_entry_message(last->first, last->second));
+      } else {
+        field("first-entry", Message(Message::Type::BulkString));
+        field("last-entry", Message(Message::Type::BulkString));
+      }
+    }
 
-      });
+    field("memory-bytes", Message(Message::Type::Integer, static_cast<int>(info.memory_bytes)));
+
+    this->next_say(Message::Type::Array, std::move(reply));
 
+  } else if (type == CommandType::Save) {
+    auto status = this->_persistence->save();
+    if (status == IPersistence::SaveStatus::Done) {
+      this->next_say(Message::Type::SimpleString, "OK");
+    } else if (status == IPersistence::SaveStatus::InProgress) {
+      this->next_say(Message::Type::SimpleError, "ERR Background save already in progress");
     } else {
-      this->next_say(Message::Type::SimpleError, "unimplemented command");
+      this->next_say(Message::Type::SimpleError, "ERR Failed to save the DB, see the server log");
     }
-  } catch (const CommandParseError& err) {
-    this->next_say(Message::Type::SimpleError, err.what());
+
+  } else if (type == CommandType::BgSave) {
+    auto& cmd = static_cast<BgSaveCommand&>(*command);
+
+    auto status = this->_persistence->bgsave(cmd.schedule());
+    if (status == IPersistence::SaveStatus::Started) {
+      this->next_say(Message::Type::SimpleString, "Background saving started");
+    } else if (status == IPersistence::SaveStatus::Scheduled) {
+      this->next_say(Message::Type::SimpleString, "Background saving scheduled");
+    } else if (status == IPersistence::SaveStatus::InProgress) {
+      this->next_say(Message::Type::SimpleError, "ERR Background save already in progress");
+    } else {
+      this->next_say(Message::Type::SimpleError, "ERR Failed to start background save, see the server log");
+    }
+
+  } else if (type == CommandType::BgRewriteAof) {
+    auto status = this->_persistence->bgrewriteaof();
+    if (status == IPersistence::SaveStatus::Started) {
+      this->next_say(Message::Type::SimpleString, "Background append only file rewriting started");
+    } else if (status == IPersistence::SaveStatus::Scheduled) {
+      this->next_say(Message::Type::SimpleString, "Background append only file rewriting scheduled");
+    } else if (status == IPersistence::SaveStatus::InProgress) {
+      this->next_say(Message::Type::SimpleError, "ERR Background append only file rewriting already in progress");
+    } else if (status == IPersistence::SaveStatus::Disabled) {
+      this->next_say(Message::Type::SimpleError, "ERR Append only file is disabled");
+    } else {
+      this->next_say(Message::Type::SimpleError, "ERR Failed to start the append only file rewrite, see the server log");
+    }
+
+  } else if (type == CommandType::LastSave) {
+    auto last_save = this->_server->info().persistence.rdb_last_save_time;
+    this->next_say(Message::Type::Integer, static_cast<int>(std::chrono::duration_cast<std::chrono::seconds>(last_save.time_since_epoch()).count()));
+
+  } else {
+    this->next_say(Message::Type::SimpleError, "unimplemented command");
   }
 }
 
@@ -219,6 +415,50 @@ void ServerTalker::interrupt() {
     this->_replicas_manager->remove_replica(this->_replica_id.value());
     this->_replica_id.reset();
   }
+
+  if (this->_remote_client_id) {
+    for (std::size_t shard = 0; shard < this->_proxied.size(); ++shard) {
+      if (this->_proxied[shard]) {
+        auto& target = this->_shards->at(shard);
+        target.post([&target, id = this->_remote_client_id.value()]() {
+          target.drop_remote(id);
+        });
+      }
+    }
+    this->_remote_client_id.reset();
+  }
+}
+
+void ServerTalker::batch_finished() {
+  if (!this->_shards) {
+    return;
+  }
+
+  for (std::size_t shard = 0; shard < this->_forward.size(); ++shard) {
+    if (this->_forward[shard].empty()) {
+      continue;
+    }
+
+    if (!this->_remote_client_id) {
+      this->_remote_client_id = this->_shards->next_remote_client_id();
+    }
+    this->_proxied[shard] = true;
+
+    auto reply = [shards = this->_shards, origin = this->_shard_id, shard, talker_wptr = this->weak_from_this()]
+    (std::vector<Message> replies) {
+      shards->at(origin).post([talker_wptr, shard, replies = std::move(replies)]() mutable {
+        if (auto talker = talker_wptr.lock()) {
+          talker->receive(shard, std::move(replies));
+        }
+      });
+    };
+
+    auto& target = this->_shards->at(shard);
+    target.post([&target, id = this->_remote_client_id.value(), messages = std::move(this->_forward[shard]), reply = std::move(reply)]() mutable {
+      target.serve_remote(id, std::move(messages), std::move(reply));
+    });
+    this->_forward[shard].clear();
+  }
 }
 
 Message::Type ServerTalker::expected() {
@@ -236,3 +476,140 @@ void ServerTalker::set_storage(IStoragePtr storage) {
 void ServerTalker::set_replicas_manager(IReplicasManagerPtr replicas_manager) {
   this->_replicas_manager = std::move(replicas_manager);
 }
+
+void ServerTalker::set_persistence(IPersistencePtr persistence) {
+  this->_persistence = std::move(persistence);
+}
+
+void ServerTalker::set_shards(Shards* shards, std::size_t shard_id) {
+  this->_shards = shards;
+  this->_shard_id = shard_id;
+  this->_proxied.assign(shards->count(), false);
+  this->_awaited.resize(shards->count());
+  this->_forward.resize(shards->count());
+}
+
+bool ServerTalker::forward(Command& command, Message& message) {
+  const auto type = command.type();
+
+  if (type == CommandType::ReplConf || type == CommandType::Psync || type == CommandType::Wait) {
+    this->next_say(Message::Type::SimpleError, "ERR replication is not available with --shards");
+    return true;
+  }
+
+  if (type == CommandType::Save || type == CommandType::BgSave || type == CommandType::BgRewriteAof) {
+    this->next_say(Message::Type::SimpleError, "ERR persistence is not available with --shards");
+    return true;
+  }
+
+  if (type == CommandType::Keys) {
+    auto sequence = this->add_reply(this->_shards->count(), merge_arrays);
+    for (std::size_t shard = 0; shard < this->_shards->count(); ++shard) {
+      this->forward_to(shard, message, sequence);
+    }
+    return true;
+  }
+
+  if (type == CommandType::XRead) {
+    auto& cmd = static_cast<XReadCommand&>(command);
+
+    std::map<std::size_t, StreamsReadRequest> by_shard;
+    std::unordered_map<std::string, std::size_t> positions;
+    for (const auto& [key, id] : cmd.request()) {
+      by_shard[this->_shards->shard_of(key)].emplace_back(key, id);
+      positions.emplace(key, positions.size());
+    }
+
+    if (by_shard.size() == 1) {
+      const auto shard = by_shard.begin()->first;
+      if (shard == this->_shard_id) {
+        return false;
+      }
+
+      this->forward_to(shard, std::move(message), this->add_reply(1));
+      return true;
+    }
+
+    // a blocked read would have to wake up on whichever shard gets an entry first
+    if (cmd.block_ms()) {
+      this->next_say(Message::Type::SimpleError, "CROSSSLOT Keys in request don't hash to the same slot");
+      return true;
+    }
+
+    auto sequence = this->add_reply(by_shard.size(), [positions = std::move(positions)](std::vector<Message> parts) {
+      auto merged = merge_arrays(std::move(parts));
+      if (merged.type() != Message::Type::Array) {
+        return merged;
+      }
+
+      auto& streams = std::get<std::vector<Message>>(merged.getValue());
+      std::sort(streams.begin(), streams.end(), [&positions](const Message& a, const Message& b) {
+        const auto& a_key = std::get<std::string>(std::get<std::vector<Message>>(a.getValue())[0].getValue());
+        const auto& b_key = std::get<std::string>(std::get<std::vector<Message>>(b.getValue())[0].getValue());
+        return positions.at(a_key) < positions.at(b_key);
+      });
+      return merged;
+    });
+
+    for (auto& [shard, request] : by_shard) {
+      this->forward_to(shard, XReadCommand(std::move(request), std::nullopt).construct(), sequence);
+    }
+    return true;
+  }
+
+  auto key = single_key(command);
+  if (!key) {
+    return false;
+  }
+
+  const auto shard = this->_shards->shard_of(key.value());
+  if (shard == this->_shard_id) {
+    return false;
+  }
+
+  this->forward_to(shard, std::move(message), this->add_reply(1));
+  return true;
+}
+
+std::size_t ServerTalker::add_reply(std::size_t parts, std::function<Message(std::vector<Message>)> merge) {
+  auto& reply = this->_replies.emplace_back();
+  reply.parts_left = parts;
+  reply.merge = std::move(merge);
+
+  return this->_replies_first + this->_replies.size() - 1;
+}
+
+void ServerTalker::forward_to(std::size_t shard, Message message, std::size_t sequence) {
+  this->_awaited[shard].push_back(sequence);
+  this->_forward[shard].push_back(std::move(message));
+}
+
+void ServerTalker::receive(std::size_t shard, std::vector<Message> replies) {
+  // a shard replies to the commands sent to it in the order they were sent
+  auto& awaited = this->_awaited[shard];
+  for (auto& message : replies) {
+    if (awaited.empty()) {
+      break;
+    }
+
+    auto& reply = this->_replies[awaited.front() - this->_replies_first];
+    awaited.pop_front();
+
+    reply.parts.push_back(std::move(message));
+    --reply.parts_left;
+  }
+
+  while (!this->_replies.empty() && this->_replies.front().parts_left == 0) {
+    auto& reply = this->_replies.front();
+    if (reply.merge) {
+      this->next_say(reply.merge(std::move(reply.parts)));
+    } else {
+      for (auto& part : reply.parts) {
+        this->next_say(std::move(part));
+      }
+    }
+
+    this->_replies.pop_front();
+    ++this->_replies_first;
+  }
+}
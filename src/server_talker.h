@@ -1,5 +1,7 @@
 #pragma once
 
+#include "persistence.h"
+#include "shards.h"
 #include "signal_slot.h"
 #include "storage_middleware.h"
 #include "talker.h"
@@ -8,26 +10,62 @@
 #include "events.h"
 #include "server.h"
 
-class ServerTalker : public Talker {
+#include <deque>
+#include <functional>
+#include <vector>
+
+class ServerTalker : public Talker, public std::enable_shared_from_this<ServerTalker> {
 public:
   ServerTalker(EventLoopPtr event_loop);
 
-  void listen(Message message) override;
+  void listen(Message message, std::string_view raw) override;
   void interrupt() override;
+  void batch_finished() override;
 
   Message::Type expected() override;
 
   void set_server(ServerPtr);
   void set_storage(IStoragePtr);
   void set_replicas_manager(IReplicasManagerPtr);
+  void set_persistence(IPersistencePtr);
+  // Sharded mode: commands for keys of other shards run there, replies still come in command order.
+  void set_shards(Shards*, std::size_t shard_id);
 
 private:
+  // Reply to a command whose parts come from the shards which ran it, `merge` combines
+  // the parts of a command spread over several.
+  struct Reply {
+    std::size_t parts_left = 0;
+    std::vector<Message> parts;
+    std::function<Message(std::vector<Message>)> merge;
+  };
+
   ServerPtr _server;
   IStoragePtr _storage;
   IReplicasManagerPtr _replicas_manager;
+  IPersistencePtr _persistence;
 
   EventLoopPtr _event_loop;
 
   std::optional<ReplicaId> _replica_id;
   SlotPtr<Message> _slot_message;
+
+  Shards* _shards = nullptr; // owned by main, outlives every talker
+  std::size_t _shard_id = 0;
+  std::optional<RemoteClientId> _remote_client_id;
+  std::vector<bool> _proxied; // shards holding a talker for this client
+
+  // Once a reply is awaited from another shard, replies made here queue up behind it.
+  std::deque<Reply> _replies;
+  std::size_t _replies_first = 0; // sequence number of _replies.front()
+  std::vector<std::deque<std::size_t>> _awaited; // per shard, sequence numbers of the replies it owes
+  std::vector<std::vector<Message>> _forward; // per shard, commands of the current batch
+
+  void execute(CommandPtr command);
+
+  // Returns false when the command runs here.
+  bool forward(Command& command, Message& message);
+  std::size_t add_reply(std::size_t parts, std::function<Message(std::vector<Message>)> merge = {});
+  void forward_to(std::size_t shard, Message message, std::size_t sequence);
+  void receive(std::size_t shard, std::vector<Message> replies);
 };
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "shards.h"
+
+#include "debug.h"
+#include "mapped_file.h"
+#include "rdb_parser.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// CRC16-CCITT (XMODEM), the one Redis Cluster hashes keys with
+constexpr std::array<std::uint16_t, 256> CRC16_TABLE = []() {
+  std::array<std::uint16_t, 256> table{};
+  for (std::uint16_t i = 0; i < 256; ++i) {
+    std::uint16_t crc = i << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+std::uint16_t crc16(std::string_view data) {
+  std::uint16_t crc = 0;
+  for (unsigned char byte : data) {
+    crc = (crc << 8) ^ CRC16_TABLE[((crc >> 8) ^ byte) & 0xff];
+  }
+  return crc;
+}
+
+// Routes every entry of the startup load to the keyspace of the shard owning its key.
+class ShardedRestore : public IRDBParserListener {
+public:
+  ShardedRestore(Shards& shards)
+    : _shards(shards)
+  {
+  }
+
+  void restore(std::string key, std::string value, std::optional<Timepoint> expire_time) override {
+    auto storage = this->_shards.at(this->_shards.shard_of(key)).storage();
+    storage->restore(std::move(key), std::move(value), expire_time);
+  }
+
+  void restore_stream(std::string key, RDBStream stream) override {
+    auto storage = this->_shards.at(this->_shards.shard_of(key)).storage();
+    storage->restore_stream(std::move(key), std::move(stream));
+  }
+
+  void restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) override {
+    auto storage = this->_shards.at(this->_shards.shard_of(key)).storage();
+    storage->restore_aggregate(std::move(key), std::move(value), expire_time);
+  }
+
+  void resize_db(std::size_t keys, std::size_t expires) override {
+    for (std::size_t i = 0; i < this->_shards.count(); ++i) {
+      this->_shards.at(i).storage()->resize_db(keys / this->_shards.count() + 1, expires / this->_shards.count() + 1);
+    }
+  }
+
+private:
+  Shards& _shards;
+};
+
+} // namespace
+
+std::size_t key_hash_slot(std::string_view key) {
+  auto open = key.find('{');
+  if (open != key.npos) {
+    auto close = key.find('}', open + 1);
+    if (close != key.npos && close != open + 1) {
+      key = key.substr(open + 1, close - open - 1);
+    }
+  }
+
+  return crc16(key) & (HASH_SLOTS - 1);
+}
+
+Shard::Shard(std::size_t id)
+  : _id(id)
+{
+  this->_event_loop = EventLoop::make();
+  this->_poller = std::make_shared<Poller>(this->_event_loop);
+  this->_storage = std::make_shared<Storage>(this->_event_loop);
+  this->_handlers_manager = std::make_shared<HandlersManager>(this->_event_loop);
+
+  this->_handlers_manager->new_fd()->connect(this->_poller->add_fd());
+  this->_handlers_manager->removed_fd()->connect(this->_poller->remove_fd());
+
+  this->_remote_handle = this->_event_loop->repeat([this]() {
+    for (auto it = this->_remote_waiting.begin(); it != this->_remote_waiting.end();) {
+      auto client_it = this->_remote_clients.find(*it);
+      if (client_it == this->_remote_clients.end() || !this->run_remote(client_it->second)) {
+        it = this->_remote_waiting.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    // clients with queued commands go on next iteration, sockets or not
+    if (!this->_remote_waiting.empty()) {
+      this->_event_loop->keep_awake();
+    }
+  });
+}
+
+Shard::~Shard() {
+  this->stop();
+}
+
+std::size_t Shard::id() const {
+  return this->_id;
+}
+
+EventLoopPtr& Shard::event_loop() {
+  return this->_event_loop;
+}
+
+IStoragePtr Shard::storage() {
+  return this->_storage;
+}
+
+HandlersMangerPtr& Shard::handlers_manager() {
+  return this->_handlers_manager;
+}
+
+void Shard::set_remote_talker(TalkerBuilder builder) {
+  this->_remote_talker_builder = std::move(builder);
+}
+
+void Shard::listen(int port, int backlog) {
+  this->_listener = std::make_shared<Listener>(this->_event_loop, port, backlog, true);
+  this->_listener->new_server_fd()->connect(this->_poller->add_fd());
+  this->_listener->removed_server_fd()->connect(this->_poller->remove_fd());
+  this->_listener->new_fd()->connect(this->_handlers_manager->add_fd());
+}
+
+void Shard::post(EventLoop::Func func) {
+  this->_event_loop->post_threadsafe(std::move(func));
+}
+
+void Shard::serve_remote(RemoteClientId id, std::vector<Message> messages, RemoteReply reply) {
+  auto it = this->_remote_clients.find(id);
+  if (it == this->_remote_clients.end()) {
+    it = this->_remote_clients.emplace(id, RemoteClient{
+      .talker = this->_remote_talker_builder(),
+      .reply = std::move(reply),
+      .queued = {}}).first;
+  }
+
+  auto& client = it->second;
+  std::move(messages.begin(), messages.end(), std::back_inserter(client.queued));
+
+  if (!client.blocked && this->run_remote(client)) {
+    this->_remote_waiting.insert(id);
+  }
+}
+
+void Shard::drop_remote(RemoteClientId id) {
+  auto it = this->_remote_clients.find(id);
+  if (it == this->_remote_clients.end()) {
+    return;
+  }
+
+  it->second.talker->interrupt();
+  this->_remote_clients.erase(it);
+  this->_remote_waiting.erase(id);
+}
+
+bool Shard::run_remote(RemoteClient& client) {
+  std::vector<Message> replies;
+  auto collect = [&client, &replies]() {
+    while (auto message = client.talker->say()) {
+      replies.push_back(std::move(message.value()));
+      client.blocked = false;
+    }
+  };
+
+  collect();
+  while (!client.blocked && !client.queued.empty()) {
+    auto message = std::move(client.queued.front());
+    client.queued.pop_front();
+
+    // every command has exactly one reply, it is blocked until that comes
+    client.blocked = true;
+    client.talker->listen(std::move(message), {});
+    collect();
+  }
+
+  if (!replies.empty()) {
+    client.reply(std::move(replies));
+  }
+
+  return client.blocked;
+}
+
+void Shard::start() {
+  this->_thread = std::thread([this]() {
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Shard " << this->_id << " started" << std::endl;
+    this->_event_loop->start();
+  });
+}
+
+void Shard::stop() {
+  if (this->_thread.joinable()) {
+    this->_event_loop->stop();
+    this->_thread.join();
+  }
+}
+
+void Shard::join() {
+  if (this->_thread.joinable()) {
+    this->_thread.join();
+  }
+}
+
+Shards::Shards(std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    this->_shards.push_back(std::make_unique<Shard>(i));
+  }
+
+  this->_slot_add = std::make_shared<Slot<int>>([this](int fd) {
+    auto& shard = *this->_shards[this->_next_client_shard];
+    this->_next_client_shard = (this->_next_client_shard + 1) % this->_shards.size();
+
+    shard.post([&shard, fd]() {
+      shard.handlers_manager()->add_fd()->call(fd);
+    });
+  });
+}
+
+Shards::~Shards() {
+  // every thread stops before any shard goes, jobs in flight may still point at the others
+  for (auto& shard : this->_shards) {
+    shard->event_loop()->stop();
+  }
+  for (auto& shard : this->_shards) {
+    shard->stop();
+  }
+}
+
+std::size_t Shards::count() const {
+  return this->_shards.size();
+}
+
+Shard& Shards::at(std::size_t id) {
+  return *this->_shards[id];
+}
+
+std::size_t Shards::shard_of(std::string_view key) const {
+  // contiguous slot ranges, as a cluster of this many nodes would split them
+  return key_hash_slot(key) * this->_shards.size() / HASH_SLOTS;
+}
+
+RemoteClientId Shards::next_remote_client_id() {
+  return this->_next_remote_client_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+SlotPtr<int>& Shards::add_fd() {
+  return this->_slot_add;
+}
+
+void Shards::load(ServerInfo& info) {
+  const auto path = info.server.db_file_path();
+  if (!std::filesystem::exists(path)) {
+    return;
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+
+  MappedFile file(path);
+  RDBLoader loader(file.data(), info.persistence.rdb_checksum);
+  ShardedRestore target(*this);
+
+  try {
+    while (!loader.step(target, std::chrono::milliseconds(100))) {
+      std::this_thread::yield();
+    }
+  } catch (const std::exception& e) {
+    std::ostringstream ss;
+    ss << "Error loading " << path.string() << ": " << e.what();
+    throw std::runtime_error(ss.str());
+  }
+
+  auto& persistence = info.persistence;
+  persistence.rdb_last_load_keys_loaded = loader.progress().keys_loaded;
+  persistence.rdb_last_load_keys_expired = loader.progress().keys_expired;
+  persistence.rdb_last_load_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Dataset loaded into " << this->_shards.size() << " shards in " << persistence.rdb_last_load_duration_ms.value() << "ms" << std::endl;
+}
+
+void Shards::start() {
+  for (auto& shard : this->_shards) {
+    shard->start();
+  }
+}
+
+void Shards::join() {
+  for (auto& shard : this->_shards) {
+    shard->join();
+  }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "events.h"
+#include "handlers_manager.h"
+#include "listener.h"
+#include "message.h"
+#include "poller.h"
+#include "server.h"
+#include "signal_slot.h"
+#include "storage.h"
+#include "talker.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+constexpr std::size_t HASH_SLOTS = 16384;
+
+// Slot of a key as in Redis Cluster: CRC16 of the key, or of the part inside its first
+// non empty {...} so that keys sharing such a hash tag always land on the same shard.
+std::size_t key_hash_slot(std::string_view key);
+
+using RemoteClientId = std::uint64_t;
+// Takes the replies to forwarded commands, called on the shard which ran them.
+using RemoteReply = std::function<void(std::vector<Message>)>;
+
+// One event loop thread owning a range of hash slots: its own keyspace and its own clients.
+// Nothing of it is shared with other threads but `post`.
+class Shard {
+public:
+  using TalkerBuilder = std::function<TalkerPtr()>;
+
+  Shard(std::size_t id);
+  ~Shard();
+
+  std::size_t id() const;
+  EventLoopPtr& event_loop();
+  IStoragePtr storage();
+  HandlersMangerPtr& handlers_manager();
+
+  // Talker running the commands clients of other shards send for keys of this one.
+  void set_remote_talker(TalkerBuilder);
+
+  // A SO_REUSEPORT listener of the shard's own, connections it accepts are served here.
+  void listen(int port, int backlog);
+
+  // Any thread: the job runs on this shard's loop, jobs of one thread run in the order posted.
+  void post(EventLoop::Func);
+
+  // Commands of a client of another shard, run in arrival order by a talker kept for that
+  // client. Replies go back through `reply` in the same order: as for a blocked client,
+  // commands after one without a reply yet (a blocked XREAD) wait until it has one.
+  void serve_remote(RemoteClientId, std::vector<Message> messages, RemoteReply reply);
+  void drop_remote(RemoteClientId);
+
+  void start();
+  void stop();
+  // returns once the loop thread has stopped
+  void join();
+
+private:
+  struct RemoteClient {
+    TalkerPtr talker;
+    RemoteReply reply;
+    bool blocked = false;
+    std::deque<Message> queued;
+  };
+
+  std::size_t _id;
+
+  EventLoopPtr _event_loop;
+  PollerPtr _poller;
+  std::shared_ptr<Storage> _storage;
+  HandlersMangerPtr _handlers_manager;
+  ListenerPtr _listener;
+  TalkerBuilder _remote_talker_builder;
+
+  std::unordered_map<RemoteClientId, RemoteClient> _remote_clients;
+  std::unordered_set<RemoteClientId> _remote_waiting;
+
+  EventLoop::JobHandle _remote_handle;
+
+  std::thread _thread;
+
+  // runs queued commands until one blocks and sends the replies, returns whether it is blocked
+  bool run_remote(RemoteClient&);
+};
+
+class Shards {
+public:
+  Shards(std::size_t count);
+  ~Shards();
+
+  std::size_t count() const;
+  Shard& at(std::size_t);
+  std::size_t shard_of(std::string_view key) const;
+
+  RemoteClientId next_remote_client_id();
+
+  // Connections accepted by the main loop, dealt to the shards round robin.
+  SlotPtr<int>& add_fd();
+
+  // Startup load of the RDB straight into the shards' keyspaces, before their threads run.
+  void load(ServerInfo&);
+
+  void start();
+  // blocks for as long as the shard threads run
+  void join();
+
+private:
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::atomic<RemoteClientId> _next_remote_client_id = 0;
+  std::size_t _next_client_shard = 0;
+
+  SlotPtr<int> _slot_add;
+};
+using ShardsPtr = std::shared_ptr<Shards>;
@@ -1,14 +1,46 @@
 #pragma once
 
-#include <functional>
+#include "inline_function.h"
+
 #include <memory>
 #include <type_traits>
 #include <vector>
 
+// Non owning callback bound to a member function at compile time: one indirect call, no
+// allocation and no lifetime tracking. Whoever registers one disconnects it explicitly before
+// the object goes, so it fits hot paths with a clear owner, as sockets in the poller.
+template <typename... Args>
+class Callback {
+public:
+  Callback() = default;
+
+  template <auto Method, typename T>
+  static Callback bind(T* object) {
+    Callback callback;
+    callback._object = object;
+    callback._func = [](void* object, const Args&... args) {
+      (static_cast<T*>(object)->*Method)(args...);
+    };
+    return callback;
+  }
+
+  void operator()(const Args&... args) const {
+    this->_func(this->_object, args...);
+  }
+
+  explicit operator bool() const {
+    return this->_func != nullptr;
+  }
+
+private:
+  void* _object = nullptr;
+  void (*_func)(void*, const Args&...) = nullptr;
+};
+
 template <typename... Args>
 class Slot : public std::enable_shared_from_this<Slot<Args...>> {
 public:
-  using ProvidedFunc = std::function<void(Args...)>;
+  using ProvidedFunc = InlineFunction<void(const Args&...), 32>;
 
   template <typename F>
   explicit Slot(F func)
@@ -27,54 +59,31 @@ private:
 template <typename... Args>
 using SlotPtr = std::shared_ptr<Slot<Args...>>;
 
+// Connections to slots or further signals, each held by a weak pointer: components connect
+// once at wiring and may go in any order.
 template <typename... Args>
 class Signal : public std::enable_shared_from_this<Signal<Args...>> {
-  struct SlotContainerBase {
-    virtual ~SlotContainerBase() = default;
-    virtual void call(const Args&...) const = 0;
-  };
-
-  template <typename Slot>
-  struct SlotContainer : public SlotContainerBase {
-    Slot slot;
-
-    SlotContainer(Slot slot)
-      : slot(std::move(slot)) {
-    }
-
-    void call(const Args&... args) const override {
-      this->slot.call(args...);
-    }
-  };
-
-  template <typename Slot>
-  struct SlotContainer<std::shared_ptr<Slot>> : public SlotContainerBase {
-    std::weak_ptr<Slot> slot_wptr;
-
-    SlotContainer(std::shared_ptr<Slot> slot_ptr)
-      : slot_wptr(slot_ptr) {
-    }
-
-    void call(const Args&... args) const override {
-      if (auto ptr = this->slot_wptr.lock()) {
-        ptr->call(args...);
-      }
-    }
+  struct Connection {
+    std::weak_ptr<void> target;
+    Callback<Args...> call;
   };
 
-  using SlotContainerBasePtr = std::unique_ptr<SlotContainerBase>;
-
 public:
-  using ExpectedFunc = std::function<void(Args...)>;
-
-  template <typename Slot>
-  void connect(Slot slot) {
-    this->_slots.push_back(std::make_unique<SlotContainer<Slot>>(std::move(slot)));
+  template <typename Target>
+  void connect(const std::shared_ptr<Target>& target) {
+    this->_connections.push_back(Connection{
+      .target = target,
+      .call = Callback<Args...>::template bind<&Target::call>(target.get())});
   }
 
   void emit(const Args&... args) const {
-    for (const auto& slot: this->_slots) {
-      slot->call(args...);
+    // by index, a slot may connect more while called
+    for (std::size_t i = 0; i < this->_connections.size(); ++i) {
+      const auto& connection = this->_connections[i];
+      if (auto target = connection.target.lock()) {
+        auto call = connection.call;
+        call(args...);
+      }
     }
   }
 
@@ -83,7 +92,7 @@ public:
   }
 
 private:
-  std::vector<SlotContainerBasePtr> _slots;
+  std::vector<Connection> _connections;
 };
 
 template <typename... Args>
@@ -1,6 +1,7 @@
 #include "storage.h"
 
 #include "debug.h"
+#include "rdb_writer.h"
 #include "utils.h"
 
 #include <algorithm>
@@ -12,6 +13,10 @@ std::string to_string(StorageType type) {
     case StorageType::None: return "none";
     case StorageType::String: return "string";
     case StorageType::Stream: return "stream";
+    case StorageType::List: return "list";
+    case StorageType::Set: return "set";
+    case StorageType::ZSet: return "zset";
+    case StorageType::Hash: return "hash";
   }
 
   throw std::runtime_error("unknown type of StorageType");
@@ -27,6 +32,8 @@ std::string to_string(StreamErrorType type) {
       return "ERR The ID specified in XADD is equal or smaller than the target stream top item";
     case StreamErrorType::WrongKeyType:
       return "WRONGTYPE Operation against a key holding the wrong kind of value";
+    case StreamErrorType::NoSuchKey:
+      return "ERR no such key";
   }
 
   throw std::runtime_error("unknown type of StreamErrorType");
@@ -219,7 +226,7 @@ StorageType Value::type() const {
 }
 
 StringValue::StringValue(std::string data)
-  : _data(data)
+  : _data(std::move(data))
   , _create_time(Clock::now())
 {
   this->_type = StorageType::String;
@@ -241,6 +248,29 @@ std::optional<Timepoint> StringValue::getExpire() const {
   return this->_expire_time;
 }
 
+AggregateValue::AggregateValue(RDBAggregate data)
+  : _data(std::move(data))
+{
+  switch (this->_data.type) {
+    case RDBAggregate::Type::List: this->_type = StorageType::List; break;
+    case RDBAggregate::Type::Set: this->_type = StorageType::Set; break;
+    case RDBAggregate::Type::ZSet: this->_type = StorageType::ZSet; break;
+    case RDBAggregate::Type::Hash: this->_type = StorageType::Hash; break;
+  }
+}
+
+const RDBAggregate& AggregateValue::data() const {
+  return this->_data;
+}
+
+void AggregateValue::setExpireTime(Timepoint tp) {
+  this->_expire_time = tp;
+}
+
+std::optional<Timepoint> AggregateValue::getExpire() const {
+  return this->_expire_time;
+}
+
 StreamValue::StreamValue() {
   this->_type = StorageType::Stream;
 }
@@ -252,7 +282,7 @@ std::tuple<StreamId, StreamErrorType> StreamValue::append(InputStreamId in_id, S
 
   StreamId id;
   if (this->_data.size() > 0) {
-    auto last_id = this->_data.rbegin()->first;
+    auto last_id = this->_last_id;
 
     if (in_id.general_wildcard) {
       std::size_t next_ms = duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
@@ -290,10 +320,29 @@ std::tuple<StreamId, StreamErrorType> StreamValue::append(InputStreamId in_id, S
     id = StreamId{in_id.ms, in_id.id};
   }
 
+  if (this->_data.size() == 0) {
+    this->_first_id = id;
+  }
+  this->_last_id = id;
+  ++this->_entries_added;
+  this->_memory_bytes += entry_memory_bytes(values);
+
   this->_data.emplace_hint(this->_data.end(), id, std::move(values));
   return {id, StreamErrorType::None};
 }
 
+void StreamValue::restore(RDBStream stream) {
+  for (auto& [id, values] : stream.entries) {
+    this->_memory_bytes += entry_memory_bytes(values);
+    this->_data.emplace_hint(this->_data.end(), StreamId{id.ms, id.seq}, std::move(values));
+  }
+
+  this->_last_id = StreamId{stream.last_id.ms, stream.last_id.seq};
+  this->_first_id = StreamId{stream.first_id.ms, stream.first_id.seq};
+  this->_max_deleted_id = StreamId{stream.max_deleted_id.ms, stream.max_deleted_id.seq};
+  this->_entries_added = stream.entries_added;
+}
+
 StreamRange StreamValue::xrange(BoundStreamId left_id, BoundStreamId right_id) {
   StreamRange::Iterator begin_it;
   StreamRange::Iterator end_it;
@@ -329,12 +378,33 @@ StreamRange StreamValue::xread(ReadStreamId id) {
   return {begin_it, this->_data.end()};
 }
 
-StreamId StreamValue::last_id() {
-  if (this->_data.size() == 0) {
-    return {};
-  }
+StreamId StreamValue::last_id() const {
+  return this->_last_id;
+}
+
+std::size_t StreamValue::length() const {
+  return this->_data.size();
+}
+
+StreamInfo StreamValue::info() const {
+  return StreamInfo{
+    .length = this->_data.size(),
+    .memory_bytes = this->_memory_bytes,
+    .entries_added = this->_entries_added,
+    .last_generated_id = this->_last_id,
+    .max_deleted_entry_id = this->_max_deleted_id,
+    .recorded_first_entry_id = this->_first_id,
+    .entries = {this->_data.cbegin(), this->_data.cend()},
+  };
+}
 
-  return this->_data.rbegin()->first;
+std::size_t StreamValue::entry_memory_bytes(const StreamPartValue& values) {
+  // rough estimate of one map node: key, value vector and the tree links
+  std::size_t bytes = sizeof(StreamDataType::value_type) + 4 * sizeof(void*);
+  for (const auto& [key, value] : values) {
+    bytes += sizeof(StreamPartValue::value_type) + key.capacity() + value.capacity();
+  }
+  return bytes;
 }
 
 Storage::WaitHandle::WaitHandle(Storage& parent, StreamsReadRequest request, std::size_t timeout_ms, std::function<void(StreamsReadResult)> callback)
@@ -381,21 +451,50 @@ Storage::Storage(EventLoopPtr event_loop)
 }
 
 void Storage::restore(std::string key, std::string value, std::optional<Timepoint> expire_time) {
-  auto ptr = std::make_unique<StringValue>(value);
+  auto ptr = std::make_unique<StringValue>(std::move(value));
+  if (expire_time) {
+    ptr->setExpireTime(expire_time.value());
+  }
+
+  this->before_insert();
+  this->_storage.insert_or_assign(std::move(key), std::move(ptr));
+}
+
+void Storage::restore_stream(std::string key, RDBStream stream) {
+  auto ptr = std::make_unique<StreamValue>();
+  ptr->restore(std::move(stream));
+
+  this->before_insert();
+  this->_storage.insert_or_assign(std::move(key), std::move(ptr));
+}
+
+void Storage::restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) {
+  auto ptr = std::make_unique<AggregateValue>(std::move(value));
   if (expire_time) {
     ptr->setExpireTime(expire_time.value());
   }
 
-  this->_storage.insert_or_assign(key, std::move(ptr));
+  this->before_insert();
+  this->_storage.insert_or_assign(std::move(key), std::move(ptr));
+}
+
+// buckets for the whole database up front, no rehashing while it is loaded
+void Storage::resize_db(std::size_t keys, std::size_t /* expires */) {
+  if (this->_open_scans > 0) {
+    return;
+  }
+
+  this->_storage.reserve(this->_storage.size() + keys);
 }
 
 void Storage::set(std::string key, std::string value, std::optional<int> expire_ms) {
-  auto ptr = std::make_unique<StringValue>(value);
+  auto ptr = std::make_unique<StringValue>(std::move(value));
   if (expire_ms) {
     ptr->setExpire(std::chrono::milliseconds{expire_ms.value()});
   }
 
-  this->_storage.insert_or_assign(key, std::move(ptr));
+  this->before_insert();
+  this->_storage.insert_or_assign(std::move(key), std::move(ptr));
 }
 
 std::optional<std::string> Storage::get(std::string key) {
@@ -435,13 +534,15 @@ std::tuple<StreamId, StreamErrorType> Storage::xadd(std::string key, InputStream
     auto ptr = std::make_unique<StreamValue>();
     result = ptr->append(id, std::move(values));
     if (std::get<1>(result) == StreamErrorType::None) {
+      this->before_insert();
       this->_storage.emplace(key, std::move(ptr));
     }
   }
 
-  if (std::get<1>(result) == StreamErrorType::None) {
+  auto waitlist_it = this->_stream_waitlists.find(key);
+  if (std::get<1>(result) == StreamErrorType::None && waitlist_it != this->_stream_waitlists.end() && !waitlist_it->second.empty()) {
     std::list<std::weak_ptr<WaitHandle>> handles;
-    for (auto ptr: this->_stream_waitlists[key]) {
+    for (auto ptr: waitlist_it->second) {
       handles.emplace_back(ptr);
     }
 
@@ -495,6 +596,52 @@ void Storage::xread(StreamsReadRequest request, std::optional<std::size_t> block
   }
 }
 
+std::tuple<std::size_t, StreamErrorType> Storage::xlen(std::string key) {
+  auto it = this->_storage.find(key);
+  if (it == this->_storage.end()) {
+    return {0, StreamErrorType::None};
+  }
+
+  if (it->second->type() != StorageType::Stream) {
+    return {0, StreamErrorType::WrongKeyType};
+  }
+
+  auto& stored = static_cast<StreamValue&>(*it->second);
+  return {stored.length(), StreamErrorType::None};
+}
+
+std::tuple<StreamInfo, StreamErrorType> Storage::xinfo(std::string key) {
+  auto it = this->_storage.find(key);
+  if (it == this->_storage.end()) {
+    return {StreamInfo{}, StreamErrorType::NoSuchKey};
+  }
+
+  if (it->second->type() != StorageType::Stream) {
+    return {StreamInfo{}, StreamErrorType::WrongKeyType};
+  }
+
+  auto& stored = static_cast<StreamValue&>(*it->second);
+  return {stored.info(), StreamErrorType::None};
+}
+
+bool Storage::expire_at(std::string key, Timepoint expire_time) {
+  auto it = this->_storage.find(key);
+  if (it == this->_storage.end()) {
+    return false;
+  }
+
+  auto& value = *it->second;
+  if (value.type() == StorageType::String) {
+    static_cast<StringValue&>(value).setExpireTime(expire_time);
+    return true;
+  } else if (value.type() == StorageType::Stream) {
+    return false;
+  }
+
+  static_cast<AggregateValue&>(value).setExpireTime(expire_time);
+  return true;
+}
+
 StorageType Storage::type(std::string key) {
   auto it = this->_storage.find(key);
   if (it == this->_storage.end()) {
@@ -515,3 +662,104 @@ std::vector<std::string> Storage::keys(std::string_view selector) const {
 
   return keys;
 }
+
+struct Storage::ScanHandle : public IKeyScan {
+  ScanHandle(Storage&);
+  ~ScanHandle() override;
+
+  bool next(std::size_t count, std::vector<std::string>& keys) override;
+  std::size_t total() const override;
+
+  Storage& parent;
+
+  std::size_t bucket = 0;
+  std::size_t buckets;
+  std::size_t keys_at_start;
+};
+
+Storage::ScanHandle::ScanHandle(Storage& parent)
+  : parent(parent)
+  // an empty table may get its first buckets on insert whatever the load factor, there is nothing to walk anyway
+  , buckets(parent._storage.empty() ? 0 : parent._storage.bucket_count())
+  , keys_at_start(parent._storage.size()) {
+  if (this->parent._open_scans++ == 0) {
+    this->parent._max_load_factor = this->parent._storage.max_load_factor();
+  }
+}
+
+// the table catches up with the inserts made meanwhile in one go
+Storage::ScanHandle::~ScanHandle() {
+  if (--this->parent._open_scans == 0) {
+    this->parent._storage.max_load_factor(this->parent._max_load_factor);
+    this->parent._storage.rehash(0);
+  }
+}
+
+bool Storage::ScanHandle::next(std::size_t count, std::vector<std::string>& keys) {
+  const auto& storage = this->parent._storage;
+
+  std::size_t added = 0;
+  while (added < count && this->bucket < this->buckets) {
+    for (auto it = storage.begin(this->bucket), end = storage.end(this->bucket); it != end; ++it) {
+      keys.emplace_back(it->first);
+      ++added;
+    }
+    ++this->bucket;
+  }
+
+  return this->bucket < this->buckets;
+}
+
+std::size_t Storage::ScanHandle::total() const {
+  return this->keys_at_start;
+}
+
+IKeyScanPtr Storage::scan() {
+  return std::make_unique<ScanHandle>(*this);
+}
+
+bool Storage::dump(const std::string& key, RDBWriter& writer) {
+  auto it = this->_storage.find(key);
+  if (it == this->_storage.end()) {
+    return false;
+  }
+
+  if (it->second->type() == StorageType::Stream) {
+    writer.stream_entry(key, static_cast<StreamValue&>(*it->second).info());
+    return true;
+  }
+
+  if (it->second->type() != StorageType::String) {
+    auto& aggregate = static_cast<AggregateValue&>(*it->second);
+    if (aggregate.getExpire() && Clock::now() >= aggregate.getExpire()) {
+      return false;
+    }
+
+    writer.aggregate_entry(key, aggregate.data(), aggregate.getExpire());
+    return true;
+  }
+
+  auto& str = static_cast<StringValue&>(*it->second);
+  if (str.getExpire() && Clock::now() >= str.getExpire()) {
+    return false;
+  }
+
+  writer.string_entry(key, str.data(), str.getExpire());
+  return true;
+}
+
+void Storage::clear() {
+  this->_storage.clear();
+}
+
+// Open scans walk the buckets by index, an insert over the load factor would rehash the table
+// under them. The load factor is raised instead and put back when the last scan is closed.
+void Storage::before_insert() {
+  if (this->_open_scans == 0) {
+    return;
+  }
+
+  if (this->_storage.size() + 1 > this->_storage.max_load_factor() * this->_storage.bucket_count()) {
+    this->_storage.max_load_factor(this->_storage.max_load_factor() * 2);
+  }
+}
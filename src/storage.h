@@ -13,11 +13,18 @@
 #include <string_view>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+class RDBWriter;
 
 enum class StorageType {
   None,
   String,
   Stream,
+  List,
+  Set,
+  ZSet,
+  Hash,
 };
 
 std::string to_string(StorageType type);
@@ -27,6 +34,7 @@ enum class StreamErrorType {
   MustBeNotZeroId,
   MustBeMoreThanTop,
   WrongKeyType,
+  NoSuchKey,
 };
 
 std::string to_string(StreamErrorType type);
@@ -107,6 +115,35 @@ private:
 using StreamsReadRequest = std::vector<std::pair<std::string, ReadStreamId>>;
 using StreamsReadResult = std::vector<std::pair<std::string, StreamRange>>;
 
+// Stream metadata, kept up to date on every append so that XLEN/XINFO never scan entries.
+struct StreamInfo {
+  std::size_t length = 0;
+  std::size_t memory_bytes = 0;
+  std::size_t entries_added = 0;
+  std::size_t groups = 0;
+
+  StreamId last_generated_id;
+  StreamId max_deleted_entry_id;
+  StreamId recorded_first_entry_id;
+
+  StreamRange entries;
+};
+
+// A walk over the keyspace in steps, with other commands served in between. Every key present
+// for the whole walk is visited exactly once, keys added or removed meanwhile may be visited or not.
+// It must not outlive the storage it was opened on.
+class IKeyScan {
+public:
+  virtual ~IKeyScan() = default;
+
+  // Appends the keys of the next buckets, at least `count` unless the end comes first.
+  // Returns false once the whole keyspace was visited.
+  virtual bool next(std::size_t count, std::vector<std::string>& keys) = 0;
+  // keys in the storage when the walk started
+  virtual std::size_t total() const = 0;
+};
+using IKeyScanPtr = std::unique_ptr<IKeyScan>;
+
 class IStorage : public IRDBParserListener {
 public:
   virtual ~IStorage() = default;
@@ -117,11 +154,21 @@ public:
   virtual std::tuple<StreamId, StreamErrorType> xadd(std::string key, InputStreamId id, StreamPartValue values) = 0;
   virtual StreamRange xrange(std::string key, BoundStreamId left_id, BoundStreamId right_id) = 0;
   virtual void xread(StreamsReadRequest, std::optional<std::size_t> block_ms, std::function<void(StreamsReadResult)> callback) = 0;
+  virtual std::tuple<std::size_t, StreamErrorType> xlen(std::string key) = 0;
+  virtual std::tuple<StreamInfo, StreamErrorType> xinfo(std::string key) = 0;
+
+  // Sets the deadline of a string or aggregate, returns false when there is no such key or it is a stream.
+  virtual bool expire_at(std::string key, Timepoint expire_time) = 0;
 
   virtual StorageType type(std::string key) = 0;
 
   virtual std::vector<std::string> keys(std::string_view selector) const = 0;
+  virtual IKeyScanPtr scan() = 0;
 
+  // Writes the key as an RDB entry, returns false when there is nothing to write.
+  virtual bool dump(const std::string& key, RDBWriter& writer) = 0;
+
+  virtual void clear() = 0;
 };
 using IStoragePtr = std::shared_ptr<IStorage>;
 
@@ -152,22 +199,50 @@ private:
   std::optional<Timepoint> _expire_time;
 };
 
+// Lists, sets, sorted sets and hashes loaded from RDB, kept in their compact encoding.
+class AggregateValue : public Value {
+public:
+  AggregateValue(RDBAggregate data);
+
+  const RDBAggregate& data() const;
+
+  void setExpireTime(Timepoint tp);
+  std::optional<Timepoint> getExpire() const;
+
+private:
+  RDBAggregate _data;
+  std::optional<Timepoint> _expire_time;
+};
+
 class StreamValue : public Value {
 public:
   StreamValue();
 
   std::tuple<StreamId, StreamErrorType> append(InputStreamId, StreamPartValue values);
+  void restore(RDBStream stream);
 
   StreamRange xrange(BoundStreamId left_id, BoundStreamId right_id);
   StreamRange xread(ReadStreamId id);
 
-  StreamId last_id();
+  StreamId last_id() const;
+  std::size_t length() const;
+  StreamInfo info() const;
 
 private:
   StreamDataType _data;
+
+  std::size_t _memory_bytes = 0;
+  std::size_t _entries_added = 0;
+  StreamId _last_id;
+  StreamId _first_id;
+  StreamId _max_deleted_id;
+
+  static std::size_t entry_memory_bytes(const StreamPartValue&);
 };
 
 class Storage : public IStorage {
+  struct ScanHandle;
+
   struct WaitHandle;
   using WaitHandlePtr = std::shared_ptr<WaitHandle>;
   using WaitList = std::list<WaitHandlePtr>;
@@ -193,6 +268,9 @@ public:
   Storage(EventLoopPtr event_loop);
 
   void restore(std::string key, std::string value, std::optional<Timepoint> expire_time) override;
+  void restore_stream(std::string key, RDBStream stream) override;
+  void restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) override;
+  void resize_db(std::size_t keys, std::size_t expires) override;
 
   void set(std::string key, std::string value, std::optional<int> expire_ms) override;
   std::optional<std::string> get(std::string key) override;
@@ -200,15 +278,30 @@ public:
   std::tuple<StreamId, StreamErrorType> xadd(std::string key, InputStreamId id, StreamPartValue values) override;
   StreamRange xrange(std::string key, BoundStreamId left_id, BoundStreamId right_id) override;
   void xread(StreamsReadRequest, std::optional<std::size_t> block_ms, std::function<void(StreamsReadResult)> callback) override;
+  std::tuple<std::size_t, StreamErrorType> xlen(std::string key) override;
+  std::tuple<StreamInfo, StreamErrorType> xinfo(std::string key) override;
+
+  bool expire_at(std::string key, Timepoint expire_time) override;
 
   StorageType type(std::string key) override;
 
   std::vector<std::string> keys(std::string_view selector) const override;
+  IKeyScanPtr scan() override;
+
+  bool dump(const std::string& key, RDBWriter& writer) override;
+
+  void clear() override;
 
 private:
   EventLoopPtr _event_loop;
 
   std::unordered_map<std::string, ValuePtr> _storage;
 
+  // open scans walk `_storage` by bucket index, it is not rehashed until the last one is closed
+  std::size_t _open_scans = 0;
+  float _max_load_factor = 1.0;
+
   std::unordered_map<std::string, WaitList> _stream_waitlists;
+
+  void before_insert();
 };
@@ -2,9 +2,52 @@
 
 #include "command.h"
 #include "command_storage.h"
+#include "crc64.h"
 #include "debug.h"
+#include "intset.h"
+#include "listpack.h"
+#include "lzf.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+constexpr std::size_t SNAPSHOT_CHUNK_SIZE = 64 * 1024;
+constexpr std::size_t SNAPSHOT_SCAN_KEYS = 64;
+constexpr std::size_t SNAPSHOT_STREAM_LIMIT = 256 * 1024 * 1024;
+constexpr std::size_t SNAPSHOT_EOF_MARK_SIZE = 40;
+constexpr std::size_t REPL_COMPRESS_MIN_SIZE = 256;
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto written = ::write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data.remove_prefix(written);
+  }
+  return true;
+}
+
+} // namespace
+
+StorageMiddleware::SnapshotHandle::~SnapshotHandle() {
+  if (this->spill_fd >= 0) {
+    ::close(this->spill_fd);
+  }
+}
+
 StorageMiddleware::StorageMiddleware(EventLoopPtr event_loop)
   : _event_loop(event_loop) {
 }
@@ -13,15 +56,81 @@ void StorageMiddleware::set_storage(IStoragePtr storage) {
   this->_storage = storage;
 }
 
+void StorageMiddleware::set_server(ServerPtr server) {
+  this->_server = server;
+
+  const auto& replication = this->_server->info().replication;
+  this->_backlog = ReplicationBacklog(replication.repl_backlog_size);
+  this->_backlog.reset(replication.master_repl_offset);
+  this->_flushed_offset = this->_backlog.offset();
+}
+
+void StorageMiddleware::set_aof(AppendOnlyFilePtr aof) {
+  this->_aof = std::move(aof);
+}
+
+// Restores come from a full sync with the master, the log has to see them as well.
 void StorageMiddleware::restore(std::string key, std::string value, std::optional<Timepoint> expire_time) {
+  if (this->_aof) {
+    this->aof_set(key, value, expire_time);
+  }
+
   this->_storage->restore(key, value, expire_time);
 }
 
+void StorageMiddleware::restore_stream(std::string key, RDBStream stream) {
+  if (this->_aof) {
+    for (const auto& [id, values] : stream.entries) {
+      this->_aof_command.clear();
+      MessageEncoder encoder(this->_aof_command);
+      encoder.array(3 + 2 * values.size()).bulk("XADD").bulk(key).bulk(std::to_string(id.ms) + "-" + std::to_string(id.seq));
+      for (const auto& [field, value] : values) {
+        encoder.bulk(field).bulk(value);
+      }
+      this->_aof->feed(this->_aof_command);
+    }
+  }
+
+  this->_storage->restore_stream(std::move(key), std::move(stream));
+}
+
+void StorageMiddleware::restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) {
+  if (this->_aof) {
+    this->aof_aggregate(key, value, expire_time);
+  }
+
+  this->_storage->restore_aggregate(std::move(key), std::move(value), expire_time);
+}
+
+void StorageMiddleware::resize_db(std::size_t keys, std::size_t expires) {
+  this->_storage->resize_db(keys, expires);
+}
+
 void StorageMiddleware::set(std::string key, std::string value, std::optional<int> expire_ms) {
-  this->_storage->set(key, value, expire_ms);
+  this->_server->info().persistence.rdb_changes_since_last_save += 1;
+
+  const bool propagating = this->is_propagating();
+  if (!propagating && !this->_aof) {
+    this->_storage->set(std::move(key), std::move(value), expire_ms);
+    return;
+  }
+
+  if (expire_ms) {
+    if (propagating) {
+      this->start_propagate().array(5).bulk("SET").bulk(key).bulk(value).bulk("PX").bulk(std::to_string(expire_ms.value()));
+    }
+    if (this->_aof) {
+      this->aof_set(key, value, Clock::now() + std::chrono::milliseconds(expire_ms.value()));
+    }
+  } else {
+    this->start_propagate().array(3).bulk("SET").bulk(key).bulk(value);
+    if (this->_aof) {
+      this->_aof->feed(this->_propagate_buffer);
+    }
+  }
 
-  SetCommand command(key, value, expire_ms);
-  this->push(command.construct());
+  this->_storage->set(std::move(key), std::move(value), expire_ms);
+  this->propagate();
 }
 
 std::optional<std::string> StorageMiddleware::get(std::string key) {
@@ -29,7 +138,38 @@ std::optional<std::string> StorageMiddleware::get(std::string key) {
 }
 
 std::tuple<StreamId, StreamErrorType> StorageMiddleware::xadd(std::string key, InputStreamId id, StreamPartValue values) {
-  return this->_storage->xadd(std::move(key), std::move(id), std::move(values));
+  if (!this->is_propagating() && !this->_aof) {
+    auto result = this->_storage->xadd(std::move(key), std::move(id), std::move(values));
+    if (std::get<1>(result) == StreamErrorType::None) {
+      this->_server->info().persistence.rdb_changes_since_last_save += 1;
+    }
+    return result;
+  }
+
+  // values are moved into storage, so encode them before the id is known
+  const auto values_count = values.size();
+  this->_propagate_tail.clear();
+  MessageEncoder tail_encoder(this->_propagate_tail);
+  for (const auto& [field, value] : values) {
+    tail_encoder.bulk(field).bulk(value);
+  }
+
+  auto result = this->_storage->xadd(key, std::move(id), std::move(values));
+  if (std::get<1>(result) != StreamErrorType::None) {
+    return result;
+  }
+
+  this->_server->info().persistence.rdb_changes_since_last_save += 1;
+
+  // replicas get the id assigned here, never a wildcard
+  this->start_propagate().array(3 + 2 * values_count).bulk("XADD").bulk(key).bulk(std::get<0>(result).to_string());
+  this->_propagate_buffer.append(this->_propagate_tail);
+  if (this->_aof) {
+    this->_aof->feed(this->_propagate_buffer);
+  }
+  this->propagate();
+
+  return result;
 }
 
 StreamRange StorageMiddleware::xrange(std::string key, BoundStreamId left_id, BoundStreamId right_id) {
@@ -40,6 +180,18 @@ void StorageMiddleware::xread(StreamsReadRequest request, std::optional<std::siz
   return this->_storage->xread(std::move(request), block_ms, std::move(callback));
 }
 
+std::tuple<std::size_t, StreamErrorType> StorageMiddleware::xlen(std::string key) {
+  return this->_storage->xlen(std::move(key));
+}
+
+std::tuple<StreamInfo, StreamErrorType> StorageMiddleware::xinfo(std::string key) {
+  return this->_storage->xinfo(std::move(key));
+}
+
+bool StorageMiddleware::expire_at(std::string key, Timepoint expire_time) {
+  return this->_storage->expire_at(std::move(key), expire_time);
+}
+
 StorageType StorageMiddleware::type(std::string key) {
   return this->_storage->type(std::move(key));
 }
@@ -48,14 +200,45 @@ std::vector<std::string> StorageMiddleware::keys(std::string_view selector) cons
   return this->_storage->keys(selector);
 }
 
+IKeyScanPtr StorageMiddleware::scan() {
+  return this->_storage->scan();
+}
+
+bool StorageMiddleware::dump(const std::string& key, RDBWriter& writer) {
+  return this->_storage->dump(key, writer);
+}
+
+void StorageMiddleware::clear() {
+  this->_storage->clear();
+
+  if (this->_aof) {
+    this->_aof_command.clear();
+    MessageEncoder(this->_aof_command).array(1).bulk("FLUSHALL");
+    this->_aof->feed(this->_aof_command);
+  }
+}
+
 ReplicaId StorageMiddleware::add_replica(SlotPtr<Message> slot_message) {
   auto id = this->_next_replica_id++;
   this->_replicas.try_emplace(id, *this, id, ReplState::MET, std::move(slot_message));
+  this->update_info();
   return id;
 }
 
 void StorageMiddleware::remove_replica(ReplicaId id) {
-  this->_replicas.erase(id);
+  auto it = this->_replicas.find(id);
+  if (it == this->_replicas.end()) {
+    return;
+  }
+
+  // pending waits stop counting it, after a reconnect it is a new replica acking from zero
+  const auto bytes_ack = it->second.bytes_ack;
+  for (auto wait_it = this->_waits.begin(), last = this->_waits.upper_bound(bytes_ack); wait_it != last; ++wait_it) {
+    --wait_it->second->replicas_ready;
+  }
+
+  this->_replicas.erase(it);
+  this->update_info();
 }
 
 bool StorageMiddleware::replica_process_conf(ReplicaId id, CommandPtr command) {
@@ -66,27 +249,457 @@ bool StorageMiddleware::replica_process_conf(ReplicaId id, CommandPtr command) {
   return false;
 }
 
-void StorageMiddleware::replica_set_state(ReplicaId id, ReplState state) {
+bool StorageMiddleware::can_partial_resync(const std::string& replid, std::size_t offset) {
+  if (replid != this->_server->info().replication.master_replid) {
+    return false;
+  }
+
+  return this->_backlog.contains(offset);
+}
+
+void StorageMiddleware::replica_start_stream(ReplicaId id, std::size_t offset) {
   auto it = this->_replicas.find(id);
   if (it != this->_replicas.end()) {
-    it->second.set_state(state);
+    it->second.start_stream(offset);
   }
 }
 
+void StorageMiddleware::replica_full_sync(ReplicaId id) {
+  auto it = this->_replicas.find(id);
+  if (it == this->_replicas.end()) {
+    return;
+  }
+
+  it->second.state = ReplState::RESYNC;
+  this->_snapshot_pending.push_back(id);
+  this->schedule_snapshot();
+}
+
+void StorageMiddleware::upstream_reset(std::size_t offset) {
+  // sub-replicas follow the history which was just dropped, they have to resync
+  for (auto& [id, handle] : this->_replicas) {
+    handle.state = ReplState::MET;
+    handle.slot_message->call(Message(Message::Type::Leave));
+  }
+
+  this->_snapshot.reset();
+  this->_snapshot_pending.clear();
+
+  this->_backlog.reset(offset);
+  this->_flushed_offset = offset;
+  this->_flush_range = {};
+  this->update_info();
+}
+
+void StorageMiddleware::upstream_feed(std::string_view raw) {
+  this->feed_backlog(raw);
+}
+
 std::size_t StorageMiddleware::count_replicas() {
   return this->_replicas.size();
 }
 
 void StorageMiddleware::wait_for(std::size_t count, std::size_t timeout_ms, SlotPtr<Message> slot_message) {
   auto wait_handle_ptr = std::make_shared<WaitHandle>(*this, count, timeout_ms, slot_message);
-  wait_handle_ptr->it = this->_waits.insert(this->_waits.end(), wait_handle_ptr);
+  wait_handle_ptr->it = this->_waits.emplace(wait_handle_ptr->target_offset, wait_handle_ptr);
   wait_handle_ptr->setup();
 }
 
-void StorageMiddleware::push(const Message & message) {
+void StorageMiddleware::process_ack(std::size_t old_offset, std::size_t new_offset) {
+  // the replica now covers exactly the waits with target in (old_offset, new_offset]
+  auto it = this->_waits.upper_bound(old_offset);
+  const auto last = this->_waits.upper_bound(new_offset);
+
+  while (it != last) {
+    auto wait = (it++)->second;
+    ++wait->replicas_ready;
+
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Wait replicas stat: " << wait->replicas_ready << "/" << wait->replicas_expected << std::endl;
+
+    if (wait->replicas_expected <= wait->replicas_ready) {
+      wait->reply();
+    }
+  }
+}
+
+void StorageMiddleware::request_ack() {
+  if (this->_getack_handle.is_pending()) {
+    return;
+  }
+
+  // one GETACK per loop iteration serves every wait registered in it
+  this->_getack_handle = this->_event_loop->post([this]() {
+    if (this->_waits.empty()) {
+      return;
+    }
+
+    if (DEBUG_LEVEL >= 1) {
+      std::cerr << "DEBUG Send getack to replicas, offset " << this->_backlog.offset() << std::endl;
+    }
+    this->start_propagate().array(3).bulk("REPLCONF").bulk("GETACK").bulk("*");
+    this->propagate();
+  });
+}
+
+void StorageMiddleware::schedule_snapshot() {
+  if (this->_snapshot || this->_snapshot_pending.empty() || this->_snapshot_start_handle.is_pending()) {
+    return;
+  }
+
+  // replicas coming during the delay or while a pass runs share the next one
+  this->_snapshot_start_handle = this->_event_loop->set_timeout(
+    this->_server->info().replication.repl_diskless_sync_delay,
+    [this]() {
+      this->start_snapshot();
+    });
+}
+
+void StorageMiddleware::start_snapshot() {
+  std::vector<ReplicaId> replicas;
+  for (auto id : std::exchange(this->_snapshot_pending, {})) {
+    if (this->_replicas.contains(id)) {
+      replicas.push_back(id);
+    }
+  }
+
+  if (replicas.empty()) {
+    return;
+  }
+
+  auto& snapshot = this->_snapshot.emplace();
+  snapshot.replicas = std::move(replicas);
+  snapshot.offset = this->_backlog.offset();
+  snapshot.eof_mark = random_hexstring(SNAPSHOT_EOF_MARK_SIZE);
+  snapshot.scan = this->_storage->scan();
+
+  const bool has_legacy = std::ranges::any_of(snapshot.replicas, [this](ReplicaId id) {
+    return !this->_replicas.at(id).capa_eof;
+  });
+  if (has_legacy) {
+    const auto& dir = this->_server->info().server.dir;
+    snapshot.spill_fd = ::open(dir.empty() ? "." : dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (snapshot.spill_fd < 0) {
+      std::cerr << "Can't open a file for replicas without EOF support: " << strerror(errno) << std::endl;
+      std::erase_if(snapshot.replicas, [this](ReplicaId id) {
+        auto& handle = this->_replicas.at(id);
+        if (handle.capa_eof) {
+          return false;
+        }
+        this->disconnect_replica(handle);
+        return true;
+      });
+    }
+  }
+
+  if (snapshot.replicas.empty()) {
+    this->_snapshot.reset();
+    return;
+  }
+
+  if (DEBUG_LEVEL >= 1) {
+    std::cerr << "DEBUG Snapshot started for " << snapshot.replicas.size() << " replica(s)"
+      << " at offset " << snapshot.offset << ", keys " << snapshot.scan->total() << std::endl;
+  }
+
+  std::ostringstream ss;
+  ss << "FULLRESYNC"
+    << " " << this->_server->info().replication.master_replid
+    << " " << snapshot.offset;
+  for (auto id : snapshot.replicas) {
+    this->_replicas.at(id).slot_message->call(Message(Message::Type::SimpleString, ss.str()));
+  }
+
+  snapshot.job = this->_event_loop->repeat([this]() {
+    this->snapshot_step();
+  });
+}
+
+void StorageMiddleware::snapshot_step() {
+  auto& snapshot = this->_snapshot.value();
+
+  // the pass goes on without waiting for sockets, it ends by resetting the snapshot
+  this->_event_loop->keep_awake();
+
+  std::erase_if(snapshot.replicas, [this](ReplicaId id) {
+    return !this->_replicas.contains(id);
+  });
+
+  // the same limit Redis puts on a replica output buffer by default
+  if (snapshot.stream.size() > SNAPSHOT_STREAM_LIMIT) {
+    std::cerr << "Writes made during the snapshot are over " << SNAPSHOT_STREAM_LIMIT << " bytes, disconnecting its replicas" << std::endl;
+    for (auto id : std::exchange(snapshot.replicas, {})) {
+      this->disconnect_replica(this->_replicas.at(id));
+    }
+  }
+
+  if (snapshot.replicas.empty()) {
+    if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Snapshot cancelled, no replicas left" << std::endl;
+    this->finish_snapshot();
+    return;
+  }
+
+  if (snapshot.scan) {
+    this->snapshot_write(snapshot);
+  } else {
+    this->snapshot_send_spilled(snapshot);
+  }
+}
+
+void StorageMiddleware::snapshot_write(SnapshotHandle& snapshot) {
+  const bool first = !snapshot.started;
+  snapshot.started = true;
+
+  std::string chunk;
+  RDBWriter writer(chunk);
+  if (first) {
+    writer.header().aux("redis-ver", "7.2.0").aux("redis-bits", "64").select_db(0).resize_db(snapshot.scan->total(), 0);
+  }
+
+  // keys gone since the pass started are skipped, newer ones may come with the stream only
+  std::vector<std::string> keys;
+  bool more = true;
+  while (more && chunk.size() < SNAPSHOT_CHUNK_SIZE) {
+    keys.clear();
+    more = snapshot.scan->next(SNAPSHOT_SCAN_KEYS, keys);
+    for (const auto& key : keys) {
+      this->_storage->dump(key, writer);
+    }
+  }
+
+  const bool done = !more;
+  if (done) {
+    writer.eof();
+  }
+
+  const bool checksum = this->_server->info().persistence.rdb_checksum;
+  if (checksum) {
+    snapshot.crc = crc64(snapshot.crc, chunk);
+  }
+  if (done) {
+    writer.checksum(checksum ? snapshot.crc : 0);
+  }
+
+  std::string framed;
+  if (first) {
+    framed.append("$EOF:").append(snapshot.eof_mark).append("\r\n");
+  }
+  framed.append(chunk);
+  if (done) {
+    framed.append(snapshot.eof_mark);
+  }
+  const auto shared = std::make_shared<const std::string>(std::move(framed));
+
+  bool has_legacy = false;
+  for (auto id : snapshot.replicas) {
+    auto& handle = this->_replicas.at(id);
+    if (handle.capa_eof) {
+      handle.slot_message->call(Message(Message::Type::Raw, shared));
+    } else {
+      has_legacy = true;
+    }
+  }
+
+  if (has_legacy) {
+    if (write_all(snapshot.spill_fd, chunk)) {
+      snapshot.spill_size += chunk.size();
+    } else {
+      std::cerr << "Can't write the snapshot for replicas without EOF support: " << strerror(errno) << std::endl;
+      std::erase_if(snapshot.replicas, [this](ReplicaId id) {
+        auto& handle = this->_replicas.at(id);
+        if (handle.capa_eof) {
+          return false;
+        }
+        this->disconnect_replica(handle);
+        return true;
+      });
+    }
+  }
+
+  if (!done) {
+    return;
+  }
+
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Snapshot written, " << snapshot.stream.size() << " bytes of stream since offset " << snapshot.offset << std::endl;
+
+  snapshot.scan.reset();
+
+  const auto stream = std::make_shared<const std::string>(snapshot.stream);
+  std::erase_if(snapshot.replicas, [this, &stream](ReplicaId id) {
+    auto& handle = this->_replicas.at(id);
+    if (!handle.capa_eof) {
+      return false;
+    }
+    this->finish_full_sync(handle, stream);
+    return true;
+  });
+
+  if (snapshot.replicas.empty()) {
+    this->finish_snapshot();
+    return;
+  }
+
+  const auto size = "$" + std::to_string(snapshot.spill_size) + "\r\n";
+  for (auto id : snapshot.replicas) {
+    this->_replicas.at(id).slot_message->call(Message(Message::Type::Raw, size));
+  }
+}
+
+// Only replicas without EOF support are left, they get the file in the same bounded chunks.
+void StorageMiddleware::snapshot_send_spilled(SnapshotHandle& snapshot) {
+  std::string chunk(std::min(SNAPSHOT_CHUNK_SIZE, snapshot.spill_size - snapshot.spill_sent), '\0');
+  auto read = ::pread(snapshot.spill_fd, chunk.data(), chunk.size(), snapshot.spill_sent);
+  if (read < 0 && errno == EINTR) {
+    return;
+  }
+  if (read <= 0) {
+    std::cerr << "Can't read the snapshot for replicas without EOF support: " << (read < 0 ? strerror(errno) : "unexpected end of file") << std::endl;
+    for (auto id : std::exchange(snapshot.replicas, {})) {
+      this->disconnect_replica(this->_replicas.at(id));
+    }
+    this->finish_snapshot();
+    return;
+  }
+
+  chunk.resize(read);
+  snapshot.spill_sent += read;
+
+  const auto shared = std::make_shared<const std::string>(std::move(chunk));
+  for (auto id : snapshot.replicas) {
+    this->_replicas.at(id).slot_message->call(Message(Message::Type::Raw, shared));
+  }
+
+  if (snapshot.spill_sent < snapshot.spill_size) {
+    return;
+  }
+
+  const auto stream = std::make_shared<const std::string>(std::move(snapshot.stream));
+  for (auto id : snapshot.replicas) {
+    this->finish_full_sync(this->_replicas.at(id), stream);
+  }
+
+  this->finish_snapshot();
+}
+
+void StorageMiddleware::finish_snapshot() {
+  this->_snapshot.reset();
+  this->schedule_snapshot();
+}
+
+void StorageMiddleware::finish_full_sync(ReplicaHandle& handle, const Message::SharedBytes& stream) {
+  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Replica #" << handle.id << " synced, streaming from offset " << this->_backlog.offset() << std::endl;
+
+  if (!stream->empty()) {
+    handle.slot_message->call(Message(Message::Type::Raw, stream));
+  }
+  handle.start_stream(this->_backlog.offset());
+}
+
+void StorageMiddleware::disconnect_replica(ReplicaHandle& handle) {
+  handle.state = ReplState::MET;
+  handle.slot_message->call(Message(Message::Type::Leave));
+}
+
+bool StorageMiddleware::is_propagating() const {
+  if (this->_server->is_replica()) {
+    return false; // replicas forward the upstream bytes instead
+  }
+
+  return !this->_replicas.empty() || this->_backlog.histlen() > 0;
+}
+
+MessageEncoder StorageMiddleware::start_propagate() {
+  this->_propagate_buffer.clear();
+  return MessageEncoder(this->_propagate_buffer);
+}
+
+void StorageMiddleware::propagate() {
+  if (!this->is_propagating()) {
+    return; // nobody ever asked for the stream, no need to keep it
+  }
+
+  this->feed_backlog(this->_propagate_buffer);
+}
+
+void StorageMiddleware::feed_backlog(std::string_view data) {
+  // a burst within one iteration must not wrap the backlog over bytes replicas did not get yet
+  if (this->_backlog.offset() - this->_flushed_offset + data.size() > this->_backlog.capacity()) {
+    this->flush();
+  }
+
+  this->_backlog.append(data);
+  this->update_info();
+
+  if (this->_snapshot) {
+    this->_snapshot->stream.append(data);
+  }
+
+  if (!this->_flush_handle.is_pending()) {
+    this->_flush_handle = this->_event_loop->post([this]() {
+      this->flush();
+    });
+  }
+}
+
+void StorageMiddleware::flush() {
   for (auto& [id, handle]: this->_replicas) {
-    handle.push(message);
+    handle.flush();
+  }
+  this->_flushed_offset = this->_backlog.offset();
+
+  // connections hold on to the bytes until written, the middleware does not need them any more
+  this->_flush_range = {};
+}
+
+StorageMiddleware::BacklogRange& StorageMiddleware::flush_range(std::size_t from) {
+  auto& cached = this->_flush_range;
+  const auto to = this->_backlog.offset();
+  if (!cached.data || cached.from != from || cached.to != to) {
+    cached = BacklogRange{
+      .from = from,
+      .to = to,
+      .data = std::make_shared<const std::string>(this->_backlog.read(from)),
+      .frame = std::nullopt};
   }
+  return cached;
+}
+
+const Message::SharedBytes& StorageMiddleware::compressed_frame(BacklogRange& range) {
+  if (range.frame) {
+    return range.frame.value();
+  }
+
+  auto started = std::chrono::steady_clock::now();
+
+  const auto& data = *range.data;
+  auto& frame = range.frame.emplace();
+  if (auto compressed = lzf_compress(data)) {
+    // REPLCONF FRAME <stream bytes> <lzf payload>, offsets keep counting the stream bytes
+    std::string encoded;
+    MessageEncoder(encoded).array(4).bulk("REPLCONF").bulk("FRAME").bulk(std::to_string(data.size())).bulk(compressed.value());
+    frame = std::make_shared<const std::string>(std::move(encoded));
+  }
+
+  auto& replication = this->_server->info().replication;
+  replication.repl_compression_frames += 1;
+  replication.repl_compression_in_bytes += data.size();
+  replication.repl_compression_out_bytes += frame ? frame->size() : data.size();
+  replication.repl_compression_cpu_usec += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+
+  return frame;
+}
+
+void StorageMiddleware::update_info() {
+  if (!this->_server) {
+    return;
+  }
+
+  auto& replication = this->_server->info().replication;
+  if (!this->_server->is_replica()) {
+    replication.master_repl_offset = this->_backlog.offset();
+  }
+  replication.connected_slaves = this->_replicas.size();
+  replication.repl_backlog_first_byte_offset = this->_backlog.first_offset() + 1;
+  replication.repl_backlog_histlen = this->_backlog.histlen();
 }
 
 StorageMiddleware::ReplicaHandle::ReplicaHandle(StorageMiddleware& parent, ReplicaId id, ReplState state, SlotPtr<Message> slot_message)
@@ -101,17 +714,34 @@ bool StorageMiddleware::ReplicaHandle::process_conf(CommandPtr command) {
 
     const auto& argv = replconf_command.args();
     const auto argc = argv.size();
-    if (argc != 2) {
-      std::cerr << "REPLCONF expects exactly 2 arguments" << std::endl;
+    if (argc % 2 != 0) {
+      std::cerr << "REPLCONF expects pairs of arguments" << std::endl;
     }
-    if (to_lower_case(argv[0]) == "ack") {
+    if (argc >= 2 && to_lower_case(argv[0]) == "capa") {
+      for (std::size_t i = 0; i + 1 < argc; i += 2) {
+        if (to_lower_case(argv[i]) != "capa") {
+          continue;
+        }
+
+        auto capa = to_lower_case(argv[i + 1]);
+        if (capa == "eof") {
+          this->capa_eof = true;
+        } else if (capa == "lzf") {
+          this->capa_lzf = true;
+        }
+      }
+    } else if (argc >= 2 && to_lower_case(argv[0]) == "ack") {
       auto maybe_bytes_ack = parseInt(argv[1].data(), argv[1].size());
       if (maybe_bytes_ack) {
+        const auto old_bytes_ack = this->bytes_ack;
         this->bytes_ack = maybe_bytes_ack.value();
 
-        for (auto it = this->parent._waits.begin(); it != this->parent._waits.end();) {
-          auto& wait = *it++;
-          wait->update_replica_ack(*this);
+        if (DEBUG_LEVEL >= 1) {
+          std::cerr << "DEBUG Replica #" << this->id << " ack " << this->bytes_ack << " bytes" << std::endl;
+        }
+
+        if (this->bytes_ack > old_bytes_ack) {
+          this->parent.process_ack(old_bytes_ack, this->bytes_ack);
         }
       }
 
@@ -121,18 +751,37 @@ bool StorageMiddleware::ReplicaHandle::process_conf(CommandPtr command) {
   return true;
 }
 
-void StorageMiddleware::ReplicaHandle::set_state(ReplState state) {
-  this->state = state;
+void StorageMiddleware::ReplicaHandle::start_stream(std::size_t offset) {
+  this->state = ReplState::WRITE;
+  this->offset = offset;
+  this->flush();
 }
 
-void StorageMiddleware::ReplicaHandle::push(const Message& message) {
-  if (this->state != ReplState::WRITE) {
+void StorageMiddleware::ReplicaHandle::flush() {
+  if (this->state != ReplState::WRITE || this->offset >= this->parent._backlog.offset()) {
+    return;
+  }
+
+  if (!this->parent._backlog.contains(this->offset)) {
+    std::cerr << "Replica #" << this->id << " fell behind replication backlog, disconnecting" << std::endl;
+    this->parent.disconnect_replica(*this);
     return;
   }
 
-  this->bytes_pushed += message.size();
+  // replicas at the same offset, the usual case, get references to one copy of the bytes
+  auto& range = this->parent.flush_range(this->offset);
+
+  if (this->capa_lzf && range.data->size() >= REPL_COMPRESS_MIN_SIZE) {
+    const auto& frame = this->parent.compressed_frame(range);
+    if (frame) {
+      this->slot_message->call(Message(Message::Type::Raw, frame));
+      this->offset = this->parent._backlog.offset();
+      return;
+    }
+  }
 
-  this->slot_message->call(message);
+  this->slot_message->call(Message(Message::Type::Raw, range.data));
+  this->offset = this->parent._backlog.offset();
 }
 
 StorageMiddleware::WaitHandle::WaitHandle(
@@ -142,6 +791,8 @@ StorageMiddleware::WaitHandle::WaitHandle(
   SlotPtr<Message> slot_message)
     : parent(parent)
     , replicas_expected(count)
+    , replicas_ready(0)
+    , target_offset(parent._backlog.offset())
     , timeout_ms(timeout_ms)
     , slot_message(slot_message) {
   this->replicas_expected = std::min(this->replicas_expected, this->parent._replicas.size());
@@ -149,45 +800,15 @@ StorageMiddleware::WaitHandle::WaitHandle(
     std::cerr << "DEBUG Wait add" << std::endl;
     std::cerr << "  replicas_expected requested = " << count << std::endl;
     std::cerr << "  replicas_expected = " << this->replicas_expected << std::endl;
+    std::cerr << "  target_offset = " << this->target_offset << std::endl;
     std::cerr << "  timeout_ms = " << this->timeout_ms << std::endl;
   }
 }
 
-void StorageMiddleware::WaitHandle::update_replica_ack(ReplicaHandle& replica) {
-  auto it = this->replica_ack_waitlist.find(replica.id);
-  if (it == this->replica_ack_waitlist.end()) {
-    return;
-  }
-
-  auto expected_bytes = it->second;
-  this->replica_ack_waitlist.erase(it);
-
-  if (DEBUG_LEVEL >= 1) {
-    std::cerr << "DEBUG Wait recieved ack from repl #" << replica.id
-      << " ack " << replica.bytes_ack << " bytes,"
-      << " expected " << expected_bytes << " bytes" << std::endl;
-  }
-
-  if (replica.bytes_ack < expected_bytes) {
-    return;
-  }
-
-  ++this->replicas_ready;
-
-  if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Wait replicas stat: " << this->replicas_ready << "/" << this->replicas_expected << std::endl;
-
-  if (this->replicas_expected <= this->replicas_ready) {
-    this->reply();
-  }
-}
-
 void StorageMiddleware::WaitHandle::setup() {
-  this->replicas_ready = 0;
-  for (auto& [id, handle] : this->parent._replicas) {
-    if (handle.bytes_ack >= handle.bytes_pushed) {
+  for (const auto& [id, handle] : this->parent._replicas) {
+    if (handle.bytes_ack >= this->target_offset) {
       ++this->replicas_ready;
-    } else {
-      this->replica_ack_waitlist[id] = handle.bytes_pushed;
     }
   }
 
@@ -198,12 +819,7 @@ void StorageMiddleware::WaitHandle::setup() {
     return;
   }
 
-  for (auto& [id, bytes_expected] : this->replica_ack_waitlist) {
-    if (DEBUG_LEVEL >= 1) {
-      std::cerr << "DEBUG Send getack to repl #" << id << ", expected " << bytes_expected << " bytes" << std::endl;
-    }
-    this->parent._replicas.at(id).push(ReplConfCommand("GETACK", "*").construct());
-  }
+  this->parent.request_ack();
 
   this->timeout = this->parent._event_loop->set_timeout(this->timeout_ms, [this]() {
     if (DEBUG_LEVEL >= 1) std::cerr << "DEBUG Wait timeout" << std::endl;
@@ -220,3 +836,63 @@ void StorageMiddleware::WaitHandle::reply() {
   this->timeout.invalidate();
   parent._waits.erase(this->it);
 }
+
+// The log is replayed at some later time, so it gets the deadline instead of the timeout.
+void StorageMiddleware::aof_set(const std::string& key, const std::string& value, std::optional<Timepoint> expire_time) {
+  this->_aof_command.clear();
+  MessageEncoder encoder(this->_aof_command);
+
+  if (expire_time) {
+    auto expire_at = std::chrono::duration_cast<std::chrono::milliseconds>(expire_time.value().time_since_epoch()).count();
+    encoder.array(5).bulk("SET").bulk(key).bulk(value).bulk("PXAT").bulk(std::to_string(expire_at));
+  } else {
+    encoder.array(3).bulk("SET").bulk(key).bulk(value);
+  }
+
+  this->_aof->feed(this->_aof_command);
+}
+
+// One command with all the elements, then the deadline, the loader rebuilds the same blob from it.
+void StorageMiddleware::aof_aggregate(const std::string& key, const RDBAggregate& value, std::optional<Timepoint> expire_time) {
+  this->_aof_command.clear();
+  MessageEncoder encoder(this->_aof_command);
+
+  const bool pairs = value.type == RDBAggregate::Type::ZSet || value.type == RDBAggregate::Type::Hash;
+  encoder.array(2 + (pairs ? 2 : 1) * value.length);
+
+  switch (value.type) {
+    case RDBAggregate::Type::List: encoder.bulk("RPUSH"); break;
+    case RDBAggregate::Type::Set: encoder.bulk("SADD"); break;
+    case RDBAggregate::Type::ZSet: encoder.bulk("ZADD"); break;
+    case RDBAggregate::Type::Hash: encoder.bulk("HSET"); break;
+  }
+  encoder.bulk(key);
+
+  if (value.encoding == RDBAggregate::Encoding::Intset) {
+    IntsetReader set(value.data);
+    while (auto member = set.next()) {
+      encoder.bulk(std::to_string(member.value()));
+    }
+  } else if (value.type == RDBAggregate::Type::ZSet) {
+    // members come before their scores in the listpack, ZADD wants them the other way round
+    ListpackReader lp(value.data);
+    while (auto member = lp.next_string()) {
+      auto score = lp.next_string();
+      encoder.bulk(score.value_or("0")).bulk(member.value());
+    }
+  } else {
+    ListpackReader lp(value.data);
+    while (auto element = lp.next_string()) {
+      encoder.bulk(element.value());
+    }
+  }
+
+  this->_aof->feed(this->_aof_command);
+
+  if (expire_time) {
+    auto expire_at = std::chrono::duration_cast<std::chrono::milliseconds>(expire_time.value().time_since_epoch()).count();
+    this->_aof_command.clear();
+    MessageEncoder(this->_aof_command).array(3).bulk("PEXPIREAT").bulk(key).bulk(std::to_string(expire_at));
+    this->_aof->feed(this->_aof_command);
+  }
+}
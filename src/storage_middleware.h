@@ -1,15 +1,22 @@
 #pragma once
 
+#include "append_only_file.h"
 #include "command.h"
 #include "message.h"
 #include "events.h"
 #include "rdb_parser.h"
+#include "rdb_writer.h"
+#include "replication_backlog.h"
+#include "server.h"
 #include "signal_slot.h"
 #include "storage.h"
 
-#include <list>
+#include <map>
 #include <memory>
+#include <optional>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 using ReplicaId = std::size_t;
 
@@ -25,7 +32,13 @@ public:
   virtual ReplicaId add_replica(SlotPtr<Message> slot_command) = 0;
   virtual void remove_replica(ReplicaId) = 0;
   virtual bool replica_process_conf(ReplicaId, CommandPtr) = 0;
-  virtual void replica_set_state(ReplicaId, ReplState) = 0;
+  virtual bool can_partial_resync(const std::string& replid, std::size_t offset) = 0;
+  virtual void replica_start_stream(ReplicaId, std::size_t offset) = 0;
+  virtual void replica_full_sync(ReplicaId) = 0;
+
+  // on a replica: the stream from its own master, forwarded to sub-replicas as is
+  virtual void upstream_reset(std::size_t offset) = 0;
+  virtual void upstream_feed(std::string_view raw) = 0;
   virtual std::size_t count_replicas() = 0;
   virtual void wait_for(std::size_t count, std::size_t timeout_ms, SlotPtr<Message> slot_message) = 0;
 };
@@ -39,20 +52,62 @@ class StorageMiddleware : public IStorage, public IReplicasManager {
     ReplState state;
     SlotPtr<Message> slot_message;
 
-    std::size_t bytes_pushed = 0;
+    std::size_t offset = 0;
     std::size_t bytes_ack = 0;
 
+    bool capa_eof = false;
+    bool capa_lzf = false;
+
     ReplicaHandle(StorageMiddleware&, ReplicaId id, ReplState state, SlotPtr<Message> slot_message);
 
     bool process_conf(CommandPtr);
-    void set_state(ReplState);
+    void start_stream(std::size_t offset);
+
+    void flush();
+  };
 
-    void push(const Message&);
+  // One pass over the keyspace, shared by every replica that joined before it started.
+  // The RDB is produced in bounded chunks, one per event loop iteration, and goes
+  // straight into replica connections. Writes made meanwhile are collected in `stream`
+  // and sent after the payload, the backlog may have wrapped over them by then.
+  struct SnapshotHandle {
+    SnapshotHandle() = default;
+    SnapshotHandle(const SnapshotHandle&) = delete;
+    SnapshotHandle& operator=(const SnapshotHandle&) = delete;
+    ~SnapshotHandle();
+
+    std::size_t offset;
+    std::string eof_mark;
+    std::vector<ReplicaId> replicas;
+
+    IKeyScanPtr scan; // null once the whole keyspace is written
+    bool started = false;
+    std::uint64_t crc = 0; // over the RDB bytes written so far
+
+    std::string stream; // replication stream from `offset` on
+
+    // Replicas which can not take an EOF framed payload need its size up front, for them
+    // the RDB goes to an unnamed file and is sent from there once it is complete.
+    int spill_fd = -1;
+    std::size_t spill_size = 0;
+    std::size_t spill_sent = 0;
+
+    EventLoop::JobHandle job;
+  };
+
+  // Last range of the stream read out of the backlog, replicas flushed from the same offset
+  // share the bytes and the compressed frame made of them.
+  struct BacklogRange {
+    std::size_t from = 0;
+    std::size_t to = 0;
+    Message::SharedBytes data;
+    std::optional<Message::SharedBytes> frame; // null when the range did not compress
   };
 
   struct WaitHandle;
   using WaitHandlePtr = std::shared_ptr<WaitHandle>;
-  using WaitList = std::list<WaitHandlePtr>;
+  // pending waits ordered by the offset replicas have to acknowledge
+  using WaitMap = std::multimap<std::size_t, WaitHandlePtr>;
 
   struct WaitHandle {
     WaitHandle(StorageMiddleware&, std::size_t count, std::size_t timeout_ms, SlotPtr<Message> slot_message);
@@ -61,17 +116,15 @@ class StorageMiddleware : public IStorage, public IReplicasManager {
 
     std::size_t replicas_expected;
     std::size_t replicas_ready;
+    std::size_t target_offset;
 
     std::size_t timeout_ms;
     EventLoop::JobHandle timeout;
 
     SlotPtr<Message> slot_message;
 
-    WaitList::iterator it;
-
-    std::unordered_map<ReplicaId, std::size_t> replica_ack_waitlist;
+    WaitMap::iterator it;
 
-    void update_replica_ack(ReplicaHandle&);
     void setup();
     void reply();
   };
@@ -80,8 +133,13 @@ public:
   StorageMiddleware(EventLoopPtr event_loop);
 
   void set_storage(IStoragePtr);
+  void set_server(ServerPtr);
+  void set_aof(AppendOnlyFilePtr);
 
   void restore(std::string key, std::string value, std::optional<Timepoint> expire_time) override;
+  void restore_stream(std::string key, RDBStream stream) override;
+  void restore_aggregate(std::string key, RDBAggregate value, std::optional<Timepoint> expire_time) override;
+  void resize_db(std::size_t keys, std::size_t expires) override;
 
   void set(std::string key, std::string value, std::optional<int> expire_ms) override;
   std::optional<std::string> get(std::string key) override;
@@ -89,15 +147,29 @@ public:
   std::tuple<StreamId, StreamErrorType> xadd(std::string key, InputStreamId id, StreamPartValue values) override;
   StreamRange xrange(std::string key, BoundStreamId left_id, BoundStreamId right_id) override;
   void xread(StreamsReadRequest, std::optional<std::size_t> block_ms, std::function<void(StreamsReadResult)> callback) override;
+  std::tuple<std::size_t, StreamErrorType> xlen(std::string key) override;
+  std::tuple<StreamInfo, StreamErrorType> xinfo(std::string key) override;
+
+  bool expire_at(std::string key, Timepoint expire_time) override;
 
   StorageType type(std::string key) override;
 
   std::vector<std::string> keys(std::string_view selector) const override;
+  IKeyScanPtr scan() override;
+
+  bool dump(const std::string& key, RDBWriter& writer) override;
+
+  void clear() override;
 
   ReplicaId add_replica(SlotPtr<Message> slot_message) override;
   void remove_replica(ReplicaId) override;
   bool replica_process_conf(ReplicaId, CommandPtr) override;
-  void replica_set_state(ReplicaId, ReplState) override;
+  bool can_partial_resync(const std::string& replid, std::size_t offset) override;
+  void replica_start_stream(ReplicaId, std::size_t offset) override;
+  void replica_full_sync(ReplicaId) override;
+
+  void upstream_reset(std::size_t offset) override;
+  void upstream_feed(std::string_view raw) override;
 
   std::size_t count_replicas() override;
   void wait_for(std::size_t count, std::size_t timeout_ms, SlotPtr<Message> slot_message) override;
@@ -106,11 +178,48 @@ private:
   EventLoopPtr _event_loop;
 
   IStoragePtr _storage;
+  ServerPtr _server;
+  AppendOnlyFilePtr _aof;
+
+  ReplicationBacklog _backlog;
+  std::string _propagate_buffer;
+  std::string _propagate_tail;
+  EventLoop::JobHandle _flush_handle;
+  std::size_t _flushed_offset = 0;
+  BacklogRange _flush_range;
+  std::string _aof_command;
 
   ReplicaId _next_replica_id = 0;
   std::unordered_map<ReplicaId, ReplicaHandle> _replicas;
 
-  WaitList _waits;
-
-  void push(const Message&);
+  std::optional<SnapshotHandle> _snapshot;
+  std::vector<ReplicaId> _snapshot_pending;
+  EventLoop::JobHandle _snapshot_start_handle;
+
+  WaitMap _waits;
+  EventLoop::JobHandle _getack_handle;
+
+  void schedule_snapshot();
+  void start_snapshot();
+  void snapshot_step();
+  void snapshot_write(SnapshotHandle&);
+  void snapshot_send_spilled(SnapshotHandle&);
+  void finish_snapshot();
+  void finish_full_sync(ReplicaHandle&, const Message::SharedBytes& stream);
+  void disconnect_replica(ReplicaHandle&);
+
+  void process_ack(std::size_t old_offset, std::size_t new_offset);
+  void request_ack();
+
+  bool is_propagating() const;
+  MessageEncoder start_propagate();
+  void propagate();
+  void feed_backlog(std::string_view data);
+  void flush();
+  BacklogRange& flush_range(std::size_t from);
+  const Message::SharedBytes& compressed_frame(BacklogRange&);
+  void update_info();
+
+  void aof_set(const std::string& key, const std::string& value, std::optional<Timepoint> expire_time);
+  void aof_aggregate(const std::string& key, const RDBAggregate& value, std::optional<Timepoint> expire_time);
 };
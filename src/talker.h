@@ -6,14 +6,22 @@
 #include <deque>
 #include <memory>
 #include <optional>
+#include <string_view>
 #include <type_traits>
 
 class Talker {
 public:
-  virtual void listen(Message message) = 0;
+  // raw holds the message bytes exactly as they came in, valid during the call only,
+  // and is empty unless wants_raw() asked for them
+  virtual void listen(Message message, std::string_view raw) = 0;
+  virtual bool wants_raw() const { return false; }
   virtual std::optional<Message> say();
   virtual void interrupt() {};
 
+  // called around every drain of the read buffer, bytes_read is what the wakeup brought
+  virtual void batch_started(std::size_t /* bytes_read */) {};
+  virtual void batch_finished() {};
+
   virtual Message::Type expected() = 0;
 
 protected:
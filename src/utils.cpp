@@ -104,6 +104,12 @@ std::string to_lower_case(std::string_view view) {
   return result;
 }
 
+bool equals_ignore_case(std::string_view lhs, std::string_view rhs) {
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](unsigned char a, unsigned char b) {
+    return std::tolower(a) == std::tolower(b);
+  });
+}
+
 std::string to_upper_case(std::string_view view) {
   std::string result{view.begin(), view.end()};
   std::transform(result.begin(), result.end(), result.begin(), [](unsigned char ch) { return std::toupper(ch); });
@@ -25,6 +25,8 @@ std::optional<std::uint64_t> parseUInt64(const char* first, std::size_t size);
 std::string to_lower_case(std::string_view);
 std::string to_upper_case(std::string_view);
 
+bool equals_ignore_case(std::string_view, std::string_view);
+
 template <typename T>
 std::string demangled() {
   int status;
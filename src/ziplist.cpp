@@ -0,0 +1,124 @@
+#include "ziplist.h"
+
+#include "utils.h"
+
+#include <stdexcept>
+
+namespace {
+
+constexpr std::size_t ZL_HEADER_SIZE = 10;
+constexpr std::uint8_t ZL_END = 0xFF;
+constexpr std::uint8_t ZL_BIG_PREVLEN = 0xFE;
+
+enum Encoding : std::uint8_t {
+  ZIP_STR_06B = 0x00,
+  ZIP_STR_14B = 0x40,
+  ZIP_STR_32B = 0x80,
+  ZIP_INT_16B = 0xC0,
+  ZIP_INT_32B = 0xD0,
+  ZIP_INT_64B = 0xE0,
+  ZIP_INT_24B = 0xF0,
+  ZIP_INT_8B = 0xFE,
+  ZIP_INT_IMM_MIN = 0xF1,
+  ZIP_INT_IMM_MAX = 0xFD,
+};
+
+std::uint64_t read_le(std::string_view data, std::size_t pos, std::size_t bytes) {
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < bytes; ++i) {
+    value |= std::uint64_t(static_cast<std::uint8_t>(data[pos + i])) << (8 * i);
+  }
+  return value;
+}
+
+// the only big endian field, the 32 bit string length
+std::uint32_t read_be32(std::string_view data, std::size_t pos) {
+  std::uint32_t value = 0;
+  for (std::size_t i = 0; i < 4; ++i) {
+    value = (value << 8) | static_cast<std::uint8_t>(data[pos + i]);
+  }
+  return value;
+}
+
+std::int64_t to_signed(std::uint64_t value, std::size_t bits) {
+  if (bits < 64 && value >= (std::uint64_t(1) << (bits - 1))) {
+    return static_cast<std::int64_t>(value) - (std::int64_t(1) << bits);
+  }
+  return static_cast<std::int64_t>(value);
+}
+
+} // namespace
+
+ZiplistReader::ZiplistReader(std::string_view data)
+  : _data(data)
+  , _pos(ZL_HEADER_SIZE)
+{
+  if (data.size() < ZL_HEADER_SIZE + 1 || read_le(data, 0, 4) != data.size()) {
+    throw std::runtime_error("Malformed ziplist header");
+  }
+}
+
+std::optional<ZiplistReader::Element> ZiplistReader::next() {
+  auto need = [this](std::size_t count) {
+    if (this->_pos + count > this->_data.size()) {
+      throw std::runtime_error("Ziplist element out of bounds");
+    }
+  };
+
+  need(1);
+  auto first = static_cast<std::uint8_t>(this->_data[this->_pos]);
+  if (first == ZL_END) {
+    return {};
+  }
+
+  // the length of the previous entry, only needed to walk backwards
+  this->_pos += first == ZL_BIG_PREVLEN ? 5 : 1;
+
+  need(1);
+  const auto encoding = static_cast<std::uint8_t>(this->_data[this->_pos]);
+
+  auto take_string = [&](std::size_t header, std::size_t length) -> Element {
+    need(header + length);
+    auto result = this->_data.substr(this->_pos + header, length);
+    this->_pos += header + length;
+    return result;
+  };
+
+  auto take_integer = [&](std::size_t bytes) -> Element {
+    need(1 + bytes);
+    auto result = to_signed(read_le(this->_data, this->_pos + 1, bytes), bytes * 8);
+    this->_pos += 1 + bytes;
+    return result;
+  };
+
+  switch (encoding & 0xC0) {
+    case ZIP_STR_06B:
+      return take_string(1, encoding & 0x3f);
+    case ZIP_STR_14B:
+      need(2);
+      return take_string(2, (std::size_t(encoding & 0x3f) << 8) | static_cast<std::uint8_t>(this->_data[this->_pos + 1]));
+    case ZIP_STR_32B:
+      if (encoding != ZIP_STR_32B) {
+        break;
+      }
+      need(5);
+      return take_string(5, read_be32(this->_data, this->_pos + 1));
+  }
+
+  if (encoding == ZIP_INT_8B) {
+    return take_integer(1);
+  } else if (encoding == ZIP_INT_16B) {
+    return take_integer(2);
+  } else if (encoding == ZIP_INT_24B) {
+    return take_integer(3);
+  } else if (encoding == ZIP_INT_32B) {
+    return take_integer(4);
+  } else if (encoding == ZIP_INT_64B) {
+    return take_integer(8);
+  } else if (encoding >= ZIP_INT_IMM_MIN && encoding <= ZIP_INT_IMM_MAX) {
+    ++this->_pos;
+    return std::int64_t((encoding & 0x0f) - 1);
+  }
+
+  throw std::runtime_error(print_args("Unknown ziplist encoding 0x", to_hex(encoding)));
+}
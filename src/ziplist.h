@@ -0,0 +1,23 @@
+#pragma once
+
+#include "listpack.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Ziplist, the compact encoding Redis used before listpacks. Only read from older
+// RDB files, elements come back the same way ListpackReader gives them.
+class ZiplistReader {
+public:
+  using Element = ListpackReader::Element;
+
+  // Throws std::runtime_error when the blob has no valid header.
+  explicit ZiplistReader(std::string_view data);
+
+  std::optional<Element> next();
+
+private:
+  std::string_view _data;
+  std::size_t _pos;
+};
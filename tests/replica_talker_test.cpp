@@ -0,0 +1,132 @@
+#include "crc64.h"
+#include "events.h"
+#include "message.h"
+#include "rdb_writer.h"
+#include "replica_talker.h"
+#include "server.h"
+#include "storage.h"
+#include "storage_middleware.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+ServerPtr make_server(EventLoopPtr event_loop) {
+  char name[] = "replica_talker_test";
+  char* argv[] = {name};
+  return std::make_shared<Server>(event_loop, ServerInfo::build(1, argv));
+}
+
+// A replica talker which went through the handshake and waits for the RDB of a full sync.
+struct FullSync {
+  EventLoopPtr event_loop = std::make_shared<EventLoop>();
+  ServerPtr server = make_server(event_loop);
+  std::shared_ptr<Storage> storage = std::make_shared<Storage>(event_loop);
+  std::shared_ptr<StorageMiddleware> middleware = std::make_shared<StorageMiddleware>(event_loop);
+  ReplicaTalker talker;
+
+  FullSync() {
+    this->middleware->set_storage(this->storage);
+    this->middleware->set_server(this->server);
+
+    this->talker.set_server(this->server);
+    this->talker.set_storage(this->middleware);
+    this->talker.set_replicas_manager(this->middleware);
+
+    for (const auto* answer : {"PONG", "OK", "OK", "FULLRESYNC 8371b4fb1155b71f4a04d3e1bc3e18c4a990aeeb 0"}) {
+      this->talker.listen(Message(Message::Type::SimpleString, std::string(answer)), {});
+    }
+    this->drain();
+  }
+
+  void feed(const std::string& chunk) {
+    this->talker.listen(Message(Message::Type::SyncChunk, chunk), {});
+  }
+
+  // what the talker has to say since the last call, by type
+  std::vector<Message::Type> drain() {
+    std::vector<Message::Type> said;
+    while (auto message = this->talker.say()) {
+      said.push_back(message->type());
+    }
+    return said;
+  }
+
+  bool leaving() {
+    auto said = this->drain();
+    return std::find(said.begin(), said.end(), Message::Type::Leave) != said.end();
+  }
+};
+
+std::string rdb_payload() {
+  std::string payload;
+  RDBWriter writer(payload);
+  writer.header().select_db(0).resize_db(2, 0);
+  writer.string_entry("first", "value of the first key", {});
+  writer.string_entry("second", "value of the second key", {});
+  writer.eof().checksum(crc64(0, payload));
+  return payload;
+}
+
+void test_valid_payload() {
+  FullSync sync;
+  sync.feed(rdb_payload());
+  sync.feed("");
+
+  check(!sync.leaving(), "valid payload: the link stays");
+  check(sync.server->info().replication.master_link_status == "up", "valid payload: the link is up");
+  check(sync.storage->get("second") == "value of the second key", "valid payload: keys are loaded");
+}
+
+void test_corrupt_checksum() {
+  auto payload = rdb_payload();
+  payload[payload.find("first")] ^= 0x20;
+
+  FullSync sync;
+  sync.feed(payload);
+  check(sync.leaving(), "corrupt checksum: the link leaves");
+
+  // the end of the payload still comes, the failed load must not be finished
+  sync.feed("");
+  check(sync.server->info().replication.master_link_status != "up", "corrupt checksum: the link is not up");
+}
+
+void test_corrupt_header() {
+  auto payload = rdb_payload();
+  payload.replace(0, 5, "RADIS");
+
+  FullSync sync;
+  sync.feed(payload.substr(0, 16));
+  check(sync.leaving(), "corrupt header: the link leaves");
+
+  sync.feed(payload.substr(16));
+  sync.feed("");
+  check(sync.server->info().replication.master_link_status != "up", "corrupt header: the link is not up");
+}
+
+} // namespace
+
+int main() {
+  test_valid_payload();
+  test_corrupt_checksum();
+  test_corrupt_header();
+
+  if (failures > 0) {
+    std::cerr << failures << " check(s) failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}